@@ -106,6 +106,15 @@ enum class EGamemode
 	Mania,
 };
 
+// Latency-sensitive work, such as new scores, is served ahead of throughput-oriented work, such as sweeps.
+enum class EPriority
+{
+	High,
+	Low,
+};
+
+const size_t s_numPriorities = 2;
+
 inline EMods MaskRelevantDifficultyMods(EGamemode mode, EMods mods)
 {
 	switch (mode)
@@ -128,6 +137,25 @@ inline EMods MaskRelevantDifficultyMods(EGamemode mode, EMods mods)
 	}
 }
 
+// 64-bit FNV-1a over the bytes of the combined integers, least significant byte first
+class Fnv1aHash
+{
+public:
+	void Combine(u64 value)
+	{
+		for (u32 i = 0; i < sizeof(value); ++i)
+		{
+			_hash ^= (value >> (8 * i)) & 0xFF;
+			_hash *= 1099511628211ull;
+		}
+	}
+
+	u64 Value() const { return _hash; }
+
+private:
+	u64 _hash = 14695981039346656037ull;
+};
+
 std::string ToString(EMods mods);
 
 std::string GamemodeSuffix(EGamemode gamemode);
@@ -135,4 +163,6 @@ std::string GamemodeName(EGamemode gamemode);
 std::string GamemodeTag(EGamemode gamemode);
 EGamemode ToGamemode(std::string modeString);
 
+std::string PriorityTag(EPriority priority);
+
 PP_NAMESPACE_END
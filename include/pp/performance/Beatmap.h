@@ -61,6 +61,17 @@ class Beatmap
 	void SetDifficultyAttribute(EMods mods, EDifficultyAttributeType type, f32 value);
 	void SetMode(EGamemode mode) { _mode = mode; }
 
+	// Changes whenever the difficulty or blacklisting changes in ways that affect the pp of its scores
+	u64 DifficultyHash(bool isBlacklisted) const;
+
+	// Whether scores on both beatmaps are worth the same
+	bool HasSameDifficulty(const Beatmap& other) const
+	{
+		return _rankedStatus == other._rankedStatus && _scoreVersion == other._scoreVersion &&
+			_numHitCircles == other._numHitCircles && _numSliders == other._numSliders && _numSpinners == other._numSpinners &&
+			_difficulty == other._difficulty;
+	}
+
 	static bool ContainsAttribute(const std::string &difficultyAttributeName)
 	{
 		return s_difficultyAttributes.find(difficultyAttributeName) != s_difficultyAttributes.end();
@@ -71,6 +82,15 @@ class Beatmap
 		return s_difficultyAttributes.at(difficultyAttributeName);
 	}
 
+	static std::string DifficultyAttributeName(EDifficultyAttributeType type)
+	{
+		for (const auto& attribute : s_difficultyAttributes)
+			if (attribute.second == type)
+				return attribute.first;
+
+		return "";
+	}
+
 private:
 	static const std::unordered_map<std::string, EDifficultyAttributeType> s_difficultyAttributes;
 
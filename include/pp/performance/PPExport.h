@@ -0,0 +1,130 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+PP_NAMESPACE_BEGIN
+
+DEFINE_EXCEPTION(ExportException);
+
+// Receives computed pp in place of the database, such that computation can be measured or a formula
+// change compared without touching any tables. Rows are buffered and written in large chunks to a temporary
+// file, which only replaces the path once the export was finished without any error.
+//
+// Files ending in ".csv" hold one line per row, either
+//   score,<score_id>,<user_id>,<beatmap_id>,<mods>,<pp>,<accuracy>,<stored pp>
+//   user,<user_id>,<pp>,<accuracy>,<stored pp>
+// where the stored pp are empty if null.
+//
+// Any other file is binary and columnar. It begins with "PPEXPORT" and a u32 version, followed by blocks
+// of rows of one kind. Each block is a char ('S' or 'U') and a u32 number of rows, followed by each of its
+// columns in turn. All numbers are stored in native byte order and null stored pp as NaN.
+//   Scores: s64 score_id, s64 user_id, s32 beatmap_id, u32 mods, f32 pp, f32 accuracy, f32 stored pp
+//   Users:  s64 user_id, f64 pp, f64 accuracy, f64 stored pp
+class PPExport
+{
+public:
+	struct ScoreRow
+	{
+		s64 ScoreId;
+		s64 UserId;
+		s32 BeatmapId;
+		EMods Mods;
+		f32 PP;
+		f32 Accuracy;
+
+		bool HasStoredPP;
+		f32 StoredPP;
+	};
+
+	struct UserRow
+	{
+		s64 UserId;
+		f64 PP;
+		f64 Accuracy;
+
+		bool HasStoredPP;
+		f64 StoredPP;
+	};
+
+	// Differences to the stored pp are only gathered if summarizeDifferences is set.
+	PPExport(const std::string& path, bool summarizeDifferences);
+	~PPExport();
+
+	PPExport& operator=(const PPExport&) = delete;
+	PPExport(const PPExport&) = delete;
+
+	void Add(const std::vector<ScoreRow>& scores);
+	void Add(const UserRow& user);
+
+	// Writes everything buffered, moves the file into place, and logs the summary of differences, if any.
+	// Throws the first error any write ran into. Exports destroyed without being finished are discarded.
+	void Finish();
+
+private:
+	static const u32 s_version;
+	static const size_t s_blockSize;
+	static const size_t s_csvBufferSize;
+
+	// Distribution of the differences between computed and stored pp
+	struct Differences
+	{
+		u64 NumRows = 0;
+		u64 NumWithoutStored = 0;
+		u64 NumIncreased = 0;
+		u64 NumDecreased = 0;
+
+		f64 Sum = 0;
+		f64 SumAbsolute = 0;
+
+		f64 LargestIncrease = 0;
+		s64 LargestIncreaseId = 0;
+		f64 LargestDecrease = 0;
+		s64 LargestDecreaseId = 0;
+
+		// Amount of absolute differences below 0.01, 0.1, 1, 10, 100, and above
+		u64 Histogram[6] = {};
+
+		void Add(s64 id, bool hasStored, f64 stored, f64 value);
+		void Log(const std::string& name) const;
+	};
+
+	void flushNonThreadsafe();
+	void flushScoresNonThreadsafe();
+	void flushUsersNonThreadsafe();
+	void flushCsvNonThreadsafe();
+
+	void write(const void* pData, size_t size);
+
+	template <typename T>
+	void writeColumn(const std::vector<T>& column)
+	{
+		write(column.data(), column.size() * sizeof(T));
+	}
+
+	std::string _path;
+	std::string _tmpPath;
+	std::FILE* _pFile = nullptr;
+
+	// First write which failed. Empty as long as none did.
+	std::string _error;
+	bool _isCsv;
+
+	bool _summarizeDifferences;
+	Differences _scoreDifferences;
+	Differences _userDifferences;
+
+	u64 _numScores = 0;
+	u64 _numUsers = 0;
+
+	std::string _csv;
+	std::vector<ScoreRow> _scores;
+	std::vector<UserRow> _users;
+
+	std::mutex _mutex;
+};
+
+PP_NAMESPACE_END
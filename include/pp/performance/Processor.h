@@ -5,11 +5,22 @@
 #include <pp/performance/Beatmap.h>
 #include <pp/performance/CURL.h>
 #include <pp/performance/DDog.h>
+#include <pp/performance/PPExport.h>
 #include <pp/performance/User.h>
+#include <pp/performance/UserStatsCache.h>
 
+#include <pp/shared/AsyncDatabase.h>
+#include <pp/shared/ConnectionPool.h>
 #include <pp/shared/DatabaseConnection.h>
+#include <pp/shared/Executor.h>
+#include <pp/shared/LeaseSet.h>
+#include <pp/shared/RPCServer.h>
 #include <pp/shared/Threading.h>
+#include <pp/shared/UpdateBatch.h>
+#include <pp/shared/WakeupSocket.h>
+#include <pp/shared/WriteQueue.h>
 
+#include <deque>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -25,12 +36,34 @@ class Processor
 	~Processor();
 
 	void MonitorNewScores();
-	void ProcessAllUsers(bool reProcess, u32 numThreads);
+	// Only users with scores on beatmaps whose difficulty changed since the last complete run are computed if onlyOutdated
+	// is set, unless the formula changed in the meantime.
+	void ProcessAllUsers(bool reProcess, u32 numThreads, bool onlyOutdated = false);
+
+	// Shares the computation of all users with other workers by leasing ranges of user IDs.
+	// Begins a new run if reProcess is set and there is none in progress.
+	void ProcessAllUsersDistributed(bool reProcess, u32 numThreads);
 	void ProcessUsers(const std::vector<std::string>& userNames);
 	void ProcessUsers(const std::vector<s64>& userIds);
 	void ProcessScores(const std::vector<s64>& scoreIds);
+
+	// Recomputes the scores on the given beatmaps, followed by the totals of their players
+	void ProcessBeatmaps(const std::vector<s32>& beatmapIds, u32 numThreads);
 	void ProcessSQL(u32 numThreads, std::string sql);
 
+	// Monitors new scores while repeatedly recomputing all users in the background.
+	// The background work yields whenever new scores pile up.
+	void Serve(u32 numThreads);
+
+	// Subsequent 'all', 'sql', 'users', and 'scores' write computed pp to the given file instead of the database,
+	// leaving all tables untouched. FinishExport writes what remains and logs the summary of differences.
+	void ExportTo(const std::string& path, bool summarizeDifferences);
+	void FinishExport();
+
+	// Answers requests for the pp of scores, the recomputation of users, and the difficulty attributes of
+	// beatmaps over a local socket. Difficulty attributes are held in memory across requests.
+	void ServeRPC(u32 numThreads);
+
 private:
 	static const Beatmap::ERankedStatus s_minRankedStatus;
 	static const Beatmap::ERankedStatus s_maxRankedStatus;
@@ -45,6 +78,27 @@ class Processor
 		return StrFormat("pp_last_user_id{0}", GamemodeSuffix(_gamemode));
 	}
 
+	std::string formulaVersionKey()
+	{
+		return StrFormat("pp_formula_version{0}", GamemodeSuffix(_gamemode));
+	}
+
+	std::string allRangesKey()
+	{
+		return StrFormat("pp_all_ranges{0}", GamemodeSuffix(_gamemode));
+	}
+
+	std::string allRangeSizeKey()
+	{
+		return StrFormat("pp_all_range_size{0}", GamemodeSuffix(_gamemode));
+	}
+
+	// Holds the last user ID up to which the range is done
+	std::string rangeCheckpointKey(u32 range)
+	{
+		return StrFormat("pp_all_range{0}_{1}", GamemodeSuffix(_gamemode), range);
+	}
+
 	struct
 	{
 		std::string MySqlMasterHost;
@@ -60,9 +114,76 @@ class Processor
 		std::string MySqlSlavePassword;
 		std::string MySqlSlaveDatabase;
 
+		// Number of non-blocking connections used by 'all' and 'sql'. 0 uses the connection pool instead.
+		u32 MySqlAsyncConnections;
+
+		// Number of master connections shared by all background writes
+		u32 MySqlWriterConnections;
+
+		// Capacity of the queue in front of the shared writer
+		u64 MySqlWriteQueueMaxBytes;
+		u32 MySqlWriteQueueMaxStatements;
+
+		// Number of users which 'all' and 'sql' process most expensive first. Each window of users is
+		// dispatched entirely before the next one, such that cheap users are not postponed indefinitely.
+		u32 SweepScheduleWindow;
+
+		// Number of user IDs leased at once by workers of a distributed 'all'
+		s64 AllRangeSize;
+
+		// While more new scores than this wait to be processed, background sweeps pause until half of them are done
+		u32 ServeMaxLag;
+
+		// Number of high priority tasks after which a worker runs a waiting low priority one. 0 strictly prefers high priority tasks.
+		u32 ExecutorHighPriorityWeight;
+
+		// Number of pooled slave connections used by 'all' and 'sql'. 0 uses one per thread.
+		u32 MySqlPoolSize;
+		bool MySqlPoolThreadAffinity;
+
 		s32 DifficultyUpdateInterval;
 		s32 ScoreUpdateInterval;
 
+		// Users with scores on beatmaps whose difficulty changed are recomputed by 'new' at this rate. 0 disables recomputing them.
+		u32 ReprocessUsersPerSecond;
+
+		// UNIX domain socket at which 'rpc' listens, and how often it reports latencies in milliseconds
+		std::string RPCSocketPath;
+		s32 RPCLatencyInterval;
+
+		// Polls which find no new scores double the interval up to this many milliseconds
+		s32 ScoreUpdateIntervalMax;
+
+		// Signals arriving at this UNIX domain socket trigger polling for new scores right away. Empty disables the socket.
+		// Every process needs its own path; starting a second process on a path which is in use fails.
+		std::string ScoreWakeupSocketPath;
+
+		// Updates of new scores to the same row within this many milliseconds are merged. 0 disables merging,
+		// which is the default. Sweeps write every row once, hence they never merge.
+		s32 CoalesceWindow;
+		u32 CoalesceMaxRows;
+
+		// Background writes are journaled here until executed, such that they survive crashes. Empty disables the journal.
+		std::string JournalPath;
+		s32 JournalSyncInterval;
+
+		// New scores are split by user into this many partitions, which are leased among all 'new' processes
+		// of the gamemode. 0 processes all new scores without coordinating with others.
+		u32 NewScoresPartitions;
+		s32 NewScoresLeaseInterval;
+
+		// Updates of new scores are executed once either limit is reached. A latency of 0 executes every update individually.
+		s32 NewScoresBatchLatency;
+		u32 NewScoresBatchSize;
+
+		// Once more than this many queue entries are behind, 'new' catches up in larger batches until at most a
+		// quarter of them are left. Users with several new scores are then processed once rather than per score.
+		u32 NewScoresCatchUpThreshold;
+		u32 NewScoresPollSize;
+		u32 NewScoresCatchUpPollSize;
+		s32 NewScoresCatchUpBatchLatency;
+		u32 NewScoresCatchUpBatchSize;
+
 		std::string UserPPColumnName;
 		std::string UserMetadataTableName;
 
@@ -89,15 +210,38 @@ class Processor
 	std::shared_ptr<DatabaseConnection> newDBConnectionMaster();
 	std::shared_ptr<DatabaseConnection> newDBConnectionSlave();
 
+	std::shared_ptr<AsyncDatabase> newAsyncDBConnectionMaster(u32 numConnections);
+	std::shared_ptr<AsyncDatabase> newAsyncDBConnectionSlave(u32 numConnections);
+
+	std::unique_ptr<ConnectionPool> newConnectionPoolSlave(u32 size);
+	std::shared_ptr<WriteQueue> newWriteQueue();
+
+	void reportWriteQueueDepth(const std::string& connectionTag);
+
+	void instrumentExecutor(Executor& executor);
+	void reportExecutorDepth(const Executor& executor);
+
+	// Recomputes many users in parallel; shared by 'all' and 'sql'. Declared in UserSweep.h.
+	class UserSweep;
+
 	// Difficulty data is held in RAM.
 	// A few hundred megabytes.
 	// Stored inside a hashmap with the beatmap ID as key
 	std::unordered_map<s32, Beatmap> _beatmaps;
 	std::string _lastApprovedDate;
+	std::string _lastBeatmapUpdate;
+
+	std::unique_ptr<UserStatsCache> _pUserStatsCache;
+
+	// Replaces all writes if set
+	std::unique_ptr<PPExport> _pExport;
 
 	void queryAllBeatmapDifficulties(u32 numThreads);
 	bool queryBeatmapDifficulty(DatabaseConnection& dbSlave, s32 startId, s32 endId = 0);
 
+	// Executes the background queries of all master connections
+	std::shared_ptr<WriteQueue> _pWriteQueue;
+
 	std::shared_ptr<DatabaseConnection> _pDB;
 	std::shared_ptr<DatabaseConnection> _pDBSlave;
 
@@ -108,36 +252,166 @@ class Processor
 	s64 _currentQueueId;
 	s64 _numScoresProcessedSinceLastStore = 0;
 	void pollAndProcessNewScores();
+
+	// Backs off while no new scores arrive
+	std::chrono::milliseconds _scorePollInterval;
+
+	bool _isCatchingUpNewScores = false;
+	void setCatchingUpNewScores(bool isCatchingUp);
+
+	// Computes and writes new scores by themselves, which suffices if user totals are not written. Takes the
+	// queue entry of every score and leaves those of the scores which do not count.
+	void processNewScoresOnly(std::unordered_map<s64, s64>& queueIdsByScore);
+	void reportNewScoresLag(s64 numQueueIdsBehind, s64 secondsBehind);
+	std::unique_ptr<WakeupSocket> _pNewScoresWakeup;
+
+	// Outlives individual polls such that repeated updates of the same rows can be merged.
+	// Score and user updates share it, which keeps all updates of a user in order.
+	std::unique_ptr<UpdateBatch> _pNewUpdatesBatch;
+
+	void enableCoalescing(UpdateBatch& batch);
+
+	// Blocks until everything written so far was executed
+	void waitUntilWritten();
+
+	// Each process claims a fair share of the partitions of new scores. All scores of a user fall into the
+	// same partition, hence they are processed in order by a single process.
+	std::unique_ptr<LeaseSet> _pNewScoresLeases;
+	std::vector<bool> _isNewScoresPartitionOwned;
+	std::vector<s64> _newScoresPartitionQueueIds;
+	std::chrono::steady_clock::time_point _lastNewScoresLeaseTime;
+
+	static const u32 s_maxNumNewScoresProcesses = 64;
+
+	void renewNewScoresLeases();
+	void releaseNewScoresPartitions(const std::vector<u32>& partitions);
+	std::string newScoresPartitionCondition() const;
+
+	// Enqueues the users with IDs in (afterUserId, endUserId) and returns the last one. onCheckpoint is
+	// invoked every so often and stops enqueuing by returning false.
+	s64 enqueueUserRange(
+		UserSweep& sweep,
+		s64 afterUserId,
+		s64 endUserId,
+		const std::string& userCondition, // Further restricts the users if not empty
+		const std::function<bool()>& onCheckpoint
+	);
+
+	// Versions of the formula and of the difficulty of every beatmap as of the last complete run of 'all'.
+	// Nothing is outdated if everything was computed with the current ones.
+	u32 formulaVersion() const;
+	bool findOutdatedBeatmaps(std::vector<s32>& beatmapIds);
+	void storeVersions();
+
+	// Joins the distributed run in progress or begins a new one. False if there is nothing to do.
+	bool beginDistributedRun(LeaseSet& leases, bool reProcess, s64& rangeSize, u32& numRanges);
+	std::vector<s64> retrieveRangeCheckpoints(u32 numRanges, s64 rangeSize);
+
+	static const std::chrono::milliseconds s_rangeLeaseRetryInterval;
+
+	// Blocks while new scores are being monitored and too many of them wait to be processed
+	void yieldToNewScores();
+	void updateNewScoresLag(s64 numScoresBehind);
+
+	bool _isMonitoringNewScores = false;
+
+	// Set by Serve, whose sweeps run alongside new scores. Users with new scores are fenced off from the active sweep.
+	bool _isServing = false;
+	UserSweep* _pActiveSweep = nullptr;
+	std::mutex _activeSweepMutex;
+	void fenceSweptUser(s64 userId);
+	s64 _numNewScoresBehind = 0;
+	std::mutex _newScoresLagMutex;
+	std::condition_variable _newScoresLagCondition;
+
 	void pollAndProcessNewBeatmapSets(DatabaseConnection& dbSlave);
 
+	// Scores on beatmaps whose difficulty changed while monitoring are recomputed right away. Their users
+	// follow at a limited rate whenever no new scores are waiting, each user at most once at a time.
+	// Only users of our own partitions are queued, and at most s_maxNumReprocessUsers. Users beyond that
+	// are left to the next sweep.
+	void reprocessScoresOnBeatmaps(DatabaseConnection& dbSlave, const std::vector<s32>& beatmapIds);
+	bool reprocessNextUser();
+
+	static const size_t s_maxNumReprocessUsers = 1000000;
+
+	std::deque<s64> _reprocessUserIds;
+	std::unordered_set<s64> _isReprocessUserQueued;
+	std::mutex _reprocessMutex;
+	std::chrono::steady_clock::time_point _lastReprocessTime;
+
+	// Copy of the owned partitions for the thread which queues users. Empty until partitions were claimed.
+	std::vector<bool> _isReprocessPartitionOwned;
+
 	std::unordered_set<s32> _blacklistedBeatmapIds;
 	void queryBeatmapBlacklist();
 
 	std::vector<Beatmap::EDifficultyAttributeType> _difficultyAttributes;
 	void queryBeatmapDifficultyAttributes();
 
+	// Selects all scores of a user in the column order expected by processSingleUser
+	std::string userScoresQuery(s64 userId) const;
+	std::string scoresQuery(const std::string& condition) const;
+
+	void registerRPCMethods(RPCServer& server, ConnectionPool& dbSlavePool);
+
+	// Computes the pp of the given scores without writing them. Scores which do not count are left out.
+	std::vector<Score::PPRecord> computeScores(DatabaseConnection& dbSlave, const std::vector<s64>& scoreIds, UpdateBatch* pNewScores = nullptr);
+
+	// Same as above, but with the scores already fetched by scoresQuery. Their pp are written to newScores if given,
+	// unless only changed pp are to be written and a score's pp did not change.
+	std::vector<Score::PPRecord> computeScores(DatabaseConnection& dbSlave, QueryResult& scores, UpdateBatch* pNewScores = nullptr, bool onlyChanged = false);
+
+	template <class TScore>
+	std::vector<Score::PPRecord> computeScoresGeneric(DatabaseConnection& dbSlave, QueryResult& scores, UpdateBatch* pNewScores, bool onlyChanged);
+
+	// Whether the pp computed for the current row of scoresQuery or userScoresQuery differ enough from the stored ones to be written
+	bool isPPChanged(const QueryResult& scores, f32 value) const;
+
+	// Reloads the difficulty attributes and blacklist entries of the given beatmaps from the master
+	void refreshBeatmaps(const std::vector<s32>& beatmapIds);
+
 	// Not thread safe with beatmap data!
+	// If given, mayWriteUser is invoked with newUsers locked right before the user's total is written.
+	// Returning false leaves the total unwritten as well as uncached.
 	User processSingleUser(
 		s64 selectedScoreId, // If this is not 0, then the score is looked at in isolation, triggering a notable event if it's good enough
 		DatabaseConnection& db,
 		DatabaseConnection& dbSlave,
 		UpdateBatch& newUsers,
 		UpdateBatch& newScores,
-		s64 userId
+		s64 userId,
+		const std::function<bool()>& mayWriteUser = nullptr
+	);
+
+	// Same as above, but with the user's scores already fetched by userScoresQuery
+	User processSingleUser(
+		s64 selectedScoreId,
+		QueryResult& scores,
+		DatabaseConnection& db,
+		DatabaseConnection& dbSlave,
+		UpdateBatch& newUsers,
+		UpdateBatch& newScores,
+		s64 userId,
+		const std::function<bool()>& mayWriteUser = nullptr
 	);
 
 	template <class TScore>
 	User processSingleUserGeneric(
 		s64 selectedScoreId, // If this is not 0, then the score is looked at in isolation, triggering a notable event if it's good enough
+		QueryResult& scores,
 		DatabaseConnection& db,
 		DatabaseConnection& dbSlave,
 		UpdateBatch& newUsers,
 		UpdateBatch& newScores,
-		s64 userId
+		s64 userId,
+		const std::function<bool()>& mayWriteUser
 	);
 
 	void storeCount(DatabaseConnection& db, std::string key, s64 value);
+	std::string storeCountQuery(const std::string& key, s64 value) const;
 	s64 retrieveCount(DatabaseConnection& db, std::string key);
+	s64 retrieveCount(DatabaseConnection& db, std::string key, s64 defaultValue);
 
 	std::string retrieveUserName(s64 userId, DatabaseConnection& db) const;
 	std::string retrieveBeatmapName(s32 beatmapId, DatabaseConnection& db) const;
@@ -146,7 +420,7 @@ class Processor
 	bool _isDocker = false;
 
 	RWMutex _beatmapMutex;
-	bool _shallShutdown = false;
+	std::atomic<bool> _shallShutdown{false};
 
 	CURL _curl;
 	std::unique_ptr<DDog> _pDataDog;
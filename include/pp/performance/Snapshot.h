@@ -0,0 +1,93 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <unordered_map>
+#include <vector>
+
+PP_NAMESPACE_BEGIN
+
+DEFINE_EXCEPTION(SnapshotException);
+
+// Compact columnar copy of the tables pp are computed from, such that everything can be recomputed without
+// a database. Created from mysqldump files and mapped into memory as a whole, hence opening it is instant.
+//
+// The file begins with "PPSNAPSH", a u32 version, the u32 gamemode, and the u32 number of columns, followed
+// by one directory entry per column (48 byte name, u32 element size, u64 number of elements, u64 offset).
+// Columns are arrays of fixed size elements in native byte order, each starting at a multiple of 64 bytes.
+// Names are prefixed by their table, and all columns of a table are in the same order. Scores are ordered
+// by user. Null pp are stored as NaN.
+//   scores:    score_id, user_id (s64), beatmap_id, score, maxcombo, count300, count100, count50, countmiss,
+//              countgeki, countkatu (s32), enabled_mods (u32), pp (f32)
+//   beatmaps:  beatmap_id, playmode, approved, score_version, countNormal, countSlider, countSpinner (s32)
+//   attribs:   beatmap_id (s32), mods (u32), type (byte, a Beatmap::EDifficultyAttributeType), value (f32)
+//   blacklist: beatmap_id (s32)
+//   users:     user_id (s64), pp (f64), ranked (byte)
+class Snapshot
+{
+public:
+	template <typename T>
+	struct Column
+	{
+		const T* pData;
+		size_t Size;
+
+		const T& operator[](size_t i) const { return pData[i]; }
+	};
+
+	Snapshot(const std::string& path);
+
+	Snapshot& operator=(const Snapshot&) = delete;
+	Snapshot(const Snapshot&) = delete;
+
+	EGamemode Gamemode() const { return _gamemode; }
+
+	template <typename T>
+	Column<T> Get(const std::string& name) const
+	{
+		auto it = _columns.find(name);
+		if (it == std::end(_columns))
+			throw SnapshotException{SRC_POS, StrFormat("Snapshot '{0}' has no column '{1}'.", _path, name)};
+
+		if (it->second.ElementSize != sizeof(T))
+			throw SnapshotException{SRC_POS, StrFormat("Column '{0}' holds elements of {1} bytes rather than {2}.", name, it->second.ElementSize, sizeof(T))};
+
+		return Column<T>{reinterpret_cast<const T*>(_mapping.pData + it->second.Offset), (size_t)it->second.NumElements};
+	}
+
+	// Converts the dumps written by scripts/dump_sample_tables.sh, found in dumpDirectory, into a snapshot.
+	// Users who are restricted, or inactive as of now, are marked unranked just like they are in the database.
+	static void Convert(EGamemode gamemode, const std::string& dumpDirectory, const std::string& userPPColumnName, const std::string& path);
+
+private:
+	static const u32 s_version;
+
+	struct Entry
+	{
+		u32 ElementSize;
+		u64 NumElements;
+		u64 Offset;
+	};
+
+	std::string _path;
+	EGamemode _gamemode;
+	std::unordered_map<std::string, Entry> _columns;
+
+	// Unmapped once destroyed, which includes snapshots found invalid while constructing
+	struct Mapping
+	{
+		~Mapping();
+
+		const char* pData = nullptr;
+		size_t Size = 0;
+
+#ifdef _WIN32
+		// Read as a whole rather than mapped
+		std::vector<char> Contents;
+#endif
+	};
+
+	Mapping _mapping;
+};
+
+PP_NAMESPACE_END
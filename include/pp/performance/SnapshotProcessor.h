@@ -0,0 +1,52 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <pp/performance/Beatmap.h>
+#include <pp/performance/PPExport.h>
+#include <pp/performance/Snapshot.h>
+
+#include <atomic>
+#include <unordered_map>
+#include <vector>
+
+PP_NAMESPACE_BEGIN
+
+// Recomputes all scores and users of a snapshot the same way 'all' does, but without any database,
+// such that formulas can be iterated on and benchmarked locally.
+class SnapshotProcessor
+{
+public:
+	SnapshotProcessor(const std::string& snapshotPath);
+
+	// Computed pp are handed to pExport if given. Otherwise they are only computed.
+	void ProcessAllUsers(u32 numThreads, PPExport* pExport);
+
+private:
+	static const s64 s_numUsersPerBlock;
+
+	void loadBeatmaps();
+	void findUsers();
+
+	void processUsers(size_t begin, size_t end, PPExport* pExport);
+
+	template <class TScore>
+	void processUsersGeneric(size_t begin, size_t end, PPExport* pExport);
+
+	Snapshot _snapshot;
+	EGamemode _gamemode;
+
+	// Only beatmaps whose scores count. Blacklisted ones are left out.
+	std::unordered_map<s32, Beatmap> _beatmaps;
+
+	// The scores of the i-th user are those from _userOffsets[i] up to _userOffsets[i + 1]
+	std::vector<size_t> _userOffsets;
+
+	// Indices of users within the snapshot's user stats
+	std::unordered_map<s64, size_t> _userStatsIndices;
+
+	std::atomic<u64> _numScoresProcessed{0};
+	std::atomic<u64> _numUsersProcessed{0};
+};
+
+PP_NAMESPACE_END
@@ -35,6 +35,9 @@ class User
 
 	const PPRecord& GetPPRecord() const { return _rating; }
 
+	// Hash of the scores which make up the pp record. Only valid after ComputePPRecord.
+	u64 ScoresFingerprint() const;
+
 	Score::PPRecord XthBestScorePPRecord(unsigned int i);
 
 private:
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <pp/Common.h>
+#include <pp/shared/DatabaseConnection.h>
+
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+PP_NAMESPACE_BEGIN
+
+// The parts of osu_user_stats and the user metadata which decide how a user's total pp is written.
+// Users are loaded in bulk ahead of being processed, such that processing them does not
+// need additional reads, and kept up to date with what we write ourselves. Once full, the users
+// which were used least recently are evicted, which are never the ones being processed.
+class UserStatsCache
+{
+public:
+	struct Stats
+	{
+		// The pp column may be null
+		bool HasPP = false;
+		f64 PP = 0;
+
+		// Not played within the last 3 months as of loading. Neither inactive nor restricted users are ranked.
+		bool IsInactive = false;
+		bool IsRestricted = false;
+
+		bool IsRanked() const { return !IsInactive && !IsRestricted; }
+
+		// Stands in for the amount of scores, which is what processing a user costs
+		u32 Playcount = 0;
+
+		// Identifies the scores and ranked status the pp were last computed from. 0 if unknown.
+		// Survives reloads as long as the pp did not change behind our back.
+		u64 Fingerprint = 0;
+	};
+
+	UserStatsCache(EGamemode gamemode, std::string ppColumnName, std::string userMetadataTableName);
+
+	// Selects the cached columns with the user ID first, such that the rows can be inserted.
+	std::string SelectQuery(const std::string& condition) const;
+
+	// Stores the current row of a result of SelectQuery.
+	void Insert(const QueryResult& res);
+
+	// Reloads the given users in bulk.
+	void Load(DatabaseConnection& dbSlave, const std::vector<s64>& userIds);
+
+	// Users which are not cached are loaded individually. Returns false for users without stats.
+	bool Get(DatabaseConnection& dbSlave, s64 userId, Stats& stats);
+
+	void SetPP(s64 userId, f64 pp);
+	void SetFingerprint(s64 userId, u64 fingerprint);
+
+	// Estimated relative cost of processing the user. Unknown users cost nothing, as no query is made.
+	u64 EstimateCost(s64 userId) const;
+
+	size_t Size() const;
+
+private:
+	static const size_t s_maxNumEntries;
+	static const size_t s_numUsersPerQuery;
+
+	struct Entry
+	{
+		Stats UserStats;
+		std::list<s64>::iterator RecentIt;
+	};
+
+	static Stats parse(const QueryResult& res);
+	void store(s64 userId, const Stats& stats);
+
+	// Must be locked
+	void touchNonThreadsafe(Entry& entry);
+
+	EGamemode _gamemode;
+	std::string _ppColumnName;
+	std::string _userMetadataTableName;
+
+	mutable std::mutex _mutex;
+	std::unordered_map<s64, Entry> _stats;
+
+	// User IDs from the most recently used onwards
+	std::list<s64> _recentUserIds;
+};
+
+PP_NAMESPACE_END
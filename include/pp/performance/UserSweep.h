@@ -0,0 +1,137 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <pp/performance/Processor.h>
+
+#include <pp/shared/AsyncDatabase.h>
+#include <pp/shared/ConnectionPool.h>
+#include <pp/shared/DatabaseConnection.h>
+#include <pp/shared/Executor.h>
+#include <pp/shared/InOrderProgress.h>
+#include <pp/shared/UpdateBatch.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+PP_NAMESPACE_BEGIN
+
+// Recomputes many users in parallel; shared by 'all' and 'sql'.
+class Processor::UserSweep
+{
+public:
+	UserSweep(Processor& processor, u32 numThreads);
+	~UserSweep();
+
+	void Enqueue(s64 userId);
+
+	// Must be called by whoever is about to read and write the user's scores concurrently with the sweep,
+	// such that the sweep does not overwrite those writes with what it computed from an earlier read.
+	// Updates of the user which the sweep already made are flushed to be executed first.
+	void FenceUser(s64 userId);
+
+	// Blocks until all enqueued users are processed and their updates are written,
+	// or merely journaled if there is a journal.
+	void WaitUntilFinished(const std::function<void()>& onProgress);
+
+	// Hands all pending updates to the writer and returns the ID of the user up to which every
+	// enqueued user was processed and had its updates executed by the database, or -1 if there is none.
+	// Users which failed to be processed hold the checkpoint back, such that they are redone on resumption.
+	// Execution is awaited in the background, hence the returned checkpoint lags behind.
+	s64 Checkpoint();
+
+	// Forgets the users processed so far, such that checkpoints only cover users enqueued afterwards.
+	// Must only be called once all enqueued users are finished.
+	void ResetCheckpoint();
+
+	s64 NumUsersProcessed() const { return _numUsersProcessed; }
+	s64 NumUsersFailed() const { return _numUsersFailed; }
+
+private:
+	struct ScheduledUser
+	{
+		u64 Cost;
+		s64 UserId;
+		u64 UserIdx;
+
+		// Within a window, the most expensive user is processed first. Among equally expensive ones the earliest.
+		bool operator<(const ScheduledUser& other) const
+		{
+			return Cost != other.Cost ? Cost < other.Cost : UserIdx > other.UserIdx;
+		}
+	};
+
+	// Starts the most expensive users of the current window while there is room. Once all of them
+	// were started, the users enqueued in the meantime form the next window.
+	void dispatch();
+
+	void launch(const ScheduledUser& user, u32 batchIdx);
+	void launchAsync(const ScheduledUser& user, u32 batchIdx);
+	void finishUser(u64 userIdx, bool isSuccessful);
+
+	// Invoked before the user's scores are read and right before the user's total is written, respectively.
+	// The latter returns false if the user was fenced in between.
+	void beginUser(s64 userId);
+	bool mayWriteUser(s64 userId, u32 batchIdx);
+
+	void flushBatches();
+	void flushUsersBatch(u32 batchIdx, EPriority priority);
+
+	// Connections of the calling worker, which are established on first use
+	DatabaseConnection& workerDB();
+	DatabaseConnection& workerDBSlave();
+
+	Processor& _processor;
+	u32 _numThreads;
+	u32 _currentBatch = 0;
+
+	// Members are ordered such that in-flight work is drained before what it depends on is destroyed.
+	std::unique_ptr<ConnectionPool> _pDBSlavePool;
+
+	std::vector<UpdateBatch> _newUsersBatches;
+	std::vector<UpdateBatch> _newScoresBatches;
+
+	// Indexed by worker, such that workers never wait for each other's synchronous queries
+	std::vector<std::shared_ptr<DatabaseConnection>> _workerDBs;
+	std::vector<std::shared_ptr<DatabaseConnection>> _workerDBSlaves;
+
+	Executor _executor;
+	std::shared_ptr<AsyncDatabase> _pAsyncDBSlave;
+
+	// Bounds the amount of users which are enqueued but not finished. They form the scheduling window.
+	u32 _maxNumUsersPending;
+	u32 _numUsersPending = 0;
+	std::mutex _pendingMutex;
+	std::condition_variable _pendingCondition;
+
+	// Bounds the amount of users which are being fetched or waiting for computation
+	u32 _maxNumUsersDispatched;
+	u32 _numUsersDispatched = 0;
+	std::priority_queue<ScheduledUser> _schedule;
+	std::vector<ScheduledUser> _nextWindow;
+
+	// Users in the order they were enqueued
+	InOrderProgress _progress;
+
+	// Only while serving new scores, whose user updates are fenced off from ours. Users are only
+	// tracked while being processed, and until their update was flushed.
+	bool _isFencing;
+	std::mutex _fenceMutex;
+	std::unordered_map<s64, bool> _isUserFenced;
+	std::unordered_map<s64, u32> _unflushedUserBatches;
+	std::vector<std::vector<s64>> _unflushedUserIds;
+
+	// Shared with write queue fences, which may outlive the sweep
+	std::shared_ptr<std::atomic<s64>> _pLastWrittenUserId = std::make_shared<std::atomic<s64>>(-1);
+
+	std::atomic<s64> _numUsersProcessed{0};
+	std::atomic<s64> _numUsersFailed{0};
+};
+
+PP_NAMESPACE_END
@@ -8,6 +8,9 @@ PP_NAMESPACE_BEGIN
 class OsuScore : public Score
 {
 public:
+	// Must be bumped whenever the computed values change, such that sweeps recompute everything
+	static const u32 s_formulaVersion = 1;
+
 	OsuScore(
 		s64 scoreId,
 		EGamemode mode,
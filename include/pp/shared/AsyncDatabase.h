@@ -0,0 +1,168 @@
+#pragma once
+
+#include <pp/Common.h>
+#include <pp/shared/QueryResult.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <mysql.h>
+
+PP_NAMESPACE_BEGIN
+
+class DatabaseConnection;
+
+// Keeps many queries in flight on few threads. If the client library offers the
+// non-blocking API (PP_MYSQL_NONBLOCKING), a single event loop thread drives all
+// connections. Otherwise every connection falls back to its own blocking thread.
+class AsyncDatabase
+{
+public:
+	using ResultCallback = std::function<void(QueryResult& result)>;
+	using DoneCallback = std::function<void()>;
+
+	AsyncDatabase(
+		std::string host,
+		s32 port,
+		std::string username,
+		std::string password,
+		std::string database,
+		u32 numConnections
+	);
+
+	AsyncDatabase& operator=(const AsyncDatabase&) = delete;
+	AsyncDatabase(const AsyncDatabase&) = delete;
+
+	// Waits for all pending requests to complete.
+	~AsyncDatabase();
+
+	// Callbacks run on the thread driving the connection and should return quickly.
+	// Failed requests are logged and invoke onError instead of their completion callback.
+	// Both throw the first failure of a statement, see ThrowIfFailed.
+	void Query(std::string queryString, ResultCallback onResult, DoneCallback onError = nullptr);
+
+	// Statements sharing the same ordering key are executed in submission order, regardless of their priority.
+	// High priority statements overtake low priority ones which did not start yet, except for those of their
+	// own ordering key, which are promoted along with them.
+	// Once a statement failed, all later ones fail without being executed, such that nothing
+	// is written out of order with it.
+	void NonQuery(
+		std::string queryString,
+		u64 orderingKey,
+		EPriority priority,
+		DoneCallback onDone = nullptr,
+		DoneCallback onError = nullptr
+	);
+
+	size_t NumPending() const { return _numPending; }
+	u32 NumConnections() const { return (u32)_connections.size(); }
+
+	// Throws upon the first statement which failed, or whose callback threw, on the calling thread
+	// rather than only logging it on the thread driving the connection.
+	void ThrowIfFailed();
+
+	// Also throws like ThrowIfFailed once idle.
+	void WaitUntilIdle();
+
+private:
+	struct Request
+	{
+		std::string QueryString;
+		u64 OrderingKey;
+		ResultCallback OnResult; // Only set for queries
+		DoneCallback OnDone;
+		DoneCallback OnError;
+	};
+
+	enum class EPhase
+	{
+		Querying,
+		StoringResult,
+		NextResult,
+	};
+
+	struct Connection
+	{
+		std::deque<Request> Requests[s_numPriorities];
+		bool IsBusy = false;
+
+		// Queued low priority statements by ordering key, such that submitting high priority ones rarely needs to look for them
+		std::unordered_map<u64, size_t> NumLowStatements;
+
+		bool HasRequests() const;
+		size_t NumRequests() const;
+		void PushRequest(EPriority priority, Request&& request);
+		Request PopRequest();
+
+#ifdef PP_MYSQL_NONBLOCKING
+		MYSQL MySQL;
+
+		bool IsWaiting = false;
+		Request Current;
+		EPhase Phase = EPhase::Querying;
+
+		s32 WaitStatus = 0;
+		std::chrono::steady_clock::time_point Deadline;
+
+		s32 Status = 0;
+		MYSQL_RES* pResult = nullptr;
+#else
+		std::unique_ptr<DatabaseConnection> pDB;
+		std::thread Thread;
+#endif
+	};
+
+	void submit(size_t connectionIdx, EPriority priority, Request&& request);
+	void complete(Request& request, QueryResult* pResult, const std::string& error);
+
+	// Statements popped after a failure are not executed. Must be locked.
+	bool isSkippedNonThreadsafe(const Request& request) const;
+
+#ifdef PP_MYSQL_NONBLOCKING
+	void runEventLoop();
+	void advance(Connection& connection, s32 readyStatus);
+	s32 startPhase(Connection& connection);
+	s32 continuePhase(Connection& connection, s32 readyStatus);
+	void finishPhase(Connection& connection);
+	void finishRequest(Connection& connection, QueryResult* pResult, const std::string& error);
+
+	void wake();
+
+	std::thread _eventLoopThread;
+#ifdef _WIN32
+	// Same as INVALID_SOCKET, without pulling winsock into every includer
+	my_socket _wakeSocket = (my_socket)~0;
+#else
+	s32 _wakePipe[2] = {-1, -1};
+#endif
+#else
+	void runConnection(Connection& connection);
+#endif
+
+	std::string _host;
+	s32 _port;
+	std::string _username;
+	std::string _password;
+	std::string _database;
+
+	std::vector<std::unique_ptr<Connection>> _connections;
+
+	std::mutex _mutex;
+	std::condition_variable _requestCondition;
+	std::condition_variable _idleCondition;
+
+	std::atomic<size_t> _numPending{0};
+	bool _shallShutdown = false;
+
+	// First failure of a statement. Empty as long as there was none.
+	std::string _error;
+};
+
+PP_NAMESPACE_END
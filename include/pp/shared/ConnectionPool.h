@@ -0,0 +1,85 @@
+#pragma once
+
+#include <pp/Common.h>
+#include <pp/shared/DatabaseConnection.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+PP_NAMESPACE_BEGIN
+
+// A fixed amount of connections which are checked out for the duration of a task
+// and returned afterwards. With thread affinity, threads get back the connection they
+// used last whenever it is available.
+class ConnectionPool
+{
+public:
+	using Factory = std::function<std::shared_ptr<DatabaseConnection>()>;
+	using WaitCallback = std::function<void(std::chrono::microseconds waitTime)>;
+
+	ConnectionPool(Factory factory, u32 size, bool isThreadAffine, WaitCallback onWait = nullptr);
+
+	ConnectionPool& operator=(const ConnectionPool&) = delete;
+	ConnectionPool(const ConnectionPool&) = delete;
+
+	class Lease
+	{
+	public:
+		Lease(Lease&& other);
+		~Lease();
+
+		Lease& operator=(const Lease&) = delete;
+		Lease(const Lease&) = delete;
+
+		DatabaseConnection& operator*() const { return *_pConnection; }
+		DatabaseConnection* operator->() const { return _pConnection.get(); }
+
+	private:
+		Lease(ConnectionPool* pPool, size_t idx, std::shared_ptr<DatabaseConnection> pConnection);
+
+		ConnectionPool* _pPool;
+		size_t _idx;
+		std::shared_ptr<DatabaseConnection> _pConnection;
+
+		friend class ConnectionPool;
+	};
+
+	// Blocks until a connection is available. Connections which were idle for a while
+	// or returned while an exception was in flight are checked and re-established first.
+	Lease Checkout();
+
+	u32 Size() const { return (u32)_entries.size(); }
+	u32 NumAvailable() const;
+
+private:
+	static const std::chrono::seconds s_healthCheckIdleTime;
+
+	struct Entry
+	{
+		std::shared_ptr<DatabaseConnection> pConnection;
+		bool IsAvailable = true;
+		bool NeedsHealthCheck = false;
+		std::chrono::steady_clock::time_point LastUsed;
+	};
+
+	size_t takeAvailableEntry();
+	void giveBack(size_t idx, bool needsHealthCheck);
+
+	Factory _factory;
+	bool _isThreadAffine;
+	WaitCallback _onWait;
+
+	std::vector<Entry> _entries;
+	u32 _numAvailable;
+	std::unordered_map<std::thread::id, size_t> _affinities;
+
+	mutable std::mutex _mutex;
+	std::condition_variable _availableCondition;
+};
+
+PP_NAMESPACE_END
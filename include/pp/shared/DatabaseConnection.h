@@ -1,24 +1,31 @@
 #pragma once
 
 #include <pp/Common.h>
-#include <pp/shared/Active.h>
 #include <pp/shared/QueryResult.h>
 
+#include <mutex>
+
 #include <mysql.h>
 
 PP_NAMESPACE_BEGIN
 
 DEFINE_EXCEPTION(DatabaseException);
 
+class WriteQueue;
+
 class DatabaseConnection
 {
 public:
+	// Background queries are pushed into the shared write queue and executed in the
+	// order in which they were issued on this connection. Connections without a write
+	// queue can not issue background queries.
 	DatabaseConnection(
 		std::string host,
 		s32 port,
 		std::string username,
 		std::string password,
-		std::string database
+		std::string database,
+		std::shared_ptr<WriteQueue> pWriteQueue = nullptr
 	);
 
 	DatabaseConnection& operator=(const DatabaseConnection&) = delete;
@@ -29,7 +36,8 @@ class DatabaseConnection
 
 	~DatabaseConnection();
 
-	void NonQueryBackground(const std::string& queryString);
+	void NonQueryBackground(const std::string& queryString, EPriority priority = EPriority::Low);
+	void NonQueryBackground(std::string&& queryString, EPriority priority = EPriority::Low);
 	void NonQuery(const std::string& queryString);
 	QueryResult Query(const std::string& queryString);
 
@@ -39,12 +47,21 @@ class DatabaseConnection
 	//returns the number of rows e.g. returned by a SELECT
 	u32 AffectedRows();
 
-	size_t NumPendingQueries() const { return _pActive->NumPending(); }
+	// Checks whether the server is still reachable
+	bool Ping();
+
+	// Pending background queries of the shared write queue, not only of this connection
+	size_t NumPendingQueries() const;
+
+	// Writes pushed with this key are executed in order with our background queries
+	u64 OrderingKey() const { return _orderingKey; }
 
 private:
 	void connect();
 
-	std::unique_ptr<Active> _pActive;
+	std::shared_ptr<WriteQueue> _pWriteQueue;
+	u64 _orderingKey;
+
 	std::recursive_mutex _dbMutex;
 
 	std::string _host;
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+PP_NAMESPACE_BEGIN
+
+// Move-only callable which is stored inline rather than on the heap.
+// Callables which do not fit are rejected at compile time.
+class Task
+{
+public:
+	static const size_t s_capacity = 64;
+
+	Task() = default;
+
+	template <typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Task>::value>::type>
+	Task(F&& f)
+	{
+		using Callable = typename std::decay<F>::type;
+
+		static_assert(sizeof(Callable) <= s_capacity, "Callable is too large to be stored inline.");
+		static_assert(alignof(Callable) <= alignof(Storage), "Callable is too strictly aligned to be stored inline.");
+
+		new (&_storage) Callable(std::forward<F>(f));
+		_pOps = ops<Callable>();
+	}
+
+	Task(Task&& other);
+	Task& operator=(Task&& other);
+	~Task();
+
+	Task(const Task&) = delete;
+	Task& operator=(const Task&) = delete;
+
+	explicit operator bool() const { return _pOps != nullptr; }
+
+	void operator()() { _pOps->Invoke(&_storage); }
+
+private:
+	using Storage = typename std::aligned_storage<s_capacity, alignof(std::max_align_t)>::type;
+
+	struct Ops
+	{
+		void (*Invoke)(void* pStorage);
+		void (*Move)(void* pDestination, void* pSource);
+		void (*Destroy)(void* pStorage);
+	};
+
+	template <typename Callable>
+	static const Ops* ops()
+	{
+		static const Ops s_ops = {
+			[](void* pStorage) { (*static_cast<Callable*>(pStorage))(); },
+			[](void* pDestination, void* pSource) { new (pDestination) Callable(std::move(*static_cast<Callable*>(pSource))); },
+			[](void* pStorage) { static_cast<Callable*>(pStorage)->~Callable(); },
+		};
+
+		return &s_ops;
+	}
+
+	void reset();
+
+	Storage _storage;
+	const Ops* _pOps = nullptr;
+};
+
+// Counts down to zero once, waking up everybody waiting for it.
+class Latch
+{
+public:
+	explicit Latch(u32 count = 0);
+
+	// Only valid before the latch reached zero.
+	void Add(u32 count);
+	// Returns whether this call made the latch reach zero.
+	bool CountDown(u32 count = 1);
+
+	bool IsDone() const;
+
+	void Wait();
+	// Returns whether the latch reached zero.
+	bool WaitFor(std::chrono::microseconds duration);
+
+private:
+	mutable std::mutex _mutex;
+	std::condition_variable _doneCondition;
+	u32 _count;
+};
+
+// Every worker owns a deque of tasks per priority. It takes work from the front and, once it
+// runs dry, steals from the back of the others' deques. Workers therefore rarely contend,
+// and tasks submitted from within a task stay on the same worker.
+class Executor
+{
+public:
+	using TaskCallback = std::function<void(EPriority priority, std::chrono::microseconds waitTime)>;
+
+	// A weight of 0 strictly runs high priority tasks first. Otherwise, workers which ran this many
+	// high priority tasks in a row run a low priority one next, such that low priority work is not starved.
+	explicit Executor(u32 numThreads, u32 highPriorityWeight = 0);
+
+	// Runs all submitted tasks before returning.
+	~Executor();
+
+	Executor(const Executor&) = delete;
+	Executor& operator=(const Executor&) = delete;
+
+	void Submit(Task&& task, EPriority priority);
+
+	// Splits [begin, end) into blocks of at most blockSize and calls f(blockBegin, blockEnd) for each
+	// on the workers. The latch counts down once per finished block. f must outlive the blocks.
+	template <typename F>
+	void ParallelFor(s64 begin, s64 end, s64 blockSize, const F& f, Latch& latch, EPriority priority = EPriority::High)
+	{
+		if (begin >= end)
+			return;
+
+		blockSize = std::max<s64>(blockSize, 1);
+		latch.Add((u32)((end - begin + blockSize - 1) / blockSize));
+
+		for (s64 blockBegin = begin; blockBegin < end; blockBegin += blockSize)
+		{
+			s64 blockEnd = std::min(blockBegin + blockSize, end);
+			push(Task{[this, &f, &latch, blockBegin, blockEnd]()
+			{
+				// Count down even if f throws, such that nobody waits forever. Workers waiting for
+				// the latch sleep until there is work for them, hence they are woken up once it is done.
+				struct CountDownGuard
+				{
+					Executor& E;
+					Latch& L;
+					~CountDownGuard()
+					{
+						if (L.CountDown())
+							E.wakeAll();
+					}
+				} guard{*this, latch};
+
+				f(blockBegin, blockEnd);
+			}}, priority);
+		}
+
+		wakeAll();
+	}
+
+	// Blocks until all blocks are done.
+	template <typename F>
+	void ParallelFor(s64 begin, s64 end, s64 blockSize, const F& f, EPriority priority = EPriority::High)
+	{
+		Latch latch;
+		ParallelFor(begin, end, blockSize, f, latch, priority);
+		Wait(latch);
+	}
+
+	// Workers waiting for a latch run other tasks in the meantime and only sleep while there are none,
+	// such that tasks may wait for work they submitted themselves. Sleeping workers are woken up by
+	// ParallelFor's blocks, hence the latch must be one passed to ParallelFor.
+	void Wait(Latch& latch);
+
+	// Invoked on the worker right before a task starts with the time it spent queued.
+	// Must be set before anything is submitted.
+	void SetStartCallback(TaskCallback onStart);
+
+	u32 NumThreads() const { return (u32)_workers.size(); }
+
+	// Index of the calling thread's worker, or the number of workers if it is not one of ours.
+	size_t CurrentWorkerIdx() const;
+	size_t NumQueued(EPriority priority) const { return _numQueued[(size_t)priority]; }
+
+private:
+	struct QueuedTask
+	{
+		Task Work;
+		EPriority Priority;
+		std::chrono::steady_clock::time_point SubmitTime;
+	};
+
+	struct Worker
+	{
+		std::mutex Mutex;
+		std::deque<QueuedTask> Tasks[s_numPriorities];
+		std::thread Thread;
+
+		// Only accessed by the worker's own thread
+		u32 NumHighPriorityInARow = 0;
+	};
+
+	void push(Task&& task, EPriority priority);
+	void wakeOne();
+	void wakeAll();
+
+	bool hasQueued() const;
+
+	bool tryAcquire(size_t workerIdx, QueuedTask& task);
+	bool tryAcquire(size_t workerIdx, EPriority priority, QueuedTask& task);
+	void execute(QueuedTask& task);
+
+	void run(size_t workerIdx);
+
+	u32 _highPriorityWeight;
+
+	std::vector<std::unique_ptr<Worker>> _workers;
+	std::atomic<size_t> _nextWorkerIdx{0};
+	std::atomic<size_t> _numQueued[s_numPriorities];
+
+	TaskCallback _onStart;
+
+	std::mutex _sleepMutex;
+	std::condition_variable _sleepCondition;
+	bool _shallShutdown = false;
+};
+
+PP_NAMESPACE_END
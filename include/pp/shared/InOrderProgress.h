@@ -0,0 +1,46 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <deque>
+
+PP_NAMESPACE_BEGIN
+
+// Tracks items which are started in order but may finish in any order. Progress only moves past an
+// item once every item started before it finished as well, hence resuming after the last finished
+// item never skips an unfinished one. Items which failed hold progress back for good, such that they
+// are redone on resumption. Not thread safe.
+class InOrderProgress
+{
+public:
+	// Returns the index by which the item is to be finished.
+	u64 Start(s64 id);
+	// Both return the ID of the item.
+	s64 Finish(u64 idx);
+	s64 Fail(u64 idx);
+
+	// ID of the last item up to which all items finished without failing, or -1 if there is none.
+	s64 LastFinishedId() const { return _lastFinishedId; }
+
+	// Forgets the items finished and failed so far, such that only items finishing afterwards count.
+	void ResetLastFinishedId() { _lastFinishedId = -1; _hasFailed = false; }
+
+private:
+	enum class EState : byte
+	{
+		Running,
+		Finished,
+		Failed,
+	};
+
+	s64 end(u64 idx, EState state);
+
+	// Items from the first one which is not finished yet onwards
+	std::deque<s64> _unfinishedIds;
+	std::deque<EState> _states;
+	u64 _firstUnfinishedIdx = 0;
+	s64 _lastFinishedId = -1;
+	bool _hasFailed = false;
+};
+
+PP_NAMESPACE_END
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <mutex>
+#include <set>
+#include <vector>
+
+PP_NAMESPACE_BEGIN
+
+class DatabaseConnection;
+
+// Exclusive leases on named resources which are shared by several processes. Leases are MySQL
+// user-level locks held by a dedicated connection. The server releases them once that connection
+// goes away, hence the leases of a process which died become available to others.
+// Holding several leases at once requires MySQL 5.7 or MariaDB 10.0.2 and later.
+class LeaseSet
+{
+public:
+	// Names are prefixed to keep them apart from unrelated locks. MySQL limits the result to 64 characters.
+	LeaseSet(std::shared_ptr<DatabaseConnection> pDB, std::string prefix);
+
+	LeaseSet& operator=(const LeaseSet&) = delete;
+	LeaseSet(const LeaseSet&) = delete;
+
+	// Releases all held leases.
+	~LeaseSet();
+
+	// Returns immediately. False if somebody else holds the lease.
+	bool TryAcquire(const std::string& name);
+	void Release(const std::string& name);
+
+	// Forgets and returns the leases which were lost, e.g. because the connection was interrupted.
+	std::vector<std::string> Verify();
+
+	// Whether anybody, including us, holds the respective lease
+	std::vector<bool> AreLeased(const std::vector<std::string>& names);
+
+	bool IsHeld(const std::string& name) const;
+	size_t NumHeld() const;
+
+private:
+	std::string lockName(const std::string& name) const;
+
+	std::shared_ptr<DatabaseConnection> _pDB;
+	std::string _prefix;
+
+	mutable std::mutex _mutex;
+	std::set<std::string> _held;
+};
+
+PP_NAMESPACE_END
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <algorithm>
+#include <string>
+
+PP_NAMESPACE_BEGIN
+
+// Appends SQL fragments and numbers into a single reusable buffer.
+// Buffers are recycled through a process-wide free list, such that
+// building and executing batches does not allocate in steady state.
+class QueryBuilder
+{
+public:
+	QueryBuilder(size_t capacity = 0);
+	~QueryBuilder();
+
+	QueryBuilder(const QueryBuilder&) = delete;
+	QueryBuilder& operator=(const QueryBuilder&) = delete;
+
+	QueryBuilder(QueryBuilder&& other);
+	QueryBuilder& operator=(QueryBuilder&& other);
+
+	QueryBuilder& Append(const char* str);
+	QueryBuilder& Append(const char* str, size_t size);
+	QueryBuilder& Append(const std::string& str);
+	QueryBuilder& Append(char c);
+
+	QueryBuilder& Append(s32 value);
+	QueryBuilder& Append(u32 value);
+	QueryBuilder& Append(s64 value);
+	QueryBuilder& Append(u64 value);
+
+	// Floats are rendered in fixed point notation with trailing zeros stripped.
+	QueryBuilder& Append(f32 value) { return AppendFixed(value, s_defaultPrecision); }
+	QueryBuilder& Append(f64 value) { return AppendFixed(value, s_defaultPrecision); }
+	QueryBuilder& AppendFixed(f64 value, u32 precision);
+
+	size_t Size() const { return _buffer.size(); }
+	bool Empty() const { return _buffer.empty(); }
+	const std::string& Str() const { return _buffer; }
+
+	// Empties the buffer without giving up its capacity.
+	void Clear() { _buffer.clear(); }
+
+	// Drops everything past the given size.
+	void Truncate(size_t size) { _buffer.resize(std::min(size, _buffer.size())); }
+
+	// Moves the finished query out and continues with a recycled buffer.
+	std::string Release();
+
+	// Returns a no longer needed query buffer to the free list.
+	static void Recycle(std::string&& buffer);
+
+private:
+	static const u32 s_defaultPrecision = 6;
+
+	static std::string acquire(size_t capacity);
+
+	void appendUnsigned(u64 value);
+
+	size_t _capacity;
+	std::string _buffer;
+};
+
+PP_NAMESPACE_END
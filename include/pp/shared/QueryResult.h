@@ -13,6 +13,9 @@ class QueryResult
 public:
 	bool NextRow();
 
+	// Continues from the first row again
+	void Rewind();
+
 	inline s32 NumRows() { return (s32)mysql_num_rows(_pRes.get()); }
 	inline s32 NumCols() { return (s32)mysql_num_fields(_pRes.get()); }
 
@@ -65,6 +68,7 @@ class QueryResult
 	std::unique_ptr<MYSQL_RES, decltype(&mysql_free_result)> _pRes;
 	MYSQL_ROW _row;
 
+	friend class AsyncDatabase;
 	friend class DatabaseConnection;
 };
 
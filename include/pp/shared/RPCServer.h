@@ -0,0 +1,110 @@
+#pragma once
+
+#include <pp/Common.h>
+#include <pp/shared/Executor.h>
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+PP_NAMESPACE_BEGIN
+
+DEFINE_EXCEPTION(RPCException);
+
+// Answers requests arriving at a local UNIX domain stream socket. Each line holds a request of the form
+// {"method": ..., "params": ...} and is answered by a line holding {"result": ...} or {"error": ...}.
+// A line may also hold an array of requests, which are run in parallel and answered by an array of
+// responses in the same order. Requests of a single connection are answered in the order they arrived.
+// Answers are sent by the thread running the server without blocking, such that clients which read slowly
+// occupy no worker. Not available on Windows.
+class RPCServer
+{
+public:
+	using Handler = std::function<nlohmann::json(const nlohmann::json& params)>;
+
+	// Invoked periodically with the latencies of the requests of each method since the last invocation
+	using LatencyCallback = std::function<void(
+		const std::string& method,
+		std::chrono::microseconds p50,
+		std::chrono::microseconds p99,
+		size_t numRequests
+	)>;
+
+	// Replaces a stale socket file left behind by a previous run.
+	RPCServer(std::string path, u32 numThreads);
+	~RPCServer();
+
+	RPCServer& operator=(const RPCServer&) = delete;
+	RPCServer(const RPCServer&) = delete;
+
+	// Must be called before Run. Handlers run on the workers and may throw to report errors.
+	void Register(std::string method, Handler handler);
+	void SetLatencyCallback(LatencyCallback onLatency, std::chrono::milliseconds interval);
+
+	// Serves requests until shutdown is requested.
+	void Run(const std::atomic<bool>& shallShutdown);
+
+	Executor& Workers() { return _executor; }
+
+private:
+	// Connections sending longer lines are closed
+	static const size_t s_maxLineSize;
+
+	// Connections are not read from while this much of their answers was not sent yet, which
+	// holds back clients sending requests without reading the answers.
+	static const size_t s_maxNumUnsentBytes;
+
+	struct Connection
+	{
+		~Connection();
+
+		s32 Fd = -1;
+
+		// Incomplete line received so far, and whether the client finished sending. Only accessed by the thread running the server.
+		std::string Received;
+		bool IsEndOfInput = false;
+
+		std::mutex Mutex;
+		std::deque<std::string> Lines;
+		bool IsBusy = false;
+
+		// Answers yet to be sent, from the given offset onwards
+		std::string Unsent;
+		size_t UnsentOffset = 0;
+	};
+
+	void receive(const std::shared_ptr<Connection>& pConnection, bool& isClosed);
+	void send(Connection& connection, bool& isClosed);
+	void answer(std::shared_ptr<Connection> pConnection);
+
+	// Interrupts polling, such that new answers are sent right away
+	void wake();
+
+	nlohmann::json handle(const nlohmann::json& request);
+	void recordLatency(const std::string& method, std::chrono::microseconds latency);
+	void reportLatencies();
+
+	std::string _path;
+	s32 _fd = -1;
+	s32 _wakePipe[2] = {-1, -1};
+
+	std::unordered_map<std::string, Handler> _handlers;
+
+	LatencyCallback _onLatency;
+	std::chrono::milliseconds _latencyInterval{10000};
+	std::mutex _latencyMutex;
+	std::unordered_map<std::string, std::vector<std::chrono::microseconds>> _latencies;
+
+	// Destroyed first, such that running requests finish while the above is still around
+	Executor _executor;
+};
+
+PP_NAMESPACE_END
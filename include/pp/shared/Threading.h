@@ -3,13 +3,8 @@
 #include <pp/Common.h>
 #include <pp/shared/Threading.h>
 
-#include <atomic>
 #include <condition_variable>
-#include <deque>
-#include <future>
 #include <mutex>
-#include <thread>
-#include <vector>
 
 PP_NAMESPACE_BEGIN
 
@@ -124,61 +119,4 @@ class RWLock
 	bool _isLocked;
 };
 
-class ThreadPool
-{
-public:
-	ThreadPool();
-	ThreadPool(const u32 numThreads);
-	~ThreadPool();
-
-	template<class F, class... Args>
-	std::future<typename std::result_of<F(Args...)>::type> EnqueueTask(F && f, Args && ... args)
-	{
-		typedef typename std::result_of<F(Args...)>::type return_type;
-
-		++_numTasksInSystem;
-
-		auto task = std::make_shared< std::packaged_task<return_type()> >(
-			std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-		);
-
-		auto res = task->get_future();
-
-		{
-			std::lock_guard<std::mutex> lock{_taskQueueMutex};
-
-			// add the task
-			_taskQueue.emplace_back([task]() { (*task)(); });
-		}
-
-		_workerCondition.notify_one();
-
-		return res;
-	}
-
-	void StartThreads(const u32 num);
-	void ShutdownThreads(const u32 num);
-
-	u32 GetNumTasksInSystem() const
-	{
-		return _numTasksInSystem;
-	}
-
-	void WaitUntilFinished();
-	void WaitUntilFinishedFor(const std::chrono::microseconds Duration);
-	void FlushQueue();
-
-private:
-	u32 _numThreads = 0; // We don't have any threads running on startup
-	std::vector<std::thread> _threads;
-
-	std::deque<std::function<void()>> _taskQueue;
-	std::mutex _taskQueueMutex;
-	std::condition_variable _workerCondition;
-
-	std::atomic<u32> _numTasksInSystem{0}; // We have no tasks in the system on startup
-	std::mutex _systemBusyMutex;
-	std::condition_variable _systemBusyCondition;
-};
-
 PP_NAMESPACE_END
@@ -1,17 +1,23 @@
 #pragma once
 
 #include <pp/Common.h>
+#include <pp/shared/QueryBuilder.h>
+#include <pp/shared/WriteCoalescer.h>
 
+#include <chrono>
 #include <mutex>
 
 PP_NAMESPACE_BEGIN
 
 class DatabaseConnection;
+class WriteQueue;
 
 class UpdateBatch
 {
 public:
 	UpdateBatch(std::shared_ptr<DatabaseConnection> pDB, u32 sizeThreshold);
+	// Batches sharing an ordering key with other writes are executed in order with these.
+	UpdateBatch(std::shared_ptr<WriteQueue> pWriteQueue, u64 orderingKey, u32 sizeThreshold);
 	~UpdateBatch();
 
 	UpdateBatch& operator=(UpdateBatch&& other);
@@ -20,30 +26,72 @@ class UpdateBatch
 	void AppendAndCommit(const std::string& values);
 	void AppendAndCommitNonThreadsafe(const std::string& values);
 
+	// Statements can be written directly into the batch's buffer to avoid
+	// intermediate strings. Must be followed by CommitNonThreadsafe.
+	QueryBuilder& Builder() { return _query; }
+	void CommitNonThreadsafe();
+
+	// Commits a statement which entirely determines the given row. If coalescing is
+	// enabled it is held back and superseded by later statements to the same row.
+	// Unkeyed statements may overtake held back ones. Tables are named as in the
+	// statement, including their gamemode suffix.
+	void CommitNonThreadsafe(const std::string& table, s64 primaryKey);
+
+	// Commits a statement which must be executed after all earlier ones, including held back statements.
+	void CommitAfterHeldBackNonThreadsafe();
+
+	void EnableCoalescing(u32 maxNumRows, std::chrono::milliseconds window);
+
+	// Executes the batch once its oldest statement waited this long, even if below the size threshold.
+	void SetLatencyBudget(std::chrono::microseconds latencyBudget);
+	void SetSizeThreshold(u32 sizeThreshold);
+
+	// Batches of latency-sensitive updates overtake bulk writes in the write queue.
+	void SetPriority(EPriority priority);
+
+	// Executes everything, including held back statements.
+	void Flush();
+
+	// Same as above, but at the given priority rather than the batch's own. Later high priority writes
+	// of the same ordering key may then be pushed without waiting for bulk writes.
+	void FlushNonThreadsafe(EPriority priority);
+
+	// Passes on held back statements and executes the batch once their respective time is up.
+	// Needed if no further commits follow.
+	void FlushIfDue();
+
+	u64 NumCoalesced();
+
 	std::mutex& Mutex() { return _batchMutex; }
 
 private:
-	void append(const std::string& values)
-	{
-		_empty = false;
-		_query += values;
-	}
+	// Batches may overshoot their threshold by one statement before being executed.
+	static const u32 s_capacitySlack = 4096;
 
-	void reset();
-	const std::string& query();
+	u32 Size() const { return (u32)_query.Size(); }
 
-	u32 Size() const { return (u32)_query.size(); }
+	bool isLatencyBudgetExhausted() const;
 
+	void flushCoalescer();
 	void execute();
+	void execute(EPriority priority);
 
 	u32 _sizeThreshold;
 
-	bool _empty = true;
-
 	std::shared_ptr<DatabaseConnection> _pDB;
+	std::shared_ptr<WriteQueue> _pWriteQueue;
+	u64 _orderingKey = 0;
+	EPriority _priority = EPriority::Low;
 	std::mutex _batchMutex;
 
-	std::string _query;
+	QueryBuilder _query;
+
+	// Beginning of the statement which is currently being built
+	size_t _commitOffset = 0;
+	std::unique_ptr<WriteCoalescer> _pCoalescer;
+
+	std::chrono::microseconds _latencyBudget{0};
+	std::chrono::steady_clock::time_point _firstCommitTime;
 };
 
 PP_NAMESPACE_END
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <chrono>
+
+PP_NAMESPACE_BEGIN
+
+DEFINE_EXCEPTION(WakeupException);
+
+// Local UNIX domain datagram socket through which other processes on the same machine signal that
+// there is work, e.g. after submitting a score. The content of datagrams is ignored, and any number
+// of signals arriving between two waits count as one. Not available on Windows.
+class WakeupSocket
+{
+public:
+	// Replaces a stale socket file left behind by a previous run, but throws if another process still listens on it.
+	explicit WakeupSocket(std::string path);
+	~WakeupSocket();
+
+	WakeupSocket& operator=(const WakeupSocket&) = delete;
+	WakeupSocket(const WakeupSocket&) = delete;
+
+	// Returns whether a signal arrived within the timeout.
+	bool Wait(std::chrono::milliseconds timeout);
+
+private:
+	std::string _path;
+	s32 _fd = -1;
+};
+
+PP_NAMESPACE_END
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+PP_NAMESPACE_BEGIN
+
+class QueryBuilder;
+
+// Holds back writes to individual rows for a short window. A later write to the
+// same row replaces the earlier one, such that only the latest value reaches the
+// database. Statements must therefore fully determine the row's new state.
+class WriteCoalescer
+{
+public:
+	WriteCoalescer(u32 maxNumRows, std::chrono::milliseconds window);
+
+	// The statement is copied and keeps the position of the row's first pending write.
+	void Put(const std::string& table, s64 primaryKey, const char* statement, size_t size);
+
+	// Due once the window elapsed since the first pending write, or enough rows are pending.
+	bool IsDue() const;
+	bool Empty() const { return _statements.empty(); }
+
+	// Appends all pending statements in order and starts a new window.
+	void DrainInto(QueryBuilder& query);
+
+	u64 NumCoalesced() const { return _numCoalesced; }
+
+private:
+	struct RowKey
+	{
+		u32 TableIdx;
+		s64 PrimaryKey;
+
+		bool operator==(const RowKey& other) const
+		{
+			return PrimaryKey == other.PrimaryKey && TableIdx == other.TableIdx;
+		}
+	};
+
+	struct RowKeyHash
+	{
+		size_t operator()(const RowKey& key) const
+		{
+			return std::hash<s64>{}(key.PrimaryKey) * 31 + key.TableIdx;
+		}
+	};
+
+	struct Statement
+	{
+		size_t Offset;
+		size_t Size;
+	};
+
+	// Few tables are written, hence they are looked up linearly
+	u32 tableIdx(const std::string& table);
+
+	u32 _maxNumRows;
+	std::chrono::milliseconds _window;
+
+	std::chrono::steady_clock::time_point _windowStart;
+	std::vector<std::string> _tables;
+	std::unordered_map<RowKey, size_t, RowKeyHash> _rowIndices;
+
+	// Pending statements are stored back to back. Superseded ones are left in place until drained.
+	std::string _buffer;
+	std::vector<Statement> _statements;
+
+	u64 _numCoalesced = 0;
+};
+
+PP_NAMESPACE_END
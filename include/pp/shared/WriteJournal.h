@@ -0,0 +1,103 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+PP_NAMESPACE_BEGIN
+
+DEFINE_EXCEPTION(JournalException);
+
+// Append-only log of background writes which were not confirmed by the database yet.
+// Appends are synced to disk in groups by a background thread, hence a crash may lose
+// the most recent few milliseconds. What survives is always a prefix of what was appended.
+// Writes which were never completed are handed back after a restart to be replayed.
+// Writes which were replayed a few times without completing are set aside into a
+// ".rejected" file next to the journal rather than being replayed forever.
+// Once the journal grew large and mostly holds completed writes, the outstanding ones
+// are copied into a fresh journal which replaces it. Syncing and copying happen on a
+// background thread without blocking appends.
+class WriteJournal
+{
+public:
+	struct Entry
+	{
+		u64 Sequence;
+		u64 OrderingKey;
+		std::string Statement;
+	};
+
+	WriteJournal(std::string path, std::chrono::milliseconds syncInterval);
+	~WriteJournal();
+
+	WriteJournal& operator=(const WriteJournal&) = delete;
+	WriteJournal(const WriteJournal&) = delete;
+
+	// Writes which were journaled but not completed by a previous run, in the order they were appended.
+	// They remain in the journal until they are completed.
+	std::vector<Entry> TakeUnfinished();
+
+	// Returns the sequence number by which the write is to be completed.
+	u64 Append(u64 orderingKey, const std::string& statement);
+	// Writes which failed are not to be completed, such that they are replayed by the next run.
+	void Complete(u64 sequence);
+
+	size_t NumOutstanding();
+	u64 Size();
+
+	void Sync();
+
+private:
+	static const u64 s_compactionSize;
+	static const u32 s_maxNumReplays;
+
+	void read();
+	void reject(const std::vector<std::pair<Entry, u32>>& rejected);
+	void rewrite();
+
+	// Copies the records of all outstanding writes into a fresh journal. Unlocks while copying.
+	void compact(std::unique_lock<std::mutex>& lock);
+	void replace(const std::string& tmpPath);
+
+	void writeRecord(char type, u64 sequence, u64 orderingKey, const std::string& statement);
+	void syncNonThreadsafe();
+
+	void runSyncLoop();
+
+	std::string _path;
+	std::chrono::milliseconds _syncInterval;
+
+	std::FILE* _pFile = nullptr;
+	u64 _size = 0;
+	bool _isDirty = false;
+
+	u64 _nextSequence = 0;
+	std::vector<Entry> _unfinished;
+	// How often each unfinished write was replayed, including by this run
+	std::vector<u32> _numReplays;
+
+	// Where the records of writes which were appended but not completed are, by their sequence
+	struct Record
+	{
+		u64 Offset;
+		u64 Size;
+	};
+
+	std::map<u64, Record> _outstanding;
+	u64 _numOutstandingBytes = 0;
+
+	std::mutex _mutex;
+	std::condition_variable _wakeCondition;
+	bool _shallShutdown = false;
+	bool _isCompactionDue = false;
+	std::thread _syncThread;
+};
+
+PP_NAMESPACE_END
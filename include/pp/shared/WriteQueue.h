@@ -0,0 +1,132 @@
+#pragma once
+
+#include <pp/Common.h>
+#include <pp/shared/WriteJournal.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <set>
+
+PP_NAMESPACE_BEGIN
+
+class AsyncDatabase;
+
+// Bounds the statements handed to a writer by their amount and total size. Producers
+// either block until there is room or are turned away. Once the queue fills past its
+// high watermark it is considered congested until it drained below its low watermark,
+// such that producers can throttle themselves rather than polling the queue's depth.
+// High priority statements only ever wait for other high priority ones, such that a
+// backlog of low priority statements can neither block nor delay them.
+class WriteQueue
+{
+public:
+	using WatermarkCallback = std::function<void()>;
+	using WaitCallback = std::function<void(EPriority priority, std::chrono::microseconds waitTime)>;
+
+	WriteQueue(
+		std::shared_ptr<AsyncDatabase> pWriter,
+		size_t maxNumBytes,
+		size_t maxNumStatements,
+		f32 highWatermark = 0.9f,
+		f32 lowWatermark = 0.5f
+	);
+
+	WriteQueue& operator=(const WriteQueue&) = delete;
+	WriteQueue(const WriteQueue&) = delete;
+
+	// Waits for all pushed statements to be written.
+	~WriteQueue();
+
+	// Blocks until the statement fits. Statements sharing an ordering key are written in order, regardless of priority.
+	void Push(std::string&& statement, u64 orderingKey, EPriority priority = EPriority::Low);
+
+	// Leaves the statement untouched and returns false if it does not fit.
+	bool TryPush(std::string& statement, u64 orderingKey, EPriority priority = EPriority::Low);
+
+	// Callbacks are invoked without the queue being locked, on whichever thread crossed the watermark.
+	void SetWatermarkCallbacks(WatermarkCallback onHighWatermark, WatermarkCallback onLowWatermark);
+
+	// Invoked for every blocking push which had to wait for room.
+	void SetWaitCallback(WaitCallback onWait);
+
+	// Replays the journal's unfinished writes and journals every subsequent one until it was executed.
+	// Must be enabled before anything is pushed. Replayed writes have low priority.
+	void EnableJournal(std::unique_ptr<WriteJournal> pJournal);
+	bool IsJournaled() const { return _pJournal != nullptr; }
+
+	// Returns immediately unless the queue is congested, in which case it blocks until below the low watermark.
+	// High priority producers only wait while their own statements fill the queue.
+	void Throttle(EPriority priority = EPriority::Low);
+
+	// Throws if any statement failed, like ThrowIfFailed.
+	void WaitUntilEmpty();
+
+	// Invoked once every statement pushed so far was executed or failed, regardless of statements pushed afterwards.
+	// Runs on whichever thread finished the last of those statements and must neither push nor throw.
+	void Fence(std::function<void()> onPassed);
+
+	// Throws the first failure of the writer. Pushing throws it as well.
+	void ThrowIfFailed();
+
+	size_t NumStatements() const;
+	size_t NumStatements(EPriority priority) const;
+	size_t NumBytes() const;
+	size_t NumBytes(EPriority priority) const;
+	bool IsCongested() const;
+
+private:
+	bool fits(size_t numBytes, EPriority priority) const;
+
+	static const u64 s_notJournaled = ~0ull;
+
+	void admit(
+		std::unique_lock<std::mutex>& lock,
+		std::string&& statement,
+		u64 orderingKey,
+		EPriority priority,
+		u64 journalSequence = s_notJournaled
+	);
+
+	// Completes the write in the journal, unless it is not journaled, and gives its capacity back
+	void release(size_t numBytes, EPriority priority, u64 journalSequence, u64 ticket);
+	void releaseCapacity(size_t numBytes, EPriority priority, u64 ticket);
+
+	struct PendingFence
+	{
+		// Passed once every statement with a lower ticket was executed
+		u64 Ticket;
+		std::function<void()> OnPassed;
+	};
+
+	std::shared_ptr<AsyncDatabase> _pWriter;
+	std::unique_ptr<WriteJournal> _pJournal;
+
+	size_t _maxNumBytes;
+	size_t _maxNumStatements;
+	f32 _highWatermark;
+	f32 _lowWatermark;
+
+	WatermarkCallback _onHighWatermark;
+	WatermarkCallback _onLowWatermark;
+	WaitCallback _onWait;
+
+	mutable std::mutex _mutex;
+	std::condition_variable _spaceCondition;
+	std::condition_variable _drainedCondition;
+
+	// The watermarks apply to the totals, the capacity to each priority
+	size_t _numBytes = 0;
+	size_t _numStatements = 0;
+	size_t _numBytesByPriority[s_numPriorities] = {};
+	size_t _numStatementsByPriority[s_numPriorities] = {};
+	bool _isCongested = false;
+
+	u64 _nextTicket = 0;
+	std::set<u64> _outstandingTickets;
+	std::deque<PendingFence> _fences;
+};
+
+PP_NAMESPACE_END
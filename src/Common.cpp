@@ -158,4 +158,15 @@ EGamemode ToGamemode(std::string modeString)
 		throw Exception{SRC_POS, StrFormat("Invalid mode '{0}'", modeString)};
 }
 
+std::string PriorityTag(EPriority priority)
+{
+	switch (priority)
+	{
+	case EPriority::High: return "high";
+	case EPriority::Low:  return "low";
+	default:
+		throw Exception{SRC_POS, StrFormat("Unknown priority requested. ({0})", (s32)priority)};
+	}
+}
+
 PP_NAMESPACE_END
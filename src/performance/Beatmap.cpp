@@ -1,6 +1,9 @@
 #include <pp/Common.h>
 #include <pp/performance/Beatmap.h>
 
+#include <algorithm>
+#include <cstring>
+
 PP_NAMESPACE_BEGIN
 
 const std::unordered_map<std::string, Beatmap::EDifficultyAttributeType> Beatmap::s_difficultyAttributes{
@@ -28,6 +31,42 @@ f32 Beatmap::DifficultyAttribute(EMods mods, EDifficultyAttributeType type) cons
 	return difficultyIt == std::end(_difficulty) ? 0.0f : difficultyIt->second[type];
 }
 
+u64 Beatmap::DifficultyHash(bool isBlacklisted) const
+{
+	Fnv1aHash hash;
+	auto combine = [&hash](u64 value) { hash.Combine(value); };
+
+	combine((u64)_rankedStatus);
+	combine((u64)_scoreVersion);
+	combine((u64)_numHitCircles);
+	combine((u64)_numSliders);
+	combine((u64)_numSpinners);
+
+	// The map is unordered, hence mods are visited in sorted order to obtain the same hash for the same content
+	std::vector<std::underlying_type_t<EMods>> mods;
+	for (const auto& entry : _difficulty)
+		mods.emplace_back(entry.first);
+
+	std::sort(std::begin(mods), std::end(mods));
+
+	for (auto m : mods)
+	{
+		combine(m);
+		for (f32 value : _difficulty.at(m))
+		{
+			u32 bits;
+			memcpy(&bits, &value, sizeof(bits));
+			combine(bits);
+		}
+	}
+
+	// Only mixed in when set such that hashes of beatmaps which were never blacklisted stay the same
+	if (isBlacklisted)
+		combine(1);
+
+	return hash.Value();
+}
+
 void Beatmap::SetDifficultyAttribute(EMods mods, EDifficultyAttributeType type, f32 value)
 {
 	_difficulty[MaskRelevantDifficultyMods(_mode, mods)][type] = value;
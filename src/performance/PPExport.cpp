@@ -0,0 +1,314 @@
+#include <pp/Common.h>
+#include <pp/performance/PPExport.h>
+
+#include <cinttypes>
+#include <cmath>
+#include <limits>
+
+PP_NAMESPACE_BEGIN
+
+const u32 PPExport::s_version = 1;
+const size_t PPExport::s_blockSize = 65536;
+const size_t PPExport::s_csvBufferSize = 1024 * 1024;
+
+namespace
+{
+	bool endsWith(const std::string& str, const std::string& suffix)
+	{
+		return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+}
+
+PPExport::PPExport(const std::string& path, bool summarizeDifferences)
+: _path{path}, _tmpPath{path + ".tmp"}, _isCsv{endsWith(path, ".csv")}, _summarizeDifferences{summarizeDifferences}
+{
+	_pFile = fopen(_tmpPath.c_str(), "wb");
+	if (!_pFile)
+		throw ExportException{SRC_POS, StrFormat("Could not open '{0}' for writing.", _tmpPath)};
+
+	if (_isCsv)
+		_csv.reserve(s_csvBufferSize + 256);
+	else
+	{
+		write("PPEXPORT", 8);
+		write(&s_version, sizeof(s_version));
+	}
+}
+
+PPExport::~PPExport()
+{
+	if (!_pFile)
+		return;
+
+	// Exports which were never finished are incomplete, hence they do not replace anything
+	tlog::warning() << StrFormat("Discarding the unfinished export to '{0}'.", _path);
+
+	fclose(_pFile);
+	remove(_tmpPath.c_str());
+}
+
+void PPExport::Add(const std::vector<ScoreRow>& scores)
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	for (const auto& score : scores)
+	{
+		if (_summarizeDifferences)
+			_scoreDifferences.Add(score.ScoreId, score.HasStoredPP, score.StoredPP, score.PP);
+
+		if (_isCsv)
+		{
+			char line[192];
+			int length = snprintf(
+				line, sizeof(line), "score,%" PRId64 ",%" PRId64 ",%d,%u,%.3f,%.5f,",
+				score.ScoreId, score.UserId, score.BeatmapId, (u32)score.Mods, score.PP, score.Accuracy
+			);
+
+			_csv.append(line, length);
+			if (score.HasStoredPP)
+				_csv.append(line, snprintf(line, sizeof(line), "%.3f", score.StoredPP));
+
+			_csv += '\n';
+			if (_csv.size() >= s_csvBufferSize)
+				flushCsvNonThreadsafe();
+		}
+		else
+		{
+			_scores.emplace_back(score);
+			if (_scores.size() >= s_blockSize)
+				flushScoresNonThreadsafe();
+		}
+	}
+
+	_numScores += scores.size();
+}
+
+void PPExport::Add(const UserRow& user)
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	if (_summarizeDifferences)
+		_userDifferences.Add(user.UserId, user.HasStoredPP, user.StoredPP, user.PP);
+
+	if (_isCsv)
+	{
+		char line[128];
+		_csv.append(line, snprintf(line, sizeof(line), "user,%" PRId64 ",%.3f,%.5f,", user.UserId, user.PP, user.Accuracy));
+		if (user.HasStoredPP)
+			_csv.append(line, snprintf(line, sizeof(line), "%.3f", user.StoredPP));
+
+		_csv += '\n';
+		if (_csv.size() >= s_csvBufferSize)
+			flushCsvNonThreadsafe();
+	}
+	else
+	{
+		_users.emplace_back(user);
+		if (_users.size() >= s_blockSize)
+			flushUsersNonThreadsafe();
+	}
+
+	++_numUsers;
+}
+
+void PPExport::Finish()
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	if (!_pFile)
+		throw ExportException{SRC_POS, StrFormat("Export to '{0}' was already finished.", _path)};
+
+	flushNonThreadsafe();
+
+	if (fclose(_pFile) != 0 && _error.empty())
+		_error = StrFormat("Could not write to '{0}'.", _tmpPath);
+
+	_pFile = nullptr;
+
+	if (_error.empty())
+	{
+#ifdef _WIN32
+		// Renaming does not replace existing files on Windows
+		remove(_path.c_str());
+#endif
+		if (rename(_tmpPath.c_str(), _path.c_str()) != 0)
+			_error = StrFormat("Could not rename '{0}' to '{1}'.", _tmpPath, _path);
+	}
+
+	// Failed exports are incomplete, hence they are removed rather than left behind
+	if (!_error.empty())
+	{
+		remove(_tmpPath.c_str());
+		throw ExportException{SRC_POS, _error};
+	}
+
+	tlog::success() << StrFormat("Exported {0} scores and {1} users to '{2}'.", _numScores, _numUsers, _path);
+
+	if (_summarizeDifferences)
+	{
+		_scoreDifferences.Log("scores");
+		_userDifferences.Log("users");
+	}
+}
+
+void PPExport::Differences::Add(s64 id, bool hasStored, f64 stored, f64 value)
+{
+	++NumRows;
+
+	if (!hasStored)
+	{
+		++NumWithoutStored;
+		return;
+	}
+
+	f64 difference = value - stored;
+	f64 absolute = std::abs(difference);
+
+	Sum += difference;
+	SumAbsolute += absolute;
+
+	// Stored pp are of lower precision, hence tiny differences count as unchanged
+	if (difference > 0.001)
+		++NumIncreased;
+	else if (difference < -0.001)
+		++NumDecreased;
+
+	if (difference > LargestIncrease)
+	{
+		LargestIncrease = difference;
+		LargestIncreaseId = id;
+	}
+	else if (difference < LargestDecrease)
+	{
+		LargestDecrease = difference;
+		LargestDecreaseId = id;
+	}
+
+	size_t bucket = 0;
+	for (f64 bound = 0.01; bucket < 5 && absolute >= bound; bound *= 10)
+		++bucket;
+
+	++Histogram[bucket];
+}
+
+void PPExport::Differences::Log(const std::string& name) const
+{
+	if (NumRows == 0)
+		return;
+
+	u64 numCompared = NumRows - NumWithoutStored;
+
+	tlog::info() << StrFormat(
+		"Differences of {0} {1} to their stored pp: {2} increased, {3} decreased, {4} unchanged, {5} without stored pp.",
+		NumRows, name, NumIncreased, NumDecreased, numCompared - NumIncreased - NumDecreased, NumWithoutStored
+	);
+
+	if (numCompared == 0)
+		return;
+
+	// Formatting with a precision drops the sign, hence it is written separately
+	f64 mean = Sum / numCompared;
+	tlog::info() << StrFormat(
+		"    Mean {0}{1p3}pp, mean absolute {2p3}pp, largest increase +{3p3}pp (id {4}), largest decrease -{5p3}pp (id {6}).",
+		mean < 0 ? "-" : "+", std::abs(mean), SumAbsolute / numCompared, LargestIncrease, LargestIncreaseId, -LargestDecrease, LargestDecreaseId
+	);
+
+	tlog::info() << StrFormat(
+		"    Absolute difference < 0.01: {0}, < 0.1: {1}, < 1: {2}, < 10: {3}, < 100: {4}, >= 100: {5}.",
+		Histogram[0], Histogram[1], Histogram[2], Histogram[3], Histogram[4], Histogram[5]
+	);
+}
+
+void PPExport::flushNonThreadsafe()
+{
+	flushScoresNonThreadsafe();
+	flushUsersNonThreadsafe();
+	flushCsvNonThreadsafe();
+}
+
+void PPExport::flushScoresNonThreadsafe()
+{
+	if (_scores.empty())
+		return;
+
+	std::vector<s64> scoreIds, userIds;
+	std::vector<s32> beatmapIds;
+	std::vector<u32> mods;
+	std::vector<f32> pp, accuracies, storedPP;
+
+	for (const auto& score : _scores)
+	{
+		scoreIds.emplace_back(score.ScoreId);
+		userIds.emplace_back(score.UserId);
+		beatmapIds.emplace_back(score.BeatmapId);
+		mods.emplace_back(score.Mods);
+		pp.emplace_back(score.PP);
+		accuracies.emplace_back(score.Accuracy);
+		storedPP.emplace_back(score.HasStoredPP ? score.StoredPP : std::numeric_limits<f32>::quiet_NaN());
+	}
+
+	u32 numRows = (u32)_scores.size();
+	write("S", 1);
+	write(&numRows, sizeof(numRows));
+
+	writeColumn(scoreIds);
+	writeColumn(userIds);
+	writeColumn(beatmapIds);
+	writeColumn(mods);
+	writeColumn(pp);
+	writeColumn(accuracies);
+	writeColumn(storedPP);
+
+	_scores.clear();
+}
+
+void PPExport::flushUsersNonThreadsafe()
+{
+	if (_users.empty())
+		return;
+
+	std::vector<s64> userIds;
+	std::vector<f64> pp, accuracies, storedPP;
+
+	for (const auto& user : _users)
+	{
+		userIds.emplace_back(user.UserId);
+		pp.emplace_back(user.PP);
+		accuracies.emplace_back(user.Accuracy);
+		storedPP.emplace_back(user.HasStoredPP ? user.StoredPP : std::numeric_limits<f64>::quiet_NaN());
+	}
+
+	u32 numRows = (u32)_users.size();
+	write("U", 1);
+	write(&numRows, sizeof(numRows));
+
+	writeColumn(userIds);
+	writeColumn(pp);
+	writeColumn(accuracies);
+	writeColumn(storedPP);
+
+	_users.clear();
+}
+
+void PPExport::flushCsvNonThreadsafe()
+{
+	if (_csv.empty())
+		return;
+
+	write(_csv.data(), _csv.size());
+	_csv.clear();
+}
+
+void PPExport::write(const void* pData, size_t size)
+{
+	// Writing stops at the first failure, which is reported once the export is finished
+	if (!_error.empty())
+		return;
+
+	if (!_pFile)
+		_error = StrFormat("Rows were added to the export to '{0}' after it was finished.", _path);
+	else if (fwrite(pData, 1, size, _pFile) != size)
+		_error = StrFormat("Could not write to '{0}'.", _tmpPath);
+}
+
+PP_NAMESPACE_END
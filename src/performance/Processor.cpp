@@ -1,5 +1,6 @@
 #include <pp/Common.h>
 #include <pp/performance/Processor.h>
+#include <pp/performance/UserSweep.h>
 
 #include <pp/performance/osu/OsuScore.h>
 #include <pp/performance/taiko/TaikoScore.h>
@@ -11,6 +12,8 @@
 
 #include <nlohmann/json.hpp>
 
+#include <future>
+
 using namespace std::chrono;
 
 PP_NAMESPACE_BEGIN
@@ -18,6 +21,9 @@ PP_NAMESPACE_BEGIN
 const Beatmap::ERankedStatus Processor::s_minRankedStatus = Beatmap::Ranked;
 const Beatmap::ERankedStatus Processor::s_maxRankedStatus = Beatmap::Approved;
 
+const u32 Processor::s_maxNumNewScoresProcesses;
+const milliseconds Processor::s_rangeLeaseRetryInterval{1000};
+
 Processor::Processor(EGamemode gamemode, const std::string& configFile)
 : _gamemode{gamemode}
 {
@@ -28,6 +34,8 @@ Processor::Processor(EGamemode gamemode, const std::string& configFile)
 
 	readConfig(configFile);
 
+	_pUserStatsCache = std::make_unique<UserStatsCache>(_gamemode, _config.UserPPColumnName, _config.UserMetadataTableName);
+
 	_isDocker = std::getenv("DOCKER") != NULL;
 
 	_pDataDog = std::make_unique<DDog>(_config.DataDogHost, _config.DataDogPort);
@@ -41,6 +49,7 @@ Processor::Processor(EGamemode gamemode, const std::string& configFile)
 		{
 			try
 			{
+				_pWriteQueue = newWriteQueue();
 				_pDB = newDBConnectionMaster();
 
 				if (retrieveCount(*_pDB, "docker_db_step") >= 2)
@@ -59,7 +68,10 @@ Processor::Processor(EGamemode gamemode, const std::string& configFile)
 		}
 	}
 	else
+	{
+		_pWriteQueue = newWriteQueue();
 		_pDB = newDBConnectionMaster();
+	}
 
 	_pDBSlave = newDBConnectionSlave();
 
@@ -70,8 +82,29 @@ Processor::Processor(EGamemode gamemode, const std::string& configFile)
 
 Processor::~Processor()
 {
-	if (_isDocker)
-		storeCount(*_pDB, "docker_db_step", 3);
+	// Destructors must not throw. Unwritten updates are left to whoever takes over, since their queue
+	// entries were not marked as processed either.
+	try
+	{
+		// Others may only take over our partitions of new scores once all of our updates were written
+		if (_pNewScoresLeases)
+		{
+			_pNewUpdatesBatch->Flush();
+			_pWriteQueue->WaitUntilEmpty();
+			_pNewScoresLeases.reset();
+		}
+
+		if (_isDocker)
+			storeCount(*_pDB, "docker_db_step", 3);
+	}
+	catch (const Exception& e)
+	{
+		e.Log();
+	}
+	catch (...)
+	{
+		tlog::error() << "Uncaught unknown exception while shutting down.";
+	}
 
 	tlog::info() << "Shutting down.";
 }
@@ -83,8 +116,39 @@ void Processor::MonitorNewScores()
 
 	tlog::info() << "Monitoring new scores.";
 
+	{
+		std::lock_guard<std::mutex> lock{_newScoresLagMutex};
+		_isMonitoringNewScores = true;
+	}
+
 	_currentScoreId = retrieveCount(*_pDB, lastScoreIdKey());
 	_currentQueueId = 0;
+	_scorePollInterval = milliseconds{_config.ScoreUpdateInterval};
+
+	if (!_config.ScoreWakeupSocketPath.empty())
+	{
+		tlog::info() << StrFormat("Listening for new score signals at '{0}'.", _config.ScoreWakeupSocketPath);
+		_pNewScoresWakeup = std::make_unique<WakeupSocket>(_config.ScoreWakeupSocketPath);
+	}
+
+	_pNewUpdatesBatch = std::make_unique<UpdateBatch>(_pDB, 0);
+	setCatchingUpNewScores(false);
+
+	// Updates of new scores must not wait behind bulk writes, e.g. those of a concurrent sweep
+	_pNewUpdatesBatch->SetPriority(EPriority::High);
+
+	// Users playing several scores in a row have their row written repeatedly
+	enableCoalescing(*_pNewUpdatesBatch);
+
+	if (_config.NewScoresPartitions > 0)
+	{
+		tlog::info() << StrFormat("Sharing {0} partitions of new scores with other processes.", _config.NewScoresPartitions);
+
+		// Our leases end with this connection
+		_pNewScoresLeases = std::make_unique<LeaseSet>(newDBConnectionMaster(), StrFormat("osu-performance.new.{0}", GamemodeTag(_gamemode)));
+		_isNewScoresPartitionOwned.assign(_config.NewScoresPartitions, false);
+		_newScoresPartitionQueueIds.assign(_config.NewScoresPartitions, 0);
+	}
 
 	auto res = _pDBSlave->Query("SELECT MAX(`approved_date`) FROM `osu_beatmapsets` WHERE 1");
 
@@ -93,6 +157,13 @@ void Processor::MonitorNewScores()
 
 	_lastApprovedDate = (std::string)res[0];
 
+	res = _pDBSlave->Query("SELECT MAX(`last_update`) FROM `osu_beatmaps` WHERE 1");
+
+	if (!res.NextRow())
+		throw ProcessorException(SRC_POS, "Couldn't find latest beatmap update.");
+
+	_lastBeatmapUpdate = (std::string)res[0];
+
 	std::thread beatmapPollThread{[this]()
 	{
 		auto pDbSlave = newDBConnectionSlave();
@@ -109,10 +180,27 @@ void Processor::MonitorNewScores()
 	{
 		while (!_shallShutdown)
 		{
-			if (steady_clock::now() - _lastScorePollTime > milliseconds{_config.ScoreUpdateInterval})
+			if (steady_clock::now() - _lastScorePollTime > _scorePollInterval)
 				pollAndProcessNewScores();
 			else
-				std::this_thread::sleep_for(milliseconds(1));
+			{
+				// Bounds the latency of updates while there are no new scores
+				_pNewUpdatesBatch->FlushIfDue();
+
+				// Users are recomputed on this thread, such that their updates are ordered with those of their new scores
+				if (reprocessNextUser())
+					continue;
+
+				if (!_pNewScoresWakeup)
+					std::this_thread::sleep_for(milliseconds(1));
+				else if (_pNewScoresWakeup->Wait(milliseconds(1)))
+				{
+					_pDataDog->Increment("osu.pp.score.wakeups", 1, {StrFormat("mode:{0}", GamemodeTag(_gamemode))});
+
+					_scorePollInterval = milliseconds{_config.ScoreUpdateInterval};
+					pollAndProcessNewScores();
+				}
+			}
 		}
 	}};
 
@@ -120,24 +208,36 @@ void Processor::MonitorNewScores()
 	beatmapPollThread.join();
 }
 
-void Processor::ProcessAllUsers(bool reProcess, u32 numThreads)
+void Processor::ProcessAllUsers(bool reProcess, u32 numThreads, bool onlyOutdated)
 {
-	ThreadPool threadPool{numThreads};
-	std::vector<std::shared_ptr<DatabaseConnection>> dbConnections;
-	std::vector<std::shared_ptr<DatabaseConnection>> dbSlaveConnections;
-	std::vector<UpdateBatch> newUsersBatches;
-	std::vector<UpdateBatch> newScoresBatches;
-
-	for (u32 i = 0; i < numThreads; ++i)
+	std::string userCondition;
+	if (onlyOutdated)
 	{
-		dbConnections.push_back(newDBConnectionMaster());
-		dbSlaveConnections.push_back(newDBConnectionSlave());
+		std::vector<s32> beatmapIds;
+		if (!findOutdatedBeatmaps(beatmapIds))
+			tlog::info() << "The formula changed since the last run. Processing everybody.";
+		else if (beatmapIds.empty())
+		{
+			tlog::success() << "All users are up to date.";
+			return;
+		}
+		else
+		{
+			std::string beatmapIdList;
+			for (s32 beatmapId : beatmapIds)
+				beatmapIdList += StrFormat("{0},", beatmapId);
 
-		newUsersBatches.emplace_back(dbConnections[i], 10000);
-		newScoresBatches.emplace_back(dbConnections[i], 10000);
+			beatmapIdList.pop_back();
+
+			tlog::info() << StrFormat("Difficulty of {0} beatmaps changed since the last run.", beatmapIds.size());
+			userCondition = StrFormat(
+				"`s`.`user_id` IN (SELECT `user_id` FROM `osu_scores{0}_high` WHERE `beatmap_id` IN ({1}))",
+				GamemodeSuffix(_gamemode), beatmapIdList
+			);
+		}
 	}
 
-	static const s32 s_maxNumUsers = 10000;
+	UserSweep sweep{*this, numThreads};
 
 	s64 currentUserId; // Will be initialized in the next few lines
 	if (reProcess)
@@ -145,14 +245,15 @@ void Processor::ProcessAllUsers(bool reProcess, u32 numThreads)
 		currentUserId = 0;
 
 		// Make sure in case of a restart we still do the full process, even if we didn't trigger a store before
-		storeCount(*_pDB, lastUserIdKey(), currentUserId);
+		if (!_pExport)
+			storeCount(*_pDB, lastUserIdKey(), currentUserId);
 	}
 	else
 		currentUserId = retrieveCount(*_pDB, lastUserIdKey());
 
 	auto res = _pDBSlave->Query(StrFormat(
-		"SELECT COUNT(`user_id`) FROM `osu_user_stats{0}` WHERE `user_id`>={1}",
-		GamemodeSuffix(_gamemode), currentUserId
+		"SELECT COUNT(`s`.`user_id`) FROM `osu_user_stats{0}` `s` WHERE `s`.`user_id`>={1}{2}",
+		GamemodeSuffix(_gamemode), currentUserId, userCondition.empty() ? "" : " AND " + userCondition
 	));
 
 	if (!res.NextRow())
@@ -163,78 +264,46 @@ void Processor::ProcessAllUsers(bool reProcess, u32 numThreads)
 	tlog::info() << StrFormat("Processing all users with ID larger than {0}.", currentUserId);
 	auto progress = tlog::progress(numUsers);
 
-	std::atomic<s64> numUsersProcessed{0};
-	u32 currentConnection = 0;
-	auto lastProgressUpdate = steady_clock::now();
-
-	// We will break out as soon as there are no more results
-	while (true)
+	s64 lastStoredUserId = currentUserId;
+	currentUserId = enqueueUserRange(sweep, currentUserId, std::numeric_limits<s64>::max(), userCondition, [&]()
 	{
-		res = _pDBSlave->Query(StrFormat(
-			"SELECT "
-			"`user_id`"
-			"FROM `osu_user_stats{0}` "
-			"WHERE `user_id`>{1} ORDER BY `user_id` ASC LIMIT {2}",
-			GamemodeSuffix(_gamemode), currentUserId, s_maxNumUsers
-		));
-
-		if (res.NumRows() == 0)
-			break;
+		progress.update(sweep.NumUsersProcessed());
 
-		while (res.NextRow())
+		// After a restart we continue behind the last user up to which everything is done
+		s64 checkpoint = sweep.Checkpoint();
+		if (checkpoint > lastStoredUserId && !_pExport)
 		{
-			s64 userId = res[0];
-
-			threadPool.EnqueueTask(
-				[&, userId, currentConnection]()
-				{
-					processSingleUser(
-						0, // We want to update _all_ scores
-						*dbConnections[currentConnection],
-						*dbSlaveConnections[currentConnection],
-						newUsersBatches[currentConnection],
-						newScoresBatches[currentConnection],
-						userId
-					);
-
-					++numUsersProcessed;
-				}
-			);
-
-			currentConnection = (currentConnection + 1) % numThreads;
-			currentUserId = std::max(currentUserId, userId);
-
-			// Shut down when requested!
-			if (_shallShutdown)
-				return;
+			storeCount(*_pDB, lastUserIdKey(), checkpoint);
+			lastStoredUserId = checkpoint;
 		}
 
-		u32 numPendingQueries = 0;
+		return true;
+	});
 
-		do
-		{
-			u32 numPendingQueries = 0;
-			for (auto& pDBConn : dbConnections)
-				numPendingQueries += (u32)pDBConn->NumPendingQueries();
+	// Shut down when requested!
+	if (_shallShutdown)
+		return;
 
-			_pDataDog->Gauge("osu.pp.db.pending_queries", numPendingQueries,
-			{
-				StrFormat("mode:{0}", GamemodeTag(_gamemode)),
-				"connection:background",
-			}, 0.01f);
+	sweep.WaitUntilFinished([&]() { progress.update(sweep.NumUsersProcessed()); });
 
-			if (steady_clock::now() - lastProgressUpdate > milliseconds{100})
-			{
-				progress.update(numUsersProcessed);
-				lastProgressUpdate += milliseconds{100};
-			}
+	// Failed users are redone by the next run, which continues right before the first of them
+	if (sweep.NumUsersFailed() > 0)
+	{
+		s64 checkpoint = sweep.Checkpoint();
+		if (checkpoint > lastStoredUserId && !_pExport)
+			storeCount(*_pDB, lastUserIdKey(), checkpoint);
 
-			std::this_thread::sleep_for(milliseconds{10});
-		}
-		while (threadPool.GetNumTasksInSystem() > 0 || numPendingQueries > 0);
+		throw ProcessorException(SRC_POS, StrFormat("Failed to process {0} users.", sweep.NumUsersFailed()));
+	}
 
+	// Exports leave the progress of runs writing to the database alone
+	if (!_pExport)
+	{
 		// Update our user_id counter
 		storeCount(*_pDB, lastUserIdKey(), currentUserId);
+
+		// Everybody is now computed with the current formula and difficulty
+		storeVersions();
 	}
 
 	tlog::success() << StrFormat(
@@ -244,237 +313,742 @@ void Processor::ProcessAllUsers(bool reProcess, u32 numThreads)
 	);
 }
 
-void Processor::ProcessSQL(u32 numThreads, std::string sql)
+void Processor::ProcessAllUsersDistributed(bool reProcess, u32 numThreads)
 {
-	ThreadPool threadPool{numThreads};
-	std::vector<std::shared_ptr<DatabaseConnection>> dbConnections;
-	std::vector<std::shared_ptr<DatabaseConnection>> dbSlaveConnections;
-	std::vector<UpdateBatch> newUsersBatches;
-	std::vector<UpdateBatch> newScoresBatches;
+	if (_pExport)
+		throw ProcessorException(SRC_POS, "Distributed runs can not be exported.");
+
+	// Leases end with this connection, such that the ranges of workers which died are issued again
+	LeaseSet leases{newDBConnectionMaster(), StrFormat("osu-performance.all.{0}", GamemodeTag(_gamemode))};
+
+	s64 rangeSize;
+	u32 numRanges;
+	if (!beginDistributedRun(leases, reProcess, rangeSize, numRanges))
+		return;
 
-	for (u32 i = 0; i < numThreads; ++i)
+	UserSweep sweep{*this, numThreads};
+	auto startTime = steady_clock::now();
+
+	while (!_shallShutdown)
 	{
-		dbConnections.push_back(newDBConnectionMaster());
-		dbSlaveConnections.push_back(newDBConnectionSlave());
+		// Progress of all workers is kept in one place, namely the checkpoints of the ranges
+		auto checkpoints = retrieveRangeCheckpoints(numRanges, rangeSize);
 
-		newUsersBatches.emplace_back(dbConnections[i], 10000);
-		newScoresBatches.emplace_back(dbConnections[i], 10000);
-	}
+		std::vector<u32> candidates;
+		std::vector<std::string> candidateNames;
+		for (u32 i = 0; i < numRanges; ++i)
+		{
+			if (checkpoints[i] >= (i + 1) * rangeSize - 1)
+				continue;
 
-	auto res = _pDBSlave->Query(sql);
+			candidates.emplace_back(i);
+			candidateNames.emplace_back(StrFormat("range.{0}", i));
+		}
 
-	if (res.NumRows() == 0)
-		throw ProcessorException(SRC_POS, "SQL query returned 0 users to process.");
+		u32 numRangesDone = numRanges - (u32)candidates.size();
+		_pDataDog->Gauge("osu.pp.all.ranges_done", numRangesDone, {StrFormat("mode:{0}", GamemodeTag(_gamemode))});
+		tlog::info() << StrFormat("{0} of {1} ranges of user IDs are done.", numRangesDone, numRanges);
 
-	const s64 numUsers = res.NumRows();
+		if (candidates.empty())
+			break;
 
-	tlog::info() << StrFormat("Processing {0} users.", numUsers);
-	auto progress = tlog::progress(numUsers);
+		auto isCandidateLeased = leases.AreLeased(candidateNames);
+
+		size_t claimedIdx = candidates.size();
+		for (size_t i = 0; i < candidates.size(); ++i)
+		{
+			if (!isCandidateLeased[i] && leases.TryAcquire(candidateNames[i]))
+			{
+				claimedIdx = i;
+				break;
+			}
+		}
+
+		if (claimedIdx == candidates.size())
+		{
+			// The remaining ranges are being processed by others. Should they die, their ranges become free again.
+			std::this_thread::sleep_for(s_rangeLeaseRetryInterval);
+			continue;
+		}
 
-	std::atomic<s64> numUsersProcessed{0};
-	u32 currentConnection = 0;
-	auto lastProgressUpdate = steady_clock::now();
+		u32 range = candidates[claimedIdx];
+		const std::string& leaseName = candidateNames[claimedIdx];
 
-	while (res.NextRow())
-	{
-		s64 userId = res[0];
+		// The range may have been finished by its previous owner since we looked
+		s64 checkpoint = retrieveRangeCheckpoints(numRanges, rangeSize)[range];
+		s64 endUserId = (range + 1) * rangeSize;
+		if (checkpoint >= endUserId - 1)
+		{
+			leases.Release(leaseName);
+			continue;
+		}
 
-		threadPool.EnqueueTask(
-			[&, userId, currentConnection]() {
-				processSingleUser(
-					0, // We want to update _all_ scores
-					*dbConnections[currentConnection],
-					*dbSlaveConnections[currentConnection],
-					newUsersBatches[currentConnection],
-					newScoresBatches[currentConnection],
-					userId);
+		tlog::info() << StrFormat("Processing users with ID from {0} to {1}.", checkpoint + 1, endUserId - 1);
 
-				++numUsersProcessed;
-			});
+		std::string key = rangeCheckpointKey(range);
+		s64 lastStoredUserId = checkpoint;
+		bool isLeaseLost = false;
+
+		// Users of the previous range must not be mistaken for progress within this one
+		sweep.ResetCheckpoint();
+		s64 numUsersFailed = sweep.NumUsersFailed();
+
+		enqueueUserRange(sweep, checkpoint, endUserId, "", [&]()
+		{
+			// Our lease persists as long as its connection. Checking that it is still ours serves as heartbeat.
+			if (!leases.Verify().empty())
+			{
+				tlog::warning() << StrFormat("Lost the lease of range {0}.", range);
+				isLeaseLost = true;
+				return false;
+			}
 
-		currentConnection = (currentConnection + 1) % numThreads;
+			// Nothing to store until the first users are done
+			s64 checkpoint = sweep.Checkpoint();
+			if (checkpoint > lastStoredUserId)
+			{
+				storeCount(*_pDB, key, checkpoint);
+				lastStoredUserId = checkpoint;
+			}
+
+			return true;
+		});
 
-		// Shut down when requested!
+		// Shut down when requested! Our ranges are continued from their checkpoints by others.
 		if (_shallShutdown)
 			return;
-	}
-
-	u32 numPendingQueries = 0;
 
-	do
-	{
-		u32 numPendingQueries = 0;
-		for (auto &pDBConn : dbConnections)
-			numPendingQueries += (u32)pDBConn->NumPendingQueries();
+		sweep.WaitUntilFinished([]() {});
 
-		_pDataDog->Gauge("osu.pp.db.pending_queries", numPendingQueries,
-						 {
-							 StrFormat("mode:{0}", GamemodeTag(_gamemode)),
-							 "connection:background",
-						 },
-						 0.01f);
+		if (isLeaseLost)
+			continue;
 
-		if (steady_clock::now() - lastProgressUpdate > milliseconds{100})
+		// The range is continued right before its first failed user by whoever claims it next
+		if (sweep.NumUsersFailed() > numUsersFailed)
 		{
-			progress.update(numUsersProcessed);
-			lastProgressUpdate += milliseconds{100};
+			s64 checkpoint = sweep.Checkpoint();
+			if (checkpoint > lastStoredUserId)
+				storeCount(*_pDB, key, checkpoint);
+
+			waitUntilWritten();
+			leases.Release(leaseName);
+
+			throw ProcessorException(SRC_POS, StrFormat(
+				"Failed to process {0} users of range {1}.", sweep.NumUsersFailed() - numUsersFailed, range
+			));
 		}
 
-		std::this_thread::sleep_for(milliseconds{10});
-	} while (threadPool.GetNumTasksInSystem() > 0 || numPendingQueries > 0);
+		storeCount(*_pDB, key, endUserId - 1);
+
+		// Whoever sees the range free next must also see it done
+		waitUntilWritten();
+		leases.Release(leaseName);
+	}
 
 	tlog::success() << StrFormat(
-		"Processed all {0} users for {1}.",
-		numUsers,
-		tlog::durationToString(progress.duration()));
+		"Processed {0} users as part of a distributed run for {1}.",
+		sweep.NumUsersProcessed(),
+		tlog::durationToString(steady_clock::now() - startTime)
+	);
 }
 
-void Processor::ProcessUsers(const std::vector<std::string> &userNames)
+bool Processor::beginDistributedRun(LeaseSet& leases, bool reProcess, s64& rangeSize, u32& numRanges)
 {
-	std::vector<s64> userIds;
-	for (const auto& name : userNames)
-	{
-		s64 id = strtoll(name.c_str(), 0, 0);
-		if (id == 0)
-		{
-			// If the given string is not a number, try treating it as a username
-			auto res = _pDBSlave->Query(StrFormat(
-				"SELECT `user_id` FROM `{0}` WHERE `username`='{1}'",
-				_config.UserMetadataTableName, name
-			));
+	// Only one worker at a time may inspect and begin runs. Leases of workers which die while holding it are released.
+	while (!leases.TryAcquire("coordinator"))
+		std::this_thread::sleep_for(milliseconds{100});
 
-			if (!res.NextRow())
-				continue;
+	numRanges = (u32)retrieveCount(*_pDB, allRangesKey(), 0);
+	rangeSize = retrieveCount(*_pDB, allRangeSizeKey(), 0);
 
-			id = res[0];
-		}
+	bool isInProgress = false;
+	if (numRanges > 0 && rangeSize > 0)
+	{
+		auto checkpoints = retrieveRangeCheckpoints(numRanges, rangeSize);
+		for (u32 i = 0; i < numRanges; ++i)
+			isInProgress = isInProgress || checkpoints[i] < (i + 1) * rangeSize - 1;
+	}
 
-		userIds.emplace_back(id);
+	if (isInProgress)
+	{
+		tlog::info() << StrFormat("Joining the run in progress over {0} ranges of {1} user IDs.", numRanges, rangeSize);
+		leases.Release("coordinator");
+		return true;
 	}
 
-	ProcessUsers(userIds);
-}
+	if (!reProcess)
+	{
+		tlog::info() << "There is no run in progress to continue.";
+		leases.Release("coordinator");
+		return false;
+	}
 
-void Processor::ProcessUsers(const std::vector<s64>& userIds)
-{
-	UpdateBatch newUsers{_pDB, 10000};
-	UpdateBatch newScores{_pDB, 10000};
+	auto res = _pDBSlave->Query(StrFormat("SELECT MAX(`user_id`) FROM `osu_user_stats{0}`", GamemodeSuffix(_gamemode)));
+	if (!res.NextRow())
+		throw ProcessorException(SRC_POS, "Could not find the largest user ID.");
 
-	tlog::info() << StrFormat("Processing {0} users.", userIds.size());
-	auto progress = tlog::progress(userIds.size());
+	s64 maxUserId = res.IsNull(0) ? 0 : (s64)res[0];
 
-	std::vector<User> users;
-	for (s64 userId : userIds)
+	// Forget the progress of the previous run. Written right away, since other workers are about to read it.
+	if (numRanges > 0)
 	{
-		users.emplace_back(processSingleUser(
-			0, // We want to update _all_ scores
-			*_pDB,
-			*_pDBSlave,
-			newUsers,
-			newScores,
-			userId
-		));
+		std::string names;
+		for (u32 i = 0; i < numRanges; ++i)
+			names += StrFormat("'{0}',", rangeCheckpointKey(i));
 
-		progress.update(users.size());
+		names.pop_back();
+		_pDB->NonQuery(StrFormat("DELETE FROM `osu_counts` WHERE `name` IN ({0})", names));
 	}
 
-	tlog::info() << StrFormat("Sorting {0} users.", users.size());
+	rangeSize = std::max<s64>(_config.AllRangeSize, 1);
+	numRanges = (u32)(maxUserId / rangeSize + 1);
 
-	std::sort(std::begin(users), std::end(users), [](const User& a, const User& b) {
-		if (a.GetPPRecord().Value != b.GetPPRecord().Value)
-			return a.GetPPRecord().Value > b.GetPPRecord().Value;
+	_pDB->NonQuery(storeCountQuery(allRangeSizeKey(), rangeSize));
+	_pDB->NonQuery(storeCountQuery(allRangesKey(), numRanges));
 
-		return a.Id() > b.Id();
-	});
+	tlog::info() << StrFormat("Began a new run over {0} ranges of {1} user IDs.", numRanges, rangeSize);
 
-	tlog::success() << StrFormat(
-		"Processed {0} users for {1}.",
-		users.size(),
-		tlog::durationToString(progress.duration())
-	);
+	leases.Release("coordinator");
+	return true;
+}
 
-	tlog::info() << "=============================================";
-	tlog::info() << "======= USER SUMMARY ========================";
-	tlog::info() << "=============================================";
-	tlog::info() << "            Name        Id    Perf.      Acc.";
-	tlog::info() << "---------------------------------------------";
+std::vector<s64> Processor::retrieveRangeCheckpoints(u32 numRanges, s64 rangeSize)
+{
+	// Ranges which were not started yet have no checkpoint
+	std::vector<s64> checkpoints;
+	std::unordered_map<std::string, u32> rangesByKey;
+	std::string names;
+	for (u32 i = 0; i < numRanges; ++i)
+	{
+		checkpoints.emplace_back(i * rangeSize - 1);
+		rangesByKey[rangeCheckpointKey(i)] = i;
+		names += StrFormat("'{0}',", rangeCheckpointKey(i));
+	}
 
-	for (const auto& user : users)
+	if (names.empty())
+		return checkpoints;
+
+	names.pop_back();
+
+	// Read from the master, since other workers just wrote there
+	auto res = _pDB->Query(StrFormat("SELECT `name`,`count` FROM `osu_counts` WHERE `name` IN ({0})", names));
+	while (res.NextRow())
 	{
-		tlog::info() << StrFormat(
-			"{0w16ar}  {1w8ar}  {2w5ar}pp  {3w6arp2} %",
-			retrieveUserName(user.Id(), *_pDBSlave),
-			user.Id(),
-			(s32)std::round(user.GetPPRecord().Value),
-			user.GetPPRecord().Accuracy
-		);
+		if (!res.IsNull(1))
+			checkpoints[rangesByKey[(std::string)res[0]]] = res[1];
 	}
 
-	tlog::info() << "=============================================";
+	return checkpoints;
 }
 
-void Processor::ProcessScores(const std::vector<s64>& scoreIds)
+s64 Processor::enqueueUserRange(
+	UserSweep& sweep,
+	s64 afterUserId,
+	s64 endUserId,
+	const std::string& userCondition,
+	const std::function<bool()>& onCheckpoint
+)
 {
-	UpdateBatch newUsers{_pDB, 10000};
-	UpdateBatch newScores{_pDB, 10000};
+	static const s32 s_maxNumUsers = 10000;
+	static const s32 s_checkpointInterval = 1000;
 
-	tlog::info() << StrFormat("Processing {0} scores.", scoreIds.size());
-	auto progress = tlog::progress(scoreIds.size());
+	// Pages are fetched on their own connection while the previous page is being processed
+	auto pDBSlavePages = newDBConnectionSlave();
+	auto fetchPage = [this, &pDBSlavePages, endUserId, &userCondition](s64 afterUserId)
+	{
+		// The page also provides the stats of its users, such that processing them needs no further reads
+		auto res = pDBSlavePages->Query(_pUserStatsCache->SelectQuery(StrFormat(
+			"`s`.`user_id`>{0} AND `s`.`user_id`<{1}{3} ORDER BY `s`.`user_id` ASC LIMIT {2}",
+			afterUserId, endUserId, s_maxNumUsers, userCondition.empty() ? "" : " AND " + userCondition
+		)));
 
-	struct Result {
-		Score::PPRecord PP;
-		s64 UserId;
-		EMods Mods;
+		std::vector<s64> userIds;
+		while (res.NextRow())
+		{
+			userIds.emplace_back(res[0]);
+			_pUserStatsCache->Insert(res);
+		}
+
+		return userIds;
 	};
 
-	std::vector<Result> results;
+	auto nextPage = std::async(std::launch::async, fetchPage, afterUserId);
 
-	for (s64 scoreId : scoreIds)
-	{
-		// Get user ID for this particular score
-		auto res = _pDBSlave->Query(StrFormat(
-			"SELECT `user_id`,`enabled_mods` FROM `osu_scores{0}_high` WHERE `score_id`='{1}'",
-			GamemodeSuffix(_gamemode), scoreId
-		));
+	s32 numUsersSinceCheckpoint = 0;
 
-		if (!res.NextRow())
-			continue;
+	// We will break out as soon as there are no more results
+	while (true)
+	{
+		auto userIds = nextPage.get();
+		if (userIds.empty())
+			break;
 
-		User user = processSingleUser(scoreId, *_pDB, *_pDBSlave, newUsers, newScores, res[0]);
+		// Users complete out of order, hence there is no need to wait for this page before starting the next
+		nextPage = std::async(std::launch::async, fetchPage, userIds.back());
 
-		auto scoreIt = std::find_if(std::begin(user.Scores()), std::end(user.Scores()), [scoreId](const Score::PPRecord& a)
+		for (s64 userId : userIds)
 		{
-			return a.ScoreId == scoreId;
-		});
+			sweep.Enqueue(userId);
+			afterUserId = userId;
 
-		if (scoreIt == std::end(user.Scores()))
-		{
-			tlog::warning() << StrFormat("Could not find score ID {0} in result set.", scoreId);
-			continue;
-		}
+			if (_shallShutdown)
+				return afterUserId;
+
+			if (++numUsersSinceCheckpoint < s_checkpointInterval)
+				continue;
 
-		results.push_back({*scoreIt, user.Id(), res[1]});
-		progress.update(results.size());
+			numUsersSinceCheckpoint = 0;
+			if (!onCheckpoint())
+				return afterUserId;
+		}
 	}
 
-	tlog::info() << StrFormat("Sorting {0} results.", results.size());
+	return afterUserId;
+}
 
-	std::sort(std::begin(results), std::end(results), [](const Result& a, const Result& b) {
-		if (a.PP.Value != b.PP.Value)
-			return a.PP.Value > b.PP.Value;
+void Processor::ProcessBeatmaps(const std::vector<s32>& beatmapIds, u32 numThreads)
+{
+	static const s32 s_maxNumScores = 10000;
 
-		return a.PP.ScoreId > b.PP.ScoreId;
-	});
+	refreshBeatmaps(beatmapIds);
 
-	tlog::success() << StrFormat(
-		"Processed {0} scores for {1}.",
-		scoreIds.size(),
-		tlog::durationToString(progress.duration())
-	);
+	std::unordered_set<s64> userIds;
+	s64 numScores = 0;
 
-	tlog::info() << "================================================================================";
-	tlog::info() << "======= SCORE SUMMARY ==========================================================";
-	tlog::info() << "================================================================================";
+	tlog::info() << StrFormat("Processing scores on {0} beatmaps.", beatmapIds.size());
+	auto startTime = steady_clock::now();
+
+	{
+		// Scores are written in bulk by the shared writer
+		UpdateBatch newScores{_pWriteQueue, 0, 10000};
+
+		for (s32 beatmapId : beatmapIds)
+		{
+			// Pages of scores follow the beatmap_id index
+			s64 currentScoreId = 0;
+			while (true)
+			{
+				auto res = _pDBSlave->Query(scoresQuery(StrFormat(
+					"`beatmap_id`={0} AND `score_id`>{1} ORDER BY `score_id` ASC LIMIT {2}",
+					beatmapId, currentScoreId, s_maxNumScores
+				)));
+
+				if (res.NumRows() == 0)
+					break;
+
+				while (res.NextRow())
+				{
+					currentScoreId = res[0];
+					userIds.insert(res[1]);
+				}
+
+				// Most scores keep their pp when a beatmap is reprocessed
+				res.Rewind();
+				numScores += computeScores(*_pDBSlave, res, &newScores, true).size();
+			}
+		}
+	}
+
+	tlog::info() << StrFormat(
+		"Processed {0} scores for {1}. Processing {2} affected users.",
+		numScores,
+		tlog::durationToString(steady_clock::now() - startTime),
+		userIds.size()
+	);
+
+	// Users' totals are recomputed afterwards, once all their scores on the beatmaps are known
+	UserSweep sweep{*this, numThreads};
+	auto progress = tlog::progress(userIds.size());
+
+	for (s64 userId : userIds)
+	{
+		sweep.Enqueue(userId);
+
+		if (_shallShutdown)
+			return;
+	}
+
+	sweep.WaitUntilFinished([&]() { progress.update(sweep.NumUsersProcessed()); });
+
+	tlog::success() << StrFormat(
+		"Processed {0} users for {1}.",
+		userIds.size(),
+		tlog::durationToString(progress.duration())
+	);
+}
+
+u32 Processor::formulaVersion() const
+{
+	switch (_gamemode)
+	{
+	case EGamemode::Osu:
+		return OsuScore::s_formulaVersion;
+
+	case EGamemode::Taiko:
+		return TaikoScore::s_formulaVersion;
+
+	case EGamemode::Catch:
+		return CatchScore::s_formulaVersion;
+
+	case EGamemode::Mania:
+		return ManiaScore::s_formulaVersion;
+
+	default:
+		throw ProcessorException(SRC_POS, StrFormat("Unknown gamemode requested. ({0})", _gamemode));
+	}
+}
+
+bool Processor::findOutdatedBeatmaps(std::vector<s32>& beatmapIds)
+{
+	if (retrieveCount(*_pDB, formulaVersionKey(), -1) != formulaVersion())
+		return false;
+
+	auto res = _pDB->Query(StrFormat(
+		"SELECT `beatmap_id`,`version` FROM `osu_beatmap_performance_versions` WHERE `mode`={0}", _gamemode
+	));
+
+	std::unordered_map<s32, u64> versions;
+	while (res.NextRow())
+		versions[res[0]] = res[1];
+
+	RWLock lock{&_beatmapMutex, false};
+
+	for (const auto& entry : _beatmaps)
+	{
+		auto versionIt = versions.find(entry.first);
+		if (versionIt == std::end(versions) || versionIt->second != entry.second.DifficultyHash(_blacklistedBeatmapIds.count(entry.first) > 0))
+			beatmapIds.emplace_back(entry.first);
+	}
+
+	// Scores on beatmaps which are no longer ranked lost their pp
+	for (const auto& entry : versions)
+		if (_beatmaps.count(entry.first) == 0)
+			beatmapIds.emplace_back(entry.first);
+
+	return true;
+}
+
+void Processor::storeVersions()
+{
+	static const size_t s_maxNumRows = 1000;
+
+	_pDB->NonQuery(
+		"CREATE TABLE IF NOT EXISTS `osu_beatmap_performance_versions` ("
+		"`beatmap_id` INT UNSIGNED NOT NULL,"
+		"`mode` TINYINT UNSIGNED NOT NULL,"
+		"`version` BIGINT UNSIGNED NOT NULL,"
+		"PRIMARY KEY (`beatmap_id`,`mode`))"
+	);
+
+	std::vector<std::string> rows;
+	{
+		RWLock lock{&_beatmapMutex, false};
+		for (const auto& entry : _beatmaps)
+			rows.emplace_back(StrFormat(
+				"({0},{1},{2})", entry.first, _gamemode, entry.second.DifficultyHash(_blacklistedBeatmapIds.count(entry.first) > 0)
+			));
+	}
+
+	// Versions and the formula version are replaced atomically, such that an interrupted store never
+	// leaves versions behind which claim beatmaps to be up to date. The transaction runs on its own
+	// connection since other threads may use the shared one in the meantime. Destroying the connection
+	// without committing rolls the transaction back.
+	auto pDB = newDBConnectionMaster();
+	pDB->NonQuery("START TRANSACTION");
+
+	pDB->NonQuery(StrFormat("DELETE FROM `osu_beatmap_performance_versions` WHERE `mode`={0}", _gamemode));
+
+	for (size_t i = 0; i < rows.size(); i += s_maxNumRows)
+	{
+		std::vector<std::string> chunk{std::begin(rows) + i, std::begin(rows) + std::min(i + s_maxNumRows, rows.size())};
+		pDB->NonQuery(StrFormat(
+			"INSERT INTO `osu_beatmap_performance_versions`(`beatmap_id`,`mode`,`version`) VALUES {0}",
+			Join(chunk, ",")
+		));
+	}
+
+	pDB->NonQuery(storeCountQuery(formulaVersionKey(), formulaVersion()));
+	pDB->NonQuery("COMMIT");
+}
+
+void Processor::ProcessSQL(u32 numThreads, std::string sql)
+{
+	UserSweep sweep{*this, numThreads};
+
+	auto res = _pDBSlave->Query(sql);
+
+	if (res.NumRows() == 0)
+		throw ProcessorException(SRC_POS, "SQL query returned 0 users to process.");
+
+	const s64 numUsers = res.NumRows();
+
+	tlog::info() << StrFormat("Processing {0} users.", numUsers);
+	auto progress = tlog::progress(numUsers);
+
+	static const size_t s_numUsersPerChunk = 1000;
+
+	std::vector<s64> userIds;
+	while (true)
+	{
+		bool hasRow = res.NextRow();
+		if (hasRow)
+			userIds.emplace_back(res[0]);
+
+		if (userIds.size() < s_numUsersPerChunk && hasRow)
+			continue;
+
+		// Load the stats of a chunk of users at once rather than each user individually
+		_pUserStatsCache->Load(*_pDBSlave, userIds);
+
+		for (s64 userId : userIds)
+		{
+			sweep.Enqueue(userId);
+
+			// Shut down when requested!
+			if (_shallShutdown)
+				return;
+		}
+
+		userIds.clear();
+
+		if (!hasRow)
+			break;
+	}
+
+	sweep.WaitUntilFinished([&]() { progress.update(sweep.NumUsersProcessed()); });
+
+	tlog::success() << StrFormat(
+		"Processed all {0} users for {1}.",
+		numUsers,
+		tlog::durationToString(progress.duration()));
+}
+
+void Processor::Serve(u32 numThreads)
+{
+	tlog::info() << "Serving new scores while recomputing all users in the background.";
+
+	_isServing = true;
+
+	// Beatmaps, user stats and the writer are shared. New scores keep their own thread,
+	// such that they are never queued behind the sweep's work.
+	std::thread monitorThread{[this]()
+	{
+		try
+		{
+			MonitorNewScores();
+		}
+		catch (const Exception& e)
+		{
+			e.Log();
+		}
+
+		// The sweep may not continue without the monitor, or it would stop yielding
+		_shallShutdown = true;
+		updateNewScoresLag(0);
+	}};
+
+	try
+	{
+		// The first sweep continues where a previous one left off. Later ones start over.
+		bool reProcess = false;
+		while (!_shallShutdown)
+		{
+			ProcessAllUsers(reProcess, numThreads);
+			reProcess = true;
+		}
+	}
+	catch (...)
+	{
+		_shallShutdown = true;
+		monitorThread.join();
+		throw;
+	}
+
+	monitorThread.join();
+}
+
+void Processor::ProcessUsers(const std::vector<std::string> &userNames)
+{
+	std::vector<s64> userIds;
+	for (const auto& name : userNames)
+	{
+		s64 id = strtoll(name.c_str(), 0, 0);
+		if (id == 0)
+		{
+			// If the given string is not a number, try treating it as a username
+			auto res = _pDBSlave->Query(StrFormat(
+				"SELECT `user_id` FROM `{0}` WHERE `username`='{1}'",
+				_config.UserMetadataTableName, name
+			));
+
+			if (!res.NextRow())
+				continue;
+
+			id = res[0];
+		}
+
+		userIds.emplace_back(id);
+	}
+
+	ProcessUsers(userIds);
+}
+
+void Processor::ProcessUsers(const std::vector<s64>& userIds)
+{
+	UpdateBatch newUsers{_pDB, 10000};
+	UpdateBatch newScores{_pDB, 10000};
+
+	tlog::info() << StrFormat("Processing {0} users.", userIds.size());
+	auto progress = tlog::progress(userIds.size());
+
+	_pUserStatsCache->Load(*_pDBSlave, userIds);
+
+	std::vector<User> users;
+	for (s64 userId : userIds)
+	{
+		users.emplace_back(processSingleUser(
+			0, // We want to update _all_ scores
+			*_pDB,
+			*_pDBSlave,
+			newUsers,
+			newScores,
+			userId
+		));
+
+		progress.update(users.size());
+	}
+
+	tlog::info() << StrFormat("Sorting {0} users.", users.size());
+
+	std::sort(std::begin(users), std::end(users), [](const User& a, const User& b) {
+		if (a.GetPPRecord().Value != b.GetPPRecord().Value)
+			return a.GetPPRecord().Value > b.GetPPRecord().Value;
+
+		return a.Id() > b.Id();
+	});
+
+	tlog::success() << StrFormat(
+		"Processed {0} users for {1}.",
+		users.size(),
+		tlog::durationToString(progress.duration())
+	);
+
+	tlog::info() << "=============================================";
+	tlog::info() << "======= USER SUMMARY ========================";
+	tlog::info() << "=============================================";
+	tlog::info() << "            Name        Id    Perf.      Acc.";
+	tlog::info() << "---------------------------------------------";
+
+	for (const auto& user : users)
+	{
+		tlog::info() << StrFormat(
+			"{0w16ar}  {1w8ar}  {2w5ar}pp  {3w6arp2} %",
+			retrieveUserName(user.Id(), *_pDBSlave),
+			user.Id(),
+			(s32)std::round(user.GetPPRecord().Value),
+			user.GetPPRecord().Accuracy
+		);
+	}
+
+	tlog::info() << "=============================================";
+}
+
+void Processor::ProcessScores(const std::vector<s64>& scoreIds)
+{
+	UpdateBatch newUsers{_pDB, 10000};
+	UpdateBatch newScores{_pDB, 10000};
+
+	tlog::info() << StrFormat("Processing {0} scores.", scoreIds.size());
+	auto progress = tlog::progress(scoreIds.size());
+
+	struct Result {
+		Score::PPRecord PP;
+		s64 UserId;
+		EMods Mods;
+	};
+
+	std::vector<Result> results;
+
+	// Without user totals, only the requested scores themselves need computing. They are fetched in bulk by primary key.
+	if (!_config.WriteUserTotals)
+	{
+		static const size_t s_numScoresPerQuery = 1000;
+
+		for (size_t begin = 0; begin < scoreIds.size(); begin += s_numScoresPerQuery)
+		{
+			size_t end = std::min(begin + s_numScoresPerQuery, scoreIds.size());
+
+			std::string scoreIdList;
+			for (size_t i = begin; i < end; ++i)
+				scoreIdList += StrFormat("{0},", scoreIds[i]);
+
+			scoreIdList.pop_back();
+
+			auto res = _pDBSlave->Query(scoresQuery(StrFormat("`score_id` IN ({0})", scoreIdList)));
+
+			std::unordered_map<s64, std::pair<s64, EMods>> usersAndMods;
+			while (res.NextRow())
+				usersAndMods[res[0]] = std::make_pair((s64)res[1], (EMods)(u32)res[11]);
+
+			res.Rewind();
+			for (const auto& record : computeScores(*_pDBSlave, res, &newScores))
+			{
+				const auto& userAndMods = usersAndMods[record.ScoreId];
+				results.push_back({record, userAndMods.first, userAndMods.second});
+			}
+
+			progress.update(end);
+		}
+	}
+	else
+	{
+		for (s64 scoreId : scoreIds)
+		{
+			// Get user ID for this particular score
+			auto res = _pDBSlave->Query(StrFormat(
+				"SELECT `user_id`,`enabled_mods` FROM `osu_scores{0}_high` WHERE `score_id`='{1}'",
+				GamemodeSuffix(_gamemode), scoreId
+			));
+
+			if (!res.NextRow())
+				continue;
+
+			User user = processSingleUser(scoreId, *_pDB, *_pDBSlave, newUsers, newScores, res[0]);
+
+			auto scoreIt = std::find_if(std::begin(user.Scores()), std::end(user.Scores()), [scoreId](const Score::PPRecord& a)
+			{
+				return a.ScoreId == scoreId;
+			});
+
+			if (scoreIt == std::end(user.Scores()))
+			{
+				tlog::warning() << StrFormat("Could not find score ID {0} in result set.", scoreId);
+				continue;
+			}
+
+			results.push_back({*scoreIt, user.Id(), res[1]});
+			progress.update(results.size());
+		}
+	}
+
+	tlog::info() << StrFormat("Sorting {0} results.", results.size());
+
+	std::sort(std::begin(results), std::end(results), [](const Result& a, const Result& b) {
+		if (a.PP.Value != b.PP.Value)
+			return a.PP.Value > b.PP.Value;
+
+		return a.PP.ScoreId > b.PP.ScoreId;
+	});
+
+	tlog::success() << StrFormat(
+		"Processed {0} scores for {1}.",
+		scoreIds.size(),
+		tlog::durationToString(progress.duration())
+	);
+
+	tlog::info() << "================================================================================";
+	tlog::info() << "======= SCORE SUMMARY ==========================================================";
+	tlog::info() << "================================================================================";
 	tlog::info() << "            Name     Perf.      Acc.  Beatmap - Mods";
 	tlog::info() << "--------------------------------------------------------------------------------";
 
@@ -490,7 +1064,312 @@ void Processor::ProcessScores(const std::vector<s64>& scoreIds)
 		);
 	}
 
-	tlog::info() << "================================================================================";
+	tlog::info() << "================================================================================";
+}
+
+void Processor::ExportTo(const std::string& path, bool summarizeDifferences)
+{
+	_pExport = std::make_unique<PPExport>(path, summarizeDifferences);
+	tlog::info() << StrFormat("Exporting pp to '{0}' instead of writing them.", path);
+}
+
+void Processor::FinishExport()
+{
+	if (_pExport)
+		_pExport->Finish();
+}
+
+void Processor::ServeRPC(u32 numThreads)
+{
+	RPCServer server{_config.RPCSocketPath, numThreads};
+	instrumentExecutor(server.Workers());
+
+	auto pDBSlavePool = newConnectionPoolSlave(server.Workers().NumThreads());
+	registerRPCMethods(server, *pDBSlavePool);
+
+	server.SetLatencyCallback([this](const std::string& method, microseconds p50, microseconds p99, size_t numRequests)
+	{
+		std::vector<std::string> tags = {StrFormat("mode:{0}", GamemodeTag(_gamemode)), StrFormat("method:{0}", method)};
+
+		_pDataDog->Gauge("osu.pp.rpc.latency_p50_us", p50.count(), tags);
+		_pDataDog->Gauge("osu.pp.rpc.latency_p99_us", p99.count(), tags);
+		_pDataDog->Increment("osu.pp.rpc.requests", numRequests, tags);
+
+		tlog::info() << StrFormat("{0}: {1} requests, p50={2}us p99={3}us", method, numRequests, p50.count(), p99.count());
+	}, milliseconds{_config.RPCLatencyInterval});
+
+	tlog::info() << StrFormat("Answering requests at '{0}' with {1} threads.", _config.RPCSocketPath, server.Workers().NumThreads());
+
+	server.Run(_shallShutdown);
+}
+
+void Processor::registerRPCMethods(RPCServer& server, ConnectionPool& dbSlavePool)
+{
+	using json = nlohmann::json;
+
+	// Every method accepts a single ID or a list of IDs
+	auto ids = [](const json& params)
+	{
+		const json& value = params.is_object() && params.count("ids") > 0 ? params["ids"] : params;
+		return value.is_array() ? value.get<std::vector<s64>>() : std::vector<s64>{value.get<s64>()};
+	};
+
+	server.Register("score", [this, &dbSlavePool, ids](const json& params)
+	{
+		auto dbSlave = dbSlavePool.Checkout();
+
+		json result = json::array();
+		for (const auto& record : computeScores(*dbSlave, ids(params)))
+		{
+			result.push_back({
+				{"score_id", record.ScoreId},
+				{"beatmap_id", record.BeatmapId},
+				{"pp", record.Value},
+				{"accuracy", record.Accuracy},
+			});
+		}
+
+		return result;
+	});
+
+	server.Register("user", [this, &dbSlavePool, ids](const json& params)
+	{
+		auto dbSlave = dbSlavePool.Checkout();
+		auto userIds = ids(params);
+
+		_pUserStatsCache->Load(*dbSlave, userIds);
+
+		json result = json::array();
+		for (s64 userId : userIds)
+		{
+			// Whoever asks waits for the result, hence updates overtake bulk writes
+			UpdateBatch newUsers{_pWriteQueue, (u64)userId, 10000};
+			UpdateBatch newScores{_pWriteQueue, (u64)userId, 10000};
+			newUsers.SetPriority(EPriority::High);
+			newScores.SetPriority(EPriority::High);
+
+			User user = processSingleUser(0, *_pDB, *dbSlave, newUsers, newScores, userId);
+			user.ComputePPRecord();
+
+			result.push_back({
+				{"user_id", userId},
+				{"pp", user.GetPPRecord().Value},
+				{"accuracy", user.GetPPRecord().Accuracy},
+			});
+		}
+
+		return result;
+	});
+
+	server.Register("beatmap", [this, &dbSlavePool, ids](const json& params)
+	{
+		EMods mods = params.is_object() && params.count("mods") > 0 ? (EMods)params["mods"].get<u32>() : EMods::Nomod;
+
+		json result = json::array();
+		for (s64 beatmapId : ids(params))
+		{
+			bool isKnown;
+			{
+				RWLock lock{&_beatmapMutex, false};
+				isKnown = _beatmaps.count((s32)beatmapId) > 0;
+			}
+
+			// Beatmaps which were ranked since we started are looked up once
+			if (!isKnown)
+			{
+				auto dbSlave = dbSlavePool.Checkout();
+				queryBeatmapDifficulty(*dbSlave, (s32)beatmapId);
+			}
+
+			RWLock lock{&_beatmapMutex, false};
+
+			auto beatmapIt = _beatmaps.find((s32)beatmapId);
+			if (beatmapIt == std::end(_beatmaps))
+				continue;
+
+			const auto& beatmap = beatmapIt->second;
+
+			json attributes = json::object();
+			for (auto type : _difficultyAttributes)
+				attributes[Beatmap::DifficultyAttributeName(type)] = beatmap.DifficultyAttribute(mods, type);
+
+			result.push_back({
+				{"beatmap_id", beatmap.Id()},
+				{"ranked_status", beatmap.RankedStatus()},
+				{"attributes", attributes},
+			});
+		}
+
+		return result;
+	});
+}
+
+std::vector<Score::PPRecord> Processor::computeScores(DatabaseConnection& dbSlave, const std::vector<s64>& scoreIds, UpdateBatch* pNewScores)
+{
+	if (scoreIds.empty())
+		return {};
+
+	std::string scoreIdList;
+	for (s64 scoreId : scoreIds)
+		scoreIdList += StrFormat("{0},", scoreId);
+
+	scoreIdList.pop_back();
+
+	auto res = dbSlave.Query(scoresQuery(StrFormat("`score_id` IN ({0})", scoreIdList)));
+	return computeScores(dbSlave, res, pNewScores);
+}
+
+std::vector<Score::PPRecord> Processor::computeScores(DatabaseConnection& dbSlave, QueryResult& scores, UpdateBatch* pNewScores, bool onlyChanged)
+{
+	switch (_gamemode)
+	{
+	case EGamemode::Osu:
+		return computeScoresGeneric<OsuScore>(dbSlave, scores, pNewScores, onlyChanged);
+
+	case EGamemode::Taiko:
+		return computeScoresGeneric<TaikoScore>(dbSlave, scores, pNewScores, onlyChanged);
+
+	case EGamemode::Catch:
+		return computeScoresGeneric<CatchScore>(dbSlave, scores, pNewScores, onlyChanged);
+
+	case EGamemode::Mania:
+		return computeScoresGeneric<ManiaScore>(dbSlave, scores, pNewScores, onlyChanged);
+
+	default:
+		throw ProcessorException(SRC_POS, StrFormat("Unknown gamemode requested. ({0})", _gamemode));
+	}
+}
+
+template <class TScore>
+std::vector<Score::PPRecord> Processor::computeScoresGeneric(DatabaseConnection& dbSlave, QueryResult& res, UpdateBatch* pNewScores, bool onlyChanged)
+{
+	std::vector<Score::PPRecord> records;
+	std::vector<TScore> scores;
+	std::vector<PPExport::ScoreRow> exportedScores;
+
+	// Many scores may be on the same unknown beatmap, which only needs to be looked up once
+	std::unordered_set<s32> unknownBeatmapIds;
+
+	while (res.NextRow())
+	{
+		s32 beatmapId = res[2];
+		if (unknownBeatmapIds.count(beatmapId) > 0)
+			continue;
+
+		bool isKnown;
+		{
+			RWLock lock{&_beatmapMutex, false};
+
+			// Blacklisted maps don't count
+			if (_blacklistedBeatmapIds.count(beatmapId) > 0)
+				continue;
+
+			isKnown = _beatmaps.count(beatmapId) > 0;
+		}
+
+		if (!isKnown && !queryBeatmapDifficulty(dbSlave, beatmapId))
+		{
+			unknownBeatmapIds.insert(beatmapId);
+			continue;
+		}
+
+		RWLock lock{&_beatmapMutex, false};
+
+		auto beatmapIt = _beatmaps.find(beatmapId);
+		if (beatmapIt == std::end(_beatmaps))
+			continue;
+
+		const auto& beatmap = beatmapIt->second;
+
+		s32 rankedStatus = beatmap.RankedStatus();
+		if (rankedStatus < s_minRankedStatus || rankedStatus > s_maxRankedStatus)
+			continue;
+
+		TScore score = TScore{
+			res[0], // score_id
+			_gamemode,
+			res[1], // user_id
+			beatmapId,
+			res[3], // score
+			res[4], // maxcombo
+			res[5], // Num300
+			res[6], // Num100
+			res[7], // Num50
+			res[8], // NumMiss
+			res[9], // NumGeki
+			res[10], // NumKatu
+			res[11], // mods
+			beatmap,
+		};
+
+		records.emplace_back(score.CreatePPRecord());
+		if (_pExport && pNewScores)
+		{
+			// Column 12 is the pp value of the score from the database
+			const auto& record = records.back();
+			exportedScores.push_back({record.ScoreId, res[1], beatmapId, res[11], record.Value, record.Accuracy, !res.IsNull(12), res.IsNull(12) ? 0 : (f32)res[12]});
+		}
+		else if (pNewScores && (!onlyChanged || isPPChanged(res, score.TotalValue())))
+			scores.emplace_back(score);
+	}
+
+	if (!exportedScores.empty())
+		_pExport->Add(exportedScores);
+
+	if (pNewScores)
+	{
+		std::lock_guard<std::mutex> lock{pNewScores->Mutex()};
+
+		for (const auto& score : scores)
+			score.AppendToUpdateBatch(*pNewScores);
+	}
+
+	return records;
+}
+
+bool Processor::isPPChanged(const QueryResult& scores, f32 value) const
+{
+	// Column 12 is the pp value of the score from the database.
+	// Only update score if it differs a lot!
+	return scores.IsNull(12) || (_config.WriteAllPPChanges && fabs((f32)scores[12] - value) > 0.001f);
+}
+
+void Processor::refreshBeatmaps(const std::vector<s32>& beatmapIds)
+{
+	std::string beatmapIdList;
+	for (s32 beatmapId : beatmapIds)
+		beatmapIdList += StrFormat("{0},", beatmapId);
+
+	if (beatmapIdList.empty())
+		return;
+
+	beatmapIdList.pop_back();
+
+	// Forget everything about the beatmaps, such that attributes which were removed or beatmaps which lost their status do not linger
+	{
+		RWLock lock{&_beatmapMutex, true};
+		for (s32 beatmapId : beatmapIds)
+		{
+			_beatmaps.erase(beatmapId);
+			_blacklistedBeatmapIds.erase(beatmapId);
+		}
+	}
+
+	auto res = _pDB->Query(StrFormat(
+		"SELECT `beatmap_id` "
+		"FROM `osu_beatmap_performance_blacklist` "
+		"WHERE `mode`={0} AND `beatmap_id` IN ({1})", _gamemode, beatmapIdList
+	));
+
+	{
+		RWLock lock{&_beatmapMutex, true};
+		while (res.NextRow())
+			_blacklistedBeatmapIds.insert(res[0]);
+	}
+
+	// Replicas may not have caught up with a recalculation which just happened
+	for (s32 beatmapId : beatmapIds)
+		queryBeatmapDifficulty(*_pDB, beatmapId);
 }
 
 void Processor::readConfig(const std::string& filename)
@@ -519,6 +1398,22 @@ void Processor::readConfig(const std::string& filename)
 		_config.MySqlSlavePassword = j.value("mysql.slave.password", _config.MySqlMasterPassword);
 		_config.MySqlSlaveDatabase = j.value("mysql.slave.database", _config.MySqlMasterDatabase);
 
+#ifdef PP_MYSQL_NONBLOCKING
+		// Without the non-blocking client API every asynchronous connection would need a thread of its own
+		_config.MySqlAsyncConnections = j.value("mysql.async-connections", 4);
+#else
+		_config.MySqlAsyncConnections = j.value("mysql.async-connections", 0);
+#endif
+		_config.MySqlWriterConnections = std::max(1u, j.value("mysql.writer-connections", 4u));
+		_config.MySqlWriteQueueMaxBytes = j.value("mysql.write-queue.max-bytes", 64ull * 1024 * 1024);
+		_config.MySqlWriteQueueMaxStatements = j.value("mysql.write-queue.max-statements", 1000);
+		_config.SweepScheduleWindow = j.value("sweep.schedule-window", 1000);
+		_config.AllRangeSize = j.value("all.range-size", 100000);
+		_config.ServeMaxLag = j.value("serve.max-lag", 100);
+		_config.ExecutorHighPriorityWeight = j.value("executor.high-priority-weight", 0);
+		_config.MySqlPoolSize = j.value("mysql.pool-size", 0);
+		_config.MySqlPoolThreadAffinity = j.value("mysql.pool-thread-affinity", true);
+
 		_config.UserPPColumnName =      j.value("mysql.user-pp-column-name",      "rank_score");
 		_config.UserMetadataTableName = j.value("mysql.user-metadata-table-name", "sample_users");
 
@@ -527,6 +1422,31 @@ void Processor::readConfig(const std::string& filename)
 
 		_config.DifficultyUpdateInterval = j.value("poll.interval.difficulties", 10000);
 		_config.ScoreUpdateInterval =      j.value("poll.interval.scores",       50);
+		_config.ReprocessUsersPerSecond = j.value("reprocess.users-per-second", 20);
+
+		_config.RPCSocketPath =      j.value("rpc.socket",           "osu-performance.sock");
+		_config.RPCLatencyInterval = j.value("rpc.latency-interval", 10000);
+		_config.ScoreWakeupSocketPath = j.value("poll.wakeup-socket", "");
+
+		// Without signals, backing off would delay new scores. With them, polling merely catches missed signals.
+		_config.ScoreUpdateIntervalMax = j.value("poll.interval.scores-max", _config.ScoreWakeupSocketPath.empty() ? _config.ScoreUpdateInterval : 1000);
+
+		_config.CoalesceWindow =  j.value("coalesce.window",   0);
+		_config.CoalesceMaxRows = j.value("coalesce.max-rows", 1000);
+
+		_config.JournalPath =         j.value("journal.path",          "");
+		_config.JournalSyncInterval = j.value("journal.sync-interval", 10);
+
+		_config.NewScoresPartitions =    j.value("new.partitions",       0);
+		_config.NewScoresLeaseInterval = j.value("new.lease-interval",   1000);
+		_config.NewScoresBatchLatency = j.value("new.batch-latency-us", 5000);
+		_config.NewScoresBatchSize =    j.value("new.batch-size",       64 * 1024);
+
+		_config.NewScoresCatchUpThreshold =    j.value("new.catch-up.threshold",        10000);
+		_config.NewScoresPollSize =            j.value("new.poll-size",                 100);
+		_config.NewScoresCatchUpPollSize =     j.value("new.catch-up.poll-size",        5000);
+		_config.NewScoresCatchUpBatchLatency = j.value("new.catch-up.batch-latency-us", 200000);
+		_config.NewScoresCatchUpBatchSize =    j.value("new.catch-up.batch-size",       1024 * 1024);
 
 		_config.SlackHookHost =     j.value("slack-hook.host",     "");
 		_config.SlackHookKey =      j.value("slack-hook.key",      "");
@@ -555,7 +1475,8 @@ std::shared_ptr<DatabaseConnection> Processor::newDBConnectionMaster()
 		_config.MySqlMasterPort,
 		_config.MySqlMasterUsername,
 		_config.MySqlMasterPassword,
-		_config.MySqlMasterDatabase
+		_config.MySqlMasterDatabase,
+		_pWriteQueue
 	);
 }
 
@@ -570,6 +1491,120 @@ std::shared_ptr<DatabaseConnection> Processor::newDBConnectionSlave()
 	);
 }
 
+std::shared_ptr<AsyncDatabase> Processor::newAsyncDBConnectionMaster(u32 numConnections)
+{
+	return std::make_shared<AsyncDatabase>(
+		_config.MySqlMasterHost,
+		_config.MySqlMasterPort,
+		_config.MySqlMasterUsername,
+		_config.MySqlMasterPassword,
+		_config.MySqlMasterDatabase,
+		numConnections
+	);
+}
+
+std::shared_ptr<AsyncDatabase> Processor::newAsyncDBConnectionSlave(u32 numConnections)
+{
+	return std::make_shared<AsyncDatabase>(
+		_config.MySqlSlaveHost,
+		_config.MySqlSlavePort,
+		_config.MySqlSlaveUsername,
+		_config.MySqlSlavePassword,
+		_config.MySqlSlaveDatabase,
+		numConnections
+	);
+}
+
+std::unique_ptr<ConnectionPool> Processor::newConnectionPoolSlave(u32 size)
+{
+	return std::make_unique<ConnectionPool>(
+		[this]() { return newDBConnectionSlave(); },
+		size,
+		_config.MySqlPoolThreadAffinity,
+		[this](microseconds waitTime)
+		{
+			_pDataDog->Histogram("osu.pp.db.pool_wait_us", waitTime.count(), {StrFormat("mode:{0}", GamemodeTag(_gamemode))}, 0.01f);
+		}
+	);
+}
+
+std::shared_ptr<WriteQueue> Processor::newWriteQueue()
+{
+	auto pWriteQueue = std::make_shared<WriteQueue>(
+		newAsyncDBConnectionMaster(_config.MySqlWriterConnections),
+		(size_t)_config.MySqlWriteQueueMaxBytes,
+		_config.MySqlWriteQueueMaxStatements
+	);
+
+	pWriteQueue->SetWatermarkCallbacks(
+		[this]()
+		{
+			tlog::debug() << "Write queue is congested. Throttling producers.";
+			_pDataDog->Increment("osu.pp.db.write_queue_congested", 1, {StrFormat("mode:{0}", GamemodeTag(_gamemode))});
+		},
+		[]()
+		{
+			tlog::debug() << "Write queue drained.";
+		}
+	);
+
+	pWriteQueue->SetWaitCallback([this](EPriority priority, microseconds waitTime)
+	{
+		_pDataDog->Histogram("osu.pp.db.write_queue_wait_us", waitTime.count(), {
+			StrFormat("mode:{0}", GamemodeTag(_gamemode)),
+			StrFormat("priority:{0}", PriorityTag(priority)),
+		}, 0.01f);
+	});
+
+	if (!_config.JournalPath.empty())
+	{
+		// Every gamemode runs in its own process and hence needs its own journal
+		pWriteQueue->EnableJournal(std::make_unique<WriteJournal>(
+			StrFormat("{0}.{1}", _config.JournalPath, GamemodeTag(_gamemode)),
+			milliseconds{_config.JournalSyncInterval}
+		));
+	}
+
+	return pWriteQueue;
+}
+
+void Processor::reportWriteQueueDepth(const std::string& connectionTag)
+{
+	for (auto priority : {EPriority::High, EPriority::Low})
+	{
+		std::vector<std::string> tags = {
+			StrFormat("mode:{0}", GamemodeTag(_gamemode)),
+			StrFormat("connection:{0}", connectionTag),
+			StrFormat("priority:{0}", PriorityTag(priority)),
+		};
+
+		_pDataDog->Gauge("osu.pp.db.pending_queries", _pWriteQueue->NumStatements(priority), tags, 0.01f);
+		_pDataDog->Gauge("osu.pp.db.pending_bytes", _pWriteQueue->NumBytes(priority), tags, 0.01f);
+	}
+}
+
+void Processor::instrumentExecutor(Executor& executor)
+{
+	executor.SetStartCallback([this](EPriority priority, microseconds waitTime)
+	{
+		_pDataDog->Histogram("osu.pp.executor.wait_us", waitTime.count(), {
+			StrFormat("mode:{0}", GamemodeTag(_gamemode)),
+			StrFormat("priority:{0}", PriorityTag(priority)),
+		}, 0.01f);
+	});
+}
+
+void Processor::reportExecutorDepth(const Executor& executor)
+{
+	for (auto priority : {EPriority::High, EPriority::Low})
+	{
+		_pDataDog->Gauge("osu.pp.executor.queued_tasks", executor.NumQueued(priority), {
+			StrFormat("mode:{0}", GamemodeTag(_gamemode)),
+			StrFormat("priority:{0}", PriorityTag(priority)),
+		}, 0.01f);
+	}
+}
+
 void Processor::queryAllBeatmapDifficulties(u32 numThreads)
 {
 	static const s32 step = 1000;
@@ -588,29 +1623,17 @@ void Processor::queryAllBeatmapDifficulties(u32 numThreads)
 	tlog::info() << "Retrieving all beatmap difficulties.";
 	auto progress = tlog::progress(numBeatmaps);
 
-	std::vector<std::shared_ptr<DatabaseConnection>> dbSlaveConnections;
-	for (u32 i = 0; i < numThreads; ++i)
-		dbSlaveConnections.emplace_back(newDBConnectionSlave());
+	auto pDBSlavePool = newConnectionPoolSlave(numThreads);
+	Executor executor{numThreads};
+	Latch latch;
 
-	ThreadPool threadPool{numThreads};
-	s32 threadIdx = 0;
+	executor.ParallelFor(0, maxBeatmapId + 1, step, [&](s64 begin, s64 end) {
+		auto dbSlave = pDBSlavePool->Checkout();
+		queryBeatmapDifficulty(*dbSlave, (s32)begin, (s32)end);
+	}, latch);
 
-	for (s32 begin = 0; begin < maxBeatmapId; begin += step)
-	{
-		auto& dbSlave = *dbSlaveConnections[threadIdx];
-		threadIdx = (threadIdx + 1) % numThreads;
-
-		threadPool.EnqueueTask([&, begin]() {
-			queryBeatmapDifficulty(dbSlave, begin, std::min(begin + step, maxBeatmapId + 1));
-
-			progress.update(_beatmaps.size());
-		});
-	}
-
-	while (threadPool.GetNumTasksInSystem() > 0)
-	{
-		std::this_thread::sleep_for(milliseconds{ 10 });
-	}
+	while (!latch.WaitFor(milliseconds{100}))
+		progress.update(_beatmaps.size());
 
 	tlog::success() << StrFormat(
 		"Loaded difficulties for a total of {0} beatmaps for {1}.",
@@ -691,92 +1714,460 @@ bool Processor::queryBeatmapDifficulty(DatabaseConnection& dbSlave, s32 startId,
 		_pDataDog->Increment("osu.pp.difficulty.retrieval_success", 1, { StrFormat("mode:{0}", GamemodeTag(_gamemode)) });
 	}
 
-	return success;
-}
+	return success;
+}
+
+void Processor::pollAndProcessNewScores()
+{
+	static const s64 s_lastScoreIdUpdateStep = 100;
+	static const s64 s_maxNumQueueIdsBehindCounted = 100000;
+
+	// Do not pick up more scores while earlier updates are still backed up. Bulk writes do not count.
+	_pWriteQueue->Throttle(EPriority::High);
+
+	// Updates are written once their time is up, even if no further scores arrive
+	_pNewUpdatesBatch->FlushIfDue();
+
+	std::string queueCondition = StrFormat("`queue_id` > {0}", _currentQueueId);
+	if (_pNewScoresLeases)
+	{
+		renewNewScoresLeases();
+
+		// Without any partitions, all new scores are taken care of by others
+		queueCondition = newScoresPartitionCondition();
+		if (queueCondition.empty())
+		{
+			_lastScorePollTime = steady_clock::now();
+			_scorePollInterval = milliseconds{_config.ScoreUpdateInterval};
+			return;
+		}
+	}
+
+	// Obtain all new scores since the last poll and process them
+	auto res = _pDBSlave->Query(StrFormat(
+		"SELECT `score_id`,`user_id`,`pp`, `queue_id`, UNIX_TIMESTAMP()-UNIX_TIMESTAMP(`osu_scores{0}_high`.`date`) "
+		"FROM `score_process_queue` LEFT JOIN `osu_scores{0}_high` USING (`score_id`) "
+		"WHERE `status` = 0 AND `mode` = {4} AND ({5}) ORDER BY `queue_id` ASC LIMIT {3}",
+		GamemodeSuffix(_gamemode), _currentScoreId, _config.UserMetadataTableName,
+		_isCatchingUpNewScores ? _config.NewScoresCatchUpPollSize : _config.NewScoresPollSize,
+		static_cast<int>(_gamemode), queueCondition
+	));
+
+	// Only reset the poll timer when we find nothing. Otherwise we want to directly keep going
+	if (res.NumRows() == 0)
+	{
+		_lastScorePollTime = steady_clock::now();
+		_scorePollInterval = std::min(_scorePollInterval * 2, milliseconds{std::max(_config.ScoreUpdateIntervalMax, _config.ScoreUpdateInterval)});
+	}
+	else
+		_scorePollInterval = milliseconds{_config.ScoreUpdateInterval};
+
+	// Refresh the stats of all users of this poll at once. They may have changed since we last saw them.
+	// The last entry of each user is remembered, such that users can be processed once while catching up.
+	std::unordered_map<s64, s64> lastQueueIdsByUser;
+	{
+		std::vector<s64> userIds;
+		while (res.NextRow())
+		{
+			if (!res.IsNull(1))
+			{
+				userIds.emplace_back(res[1]);
+				lastQueueIdsByUser[res[1]] = res[3];
+			}
+		}
+
+		_pUserStatsCache->Load(*_pDBSlave, userIds);
+		res.Rewind();
+	}
+
+	// All pending entries of our gamemode and partitions are behind, regardless of how many a poll returns.
+	// Counting stops at a bound well above the catch-up threshold to keep the query cheap when far behind.
+	s64 numQueueIdsBehind = 0;
+	s64 secondsBehind = 0;
+	if (res.NextRow())
+	{
+		secondsBehind = res.IsNull(4) ? 0 : std::max<s64>(res[4], 0);
+		res.Rewind();
+
+		auto countRes = _pDBSlave->Query(StrFormat(
+			"SELECT COUNT(*) FROM (SELECT 1 FROM `score_process_queue` LEFT JOIN `osu_scores{0}_high` USING (`score_id`) "
+			"WHERE `status` = 0 AND `mode` = {1} AND ({2}) LIMIT {3}) AS `behind`",
+			GamemodeSuffix(_gamemode), static_cast<int>(_gamemode), queueCondition,
+			std::max<s64>(s_maxNumQueueIdsBehindCounted, 4 * (s64)_config.NewScoresCatchUpThreshold)
+		));
+
+		numQueueIdsBehind = std::max<s64>(countRes.NextRow() ? (s64)countRes[0] : 0, (s64)res.NumRows());
+	}
+
+	if (!_isCatchingUpNewScores && numQueueIdsBehind > _config.NewScoresCatchUpThreshold)
+		setCatchingUpNewScores(true);
+	else if (_isCatchingUpNewScores && numQueueIdsBehind <= _config.NewScoresCatchUpThreshold / 4)
+		setCatchingUpNewScores(false);
+
+	reportNewScoresLag(numQueueIdsBehind, secondsBehind);
+
+	// Without user totals, scores are computed on their own and in bulk after this loop
+	std::unordered_map<s64, s64> queueIdsByScore;
+
+	std::vector<s64> coalescedQueueIds;
+	while (res.NextRow())
+	{
+		s64 queueId = res[3];
+
+		if (res.IsNull(1))
+		{
+			// even though the score wasn't processed, we still want to mark the queue as completed.
+			_pDB->NonQuery(StrFormat("UPDATE `score_process_queue` SET `status` = 1 WHERE `queue_id` = {0}", queueId));
+			continue;
+		}
+
+		s64 scoreId = res[0];
+		s64 userId = res[1];
+
+		_currentScoreId = std::max(_currentScoreId, scoreId);
+		_currentQueueId = std::max(_currentQueueId, queueId);
+
+		if (_pNewScoresLeases)
+		{
+			s64& partitionQueueId = _newScoresPartitionQueueIds[userId % _config.NewScoresPartitions];
+			partitionQueueId = std::max(partitionQueueId, queueId);
+		}
+
+		if (!_config.WriteUserTotals)
+		{
+			queueIdsByScore[scoreId] = queueId;
+			continue;
+		}
+
+		// Only the last score of a user is processed while catching up. Scores without pp, such as the user's
+		// earlier new scores, are written along with it anyways.
+		if (_isCatchingUpNewScores && lastQueueIdsByUser[userId] != queueId)
+		{
+			coalescedQueueIds.emplace_back(queueId);
+			continue;
+		}
+
+		// Whatever a concurrent sweep computes from before the new score must not overwrite the result
+		fenceSweptUser(userId);
+
+		User user = processSingleUser(
+			scoreId, // Only update the new score, old ones are caught by the background processor anyways
+			*_pDB,
+			*_pDBSlave,
+			*_pNewUpdatesBatch,
+			*_pNewUpdatesBatch,
+			userId
+		);
+
+		auto scoreIt = std::find_if(std::begin(user.Scores()), std::end(user.Scores()), [scoreId](const Score::PPRecord& a)
+		{
+			return a.ScoreId == scoreId;
+		});
+
+		if (scoreIt == std::end(user.Scores()))
+		{
+			tlog::warning() << StrFormat("Could not find score ID {0} in result set.", scoreId);
+
+			// even though the score wasn't processed, we still want to mark the queue as completed.
+			_pDB->NonQuery(StrFormat("UPDATE `score_process_queue` SET `status` = 1 WHERE `queue_id` = {0}", queueId));
+
+			continue;
+		}
+
+		tlog::info() << StrFormat(
+			"{7w10ar} Score={0w10ar} {1p1w6ar}pp {2p2w6ar}% | User={3w8ar} {4p1w7ar}pp {5p2w6ar}% | Beatmap={6w7ar}",
+			scoreId, scoreIt->Value, scoreIt->Accuracy * 100,
+			userId, user.GetPPRecord().Value, user.GetPPRecord().Accuracy,
+			scoreIt->BeatmapId, queueId
+		);
+
+		++_numScoresProcessedSinceLastStore;
+		if (_numScoresProcessedSinceLastStore > s_lastScoreIdUpdateStep)
+		{
+			storeCount(*_pDB, lastScoreIdKey(), _currentScoreId);
+			_numScoresProcessedSinceLastStore = 0;
+		}
+
+		_pDataDog->Increment("osu.pp.score.processed_new", 1, {StrFormat("mode:{0}", GamemodeTag(_gamemode))});
+		reportWriteQueueDepth("main");
+	}
+
+	if (!queueIdsByScore.empty())
+		processNewScoresOnly(queueIdsByScore);
+
+	if (!coalescedQueueIds.empty())
+	{
+		std::string queueIds;
+		for (s64 queueId : coalescedQueueIds)
+			queueIds += StrFormat("{0},", queueId);
+
+		queueIds.pop_back();
+
+		// Committed after the updates of the users, including held back ones, such that entries are never marked
+		// completed ahead of their scores
+		{
+			std::lock_guard<std::mutex> lock{_pNewUpdatesBatch->Mutex()};
+			_pNewUpdatesBatch->Builder()
+				.Append("UPDATE `score_process_queue` SET `status` = 1 WHERE `queue_id` IN (").Append(queueIds).Append(");");
+			_pNewUpdatesBatch->CommitAfterHeldBackNonThreadsafe();
+		}
+
+		_pDataDog->Increment("osu.pp.score.coalesced_new", coalescedQueueIds.size(), {StrFormat("mode:{0}", GamemodeTag(_gamemode))});
+	}
+}
+
+void Processor::processNewScoresOnly(std::unordered_map<s64, s64>& queueIdsByScore)
+{
+	static const s64 s_lastScoreIdUpdateStep = 100;
+
+	std::vector<s64> scoreIds;
+	for (const auto& entry : queueIdsByScore)
+		scoreIds.emplace_back(entry.first);
+
+	auto records = computeScores(*_pDBSlave, scoreIds, _pNewUpdatesBatch.get());
+	for (const auto& record : records)
+	{
+		tlog::info() << StrFormat(
+			"{4w10ar} Score={0w10ar} {1p1w6ar}pp {2p2w6ar}% | Beatmap={3w7ar}",
+			record.ScoreId, record.Value, record.Accuracy * 100, record.BeatmapId, queueIdsByScore[record.ScoreId]
+		);
+
+		queueIdsByScore.erase(record.ScoreId);
+	}
+
+	// Scores which do not count were not written
+	for (const auto& entry : queueIdsByScore)
+	{
+		tlog::warning() << StrFormat("Could not find score ID {0} in result set.", entry.first);
+
+		// even though the score wasn't processed, we still want to mark the queue as completed.
+		_pDB->NonQuery(StrFormat("UPDATE `score_process_queue` SET `status` = 1 WHERE `queue_id` = {0}", entry.second));
+	}
+
+	_numScoresProcessedSinceLastStore += records.size();
+	if (_numScoresProcessedSinceLastStore > s_lastScoreIdUpdateStep)
+	{
+		storeCount(*_pDB, lastScoreIdKey(), _currentScoreId);
+		_numScoresProcessedSinceLastStore = 0;
+	}
+
+	_pDataDog->Increment("osu.pp.score.processed_new", records.size(), {StrFormat("mode:{0}", GamemodeTag(_gamemode))});
+	reportWriteQueueDepth("main");
+}
+
+void Processor::setCatchingUpNewScores(bool isCatchingUp)
+{
+	if (isCatchingUp != _isCatchingUpNewScores)
+		tlog::info() << (isCatchingUp ? "Catching up on new scores." : "Caught up on new scores.");
+
+	_isCatchingUpNewScores = isCatchingUp;
+
+	if (isCatchingUp)
+	{
+		// Throughput matters more than latency, hence updates are written in bulk
+		_pNewUpdatesBatch->SetSizeThreshold(_config.NewScoresCatchUpBatchSize);
+		_pNewUpdatesBatch->SetLatencyBudget(microseconds{_config.NewScoresCatchUpBatchLatency});
+	}
+	else
+	{
+		// A threshold of 0 executes updates as soon as they leave the coalescer
+		_pNewUpdatesBatch->SetSizeThreshold(_config.NewScoresBatchLatency > 0 ? _config.NewScoresBatchSize : 0);
+		_pNewUpdatesBatch->SetLatencyBudget(microseconds{_config.NewScoresBatchLatency});
+	}
+}
+
+void Processor::reportNewScoresLag(s64 numQueueIdsBehind, s64 secondsBehind)
+{
+	std::vector<std::string> tags = {StrFormat("mode:{0}", GamemodeTag(_gamemode))};
+
+	_pDataDog->Gauge("osu.pp.score.amount_behind_newest", numQueueIdsBehind, tags);
+	_pDataDog->Gauge("osu.pp.score.seconds_behind_newest", secondsBehind, tags);
+	_pDataDog->Gauge("osu.pp.score.catching_up", _isCatchingUpNewScores ? 1 : 0, tags);
+
+	updateNewScoresLag(numQueueIdsBehind);
+}
+
+void Processor::yieldToNewScores()
+{
+	std::unique_lock<std::mutex> lock{_newScoresLagMutex};
+	if (!_isMonitoringNewScores || _numNewScoresBehind <= _config.ServeMaxLag)
+		return;
+
+	tlog::debug() << StrFormat("{0} new scores are waiting. Pausing the background sweep.", _numNewScoresBehind);
+
+	// Resuming only once most of the backlog is gone avoids pausing again right away
+	auto startTime = steady_clock::now();
+	_newScoresLagCondition.wait(lock, [this]() { return _shallShutdown || _numNewScoresBehind <= _config.ServeMaxLag / 2; });
+	auto yieldTime = duration_cast<microseconds>(steady_clock::now() - startTime);
+
+	_pDataDog->Histogram("osu.pp.serve.sweep_yield_us", yieldTime.count(), {StrFormat("mode:{0}", GamemodeTag(_gamemode))});
+}
+
+void Processor::updateNewScoresLag(s64 numScoresBehind)
+{
+	{
+		std::lock_guard<std::mutex> lock{_newScoresLagMutex};
+		_numNewScoresBehind = numScoresBehind;
+	}
+
+	_newScoresLagCondition.notify_all();
+}
+
+void Processor::renewNewScoresLeases()
+{
+	auto now = steady_clock::now();
+	if (now - _lastNewScoresLeaseTime < milliseconds{_config.NewScoresLeaseInterval})
+		return;
+
+	_lastNewScoresLeaseTime = now;
+
+	const u32 numPartitions = _config.NewScoresPartitions;
+
+	// Leases are lost if our connection was interrupted. Others may be processing those partitions by now.
+	for (const auto& name : _pNewScoresLeases->Verify())
+		tlog::warning() << StrFormat("Lost lease '{0}'.", name);
+
+	u32 numOwned = 0;
+	for (u32 i = 0; i < numPartitions; ++i)
+	{
+		if (_isNewScoresPartitionOwned[i] && !_pNewScoresLeases->IsHeld(StrFormat("partition.{0}", i)))
+			_isNewScoresPartitionOwned[i] = false;
+
+		if (_isNewScoresPartitionOwned[i])
+			++numOwned;
+	}
+
+	// Every process holds a membership lease, such that all of them know how many there are
+	std::vector<std::string> memberNames;
+	for (u32 i = 0; i < s_maxNumNewScoresProcesses; ++i)
+		memberNames.emplace_back(StrFormat("member.{0}", i));
 
-void Processor::pollAndProcessNewScores()
-{
-	static const s64 s_lastScoreIdUpdateStep = 100;
-	static const s64 s_maxNumScores = 1000;
+	auto isMemberLeased = _pNewScoresLeases->AreLeased(memberNames);
 
-	UpdateBatch newUsers{_pDB, 0};  // We want the updates to occur immediately
-	UpdateBatch newScores{_pDB, 0}; // batches are used to conform the interface of processSingleUser
+	bool isMember = false;
+	for (const auto& name : memberNames)
+		isMember = isMember || _pNewScoresLeases->IsHeld(name);
 
-	// Obtain all new scores since the last poll and process them
-	auto res = _pDBSlave->Query(StrFormat(
-		"SELECT `score_id`,`user_id`,`pp`, `queue_id` "
-		"FROM `score_process_queue` LEFT JOIN `osu_scores{0}_high` USING (`score_id`) "
-		"WHERE `status` = 0 AND `mode` = {4} AND `queue_id` > {5} ORDER BY `queue_id` ASC LIMIT {3}",
-		GamemodeSuffix(_gamemode), _currentScoreId, _config.UserMetadataTableName, s_maxNumScores, static_cast<int>(_gamemode), _currentQueueId
-	));
+	for (u32 i = 0; i < s_maxNumNewScoresProcesses && !isMember; ++i)
+	{
+		if (!isMemberLeased[i] && _pNewScoresLeases->TryAcquire(memberNames[i]))
+		{
+			isMemberLeased[i] = true;
+			isMember = true;
+		}
+	}
 
-	// Only reset the poll timer when we find nothing. Otherwise we want to directly keep going
-	if (res.NumRows() == 0)
-		_lastScorePollTime = steady_clock::now();
+	if (!isMember)
+		throw ProcessorException(SRC_POS, StrFormat("More than {0} processes are monitoring new scores.", s_maxNumNewScoresProcesses));
 
-	_pDataDog->Gauge("osu.pp.score.amount_behind_newest", res.NumRows(), {StrFormat("mode:{0}", GamemodeTag(_gamemode))});
+	u32 numMembers = (u32)std::count(std::begin(isMemberLeased), std::end(isMemberLeased), true);
+	u32 fairShare = (numPartitions + numMembers - 1) / numMembers;
 
-	while (res.NextRow())
+	if (numOwned > fairShare)
 	{
-		s64 queueId = res[3];
+		// Others joined. Hand them our surplus partitions.
+		std::vector<u32> surplus;
+		for (u32 i = numPartitions; i-- > 0 && numOwned > fairShare;)
+		{
+			if (!_isNewScoresPartitionOwned[i])
+				continue;
 
-		if (res.IsNull(1))
+			_isNewScoresPartitionOwned[i] = false;
+			surplus.emplace_back(i);
+			--numOwned;
+		}
+
+		releaseNewScoresPartitions(surplus);
+	}
+	else if (numOwned < fairShare)
+	{
+		// Partitions of processes which left or died are free to be claimed
+		std::vector<u32> candidates;
+		std::vector<std::string> candidateNames;
+		for (u32 i = 0; i < numPartitions; ++i)
 		{
-			// even though the score wasn't processed, we still want to mark the queue as completed.
-			_pDB->NonQuery(StrFormat("UPDATE `score_process_queue` SET `status` = 1 WHERE `queue_id` = {0}", queueId));
-			continue;
+			if (_isNewScoresPartitionOwned[i])
+				continue;
+
+			candidates.emplace_back(i);
+			candidateNames.emplace_back(StrFormat("partition.{0}", i));
 		}
 
-		s64 scoreId = res[0];
-		s64 userId = res[1];
+		auto isCandidateLeased = _pNewScoresLeases->AreLeased(candidateNames);
+		for (size_t i = 0; i < candidates.size() && numOwned < fairShare; ++i)
+		{
+			if (isCandidateLeased[i] || !_pNewScoresLeases->TryAcquire(candidateNames[i]))
+				continue;
 
-		_currentScoreId = std::max(_currentScoreId, scoreId);
-		_currentQueueId = std::max(_currentQueueId, queueId);
+			// Scores of the partition which were not processed by its previous owner are picked up from the start
+			_isNewScoresPartitionOwned[candidates[i]] = true;
+			_newScoresPartitionQueueIds[candidates[i]] = 0;
+			++numOwned;
 
-		User user = processSingleUser(
-			scoreId, // Only update the new score, old ones are caught by the background processor anyways
-			*_pDB,
-			*_pDBSlave,
-			newUsers,
-			newScores,
-			userId
-		);
+			tlog::info() << StrFormat("Claimed partition {0} of new scores.", candidates[i]);
+		}
+	}
 
-		auto scoreIt = std::find_if(std::begin(user.Scores()), std::end(user.Scores()), [scoreId](const Score::PPRecord& a)
-		{
-			return a.ScoreId == scoreId;
-		});
+	{
+		// Users to reprocess are queued by the thread polling beatmaps
+		std::lock_guard<std::mutex> lock{_reprocessMutex};
+		_isReprocessPartitionOwned = _isNewScoresPartitionOwned;
+	}
 
-		if (scoreIt == std::end(user.Scores()))
-		{
-			tlog::warning() << StrFormat("Could not find score ID {0} in result set.", scoreId);
+	_pDataDog->Gauge("osu.pp.score.owned_partitions", numOwned, {StrFormat("mode:{0}", GamemodeTag(_gamemode))});
+}
 
-			// even though the score wasn't processed, we still want to mark the queue as completed.
-			_pDB->NonQuery(StrFormat("UPDATE `score_process_queue` SET `status` = 1 WHERE `queue_id` = {0}", queueId));
+void Processor::releaseNewScoresPartitions(const std::vector<u32>& partitions)
+{
+	if (partitions.empty())
+		return;
+
+	// The next owner may only process a user once all of our updates of that user were executed
+	_pNewUpdatesBatch->Flush();
+	waitUntilWritten();
+
+	for (u32 partition : partitions)
+	{
+		_pNewScoresLeases->Release(StrFormat("partition.{0}", partition));
+		tlog::info() << StrFormat("Released partition {0} of new scores.", partition);
+	}
+}
 
+std::string Processor::newScoresPartitionCondition() const
+{
+	std::string condition;
+	for (u32 i = 0; i < _config.NewScoresPartitions; ++i)
+	{
+		if (!_isNewScoresPartitionOwned[i])
 			continue;
-		}
 
-		tlog::info() << StrFormat(
-			"{7w10ar} Score={0w10ar} {1p1w6ar}pp {2p2w6ar}% | User={3w8ar} {4p1w7ar}pp {5p2w6ar}% | Beatmap={6w7ar}",
-			scoreId, scoreIt->Value, scoreIt->Accuracy * 100,
-			userId, user.GetPPRecord().Value, user.GetPPRecord().Accuracy,
-			scoreIt->BeatmapId, queueId
+		if (!condition.empty())
+			condition += " OR ";
+
+		// Scores whose user is unknown belong to the first partition
+		condition += StrFormat(
+			"(MOD(COALESCE(`user_id`,0),{0})={1} AND `queue_id`>{2})",
+			_config.NewScoresPartitions, i, _newScoresPartitionQueueIds[i]
 		);
+	}
 
-		++_numScoresProcessedSinceLastStore;
-		if (_numScoresProcessedSinceLastStore > s_lastScoreIdUpdateStep)
-		{
-			storeCount(*_pDB, lastScoreIdKey(), _currentScoreId);
-			_numScoresProcessedSinceLastStore = 0;
-		}
+	return condition;
+}
 
-		_pDataDog->Increment("osu.pp.score.processed_new", 1, {StrFormat("mode:{0}", GamemodeTag(_gamemode))});
-		_pDataDog->Gauge("osu.pp.db.pending_queries", _pDB->NumPendingQueries(), {
-			StrFormat("mode:{0}", GamemodeTag(_gamemode)),
-			"connection:main",
-		});
-	}
+void Processor::waitUntilWritten()
+{
+	Latch latch{1};
+	_pWriteQueue->Fence([&latch]() { latch.CountDown(); });
+	latch.Wait();
+
+	// Fences pass failed writes as well
+	_pWriteQueue->ThrowIfFailed();
+}
+
+void Processor::enableCoalescing(UpdateBatch& batch)
+{
+	if (_config.CoalesceWindow > 0)
+		batch.EnableCoalescing(_config.CoalesceMaxRows, milliseconds{_config.CoalesceWindow});
 }
 
 void Processor::pollAndProcessNewBeatmapSets(DatabaseConnection& dbSlave)
@@ -795,13 +2186,164 @@ void Processor::pollAndProcessNewBeatmapSets(DatabaseConnection& dbSlave)
 
 	tlog::success() << StrFormat("Retrieved {0} new beatmaps.", res.NumRows());
 
+	std::vector<s32> beatmapIds;
 	while (res.NextRow())
 	{
 		_lastApprovedDate = (std::string)res[1];
-		queryBeatmapDifficulty(dbSlave, res[0]);
+		beatmapIds.emplace_back(res[0]);
+	}
+
+	// Difficulty attributes of ranked beatmaps may be recalculated, e.g. after changes to the difficulty calculator
+	res = dbSlave.Query(StrFormat(
+		"SELECT `beatmap_id`, `last_update` "
+		"FROM `osu_beatmaps` "
+		"WHERE `last_update` > '{0}' AND (`playmode`=0 OR `playmode`={1}) AND `approved` BETWEEN {2} AND {3} "
+		"ORDER BY `last_update` ASC",
+		_lastBeatmapUpdate, _gamemode, s_minRankedStatus, s_maxRankedStatus
+	));
+
+	while (res.NextRow())
+	{
+		_lastBeatmapUpdate = (std::string)res[1];
+		beatmapIds.emplace_back(res[0]);
+	}
+
+	std::vector<s32> changedBeatmapIds;
+	for (s32 beatmapId : beatmapIds)
+	{
+		Beatmap previous{beatmapId};
+		bool isKnown;
+		{
+			RWLock lock{&_beatmapMutex, false};
+
+			auto beatmapIt = _beatmaps.find(beatmapId);
+			isKnown = beatmapIt != std::end(_beatmaps);
+			if (isKnown)
+				previous = beatmapIt->second;
+		}
+
+		queryBeatmapDifficulty(dbSlave, beatmapId);
 
 		_pDataDog->Increment("osu.pp.difficulty.required_retrieval", 1, { StrFormat("mode:{0}", GamemodeTag(_gamemode)) });
+
+		RWLock lock{&_beatmapMutex, false};
+
+		auto beatmapIt = _beatmaps.find(beatmapId);
+		if (beatmapIt != std::end(_beatmaps) && (!isKnown || !beatmapIt->second.HasSameDifficulty(previous)))
+			changedBeatmapIds.emplace_back(beatmapId);
+	}
+
+	if (_config.ReprocessUsersPerSecond > 0 && !changedBeatmapIds.empty())
+		reprocessScoresOnBeatmaps(dbSlave, changedBeatmapIds);
+}
+
+void Processor::reprocessScoresOnBeatmaps(DatabaseConnection& dbSlave, const std::vector<s32>& beatmapIds)
+{
+	static const s32 s_maxNumScores = 10000;
+
+	tlog::info() << StrFormat("Difficulty of {0} beatmaps changed. Reprocessing their scores.", beatmapIds.size());
+
+	// Written by the shared writer behind all latency-sensitive updates
+	UpdateBatch newScores{_pWriteQueue, 0, 10000};
+
+	for (s32 beatmapId : beatmapIds)
+	{
+		s64 currentScoreId = 0;
+		while (!_shallShutdown)
+		{
+			_pWriteQueue->Throttle();
+
+			auto res = dbSlave.Query(scoresQuery(StrFormat(
+				"`beatmap_id`={0} AND `score_id`>{1} ORDER BY `score_id` ASC LIMIT {2}",
+				beatmapId, currentScoreId, s_maxNumScores
+			)));
+
+			if (res.NumRows() == 0)
+				break;
+
+			size_t numQueued = 0;
+			size_t numDropped = 0;
+			{
+				std::lock_guard<std::mutex> lock{_reprocessMutex};
+				while (res.NextRow())
+				{
+					currentScoreId = res[0];
+
+					// Users of partitions owned by others are taken care of by their processes
+					s64 userId = res[1];
+					if (!_isReprocessPartitionOwned.empty() && !_isReprocessPartitionOwned[userId % _isReprocessPartitionOwned.size()])
+						continue;
+
+					if (_isReprocessUserQueued.count(userId) > 0)
+						continue;
+
+					if (_reprocessUserIds.size() >= s_maxNumReprocessUsers)
+					{
+						++numDropped;
+						continue;
+					}
+
+					_isReprocessUserQueued.insert(userId);
+					_reprocessUserIds.emplace_back(userId);
+				}
+
+				numQueued = _reprocessUserIds.size();
+			}
+
+			// Most scores keep their pp when a beatmap is reprocessed
+			res.Rewind();
+			auto numScores = computeScores(dbSlave, res, &newScores, true).size();
+
+			std::vector<std::string> tags = {StrFormat("mode:{0}", GamemodeTag(_gamemode))};
+			_pDataDog->Increment("osu.pp.reprocess.scores", numScores, tags);
+			_pDataDog->Gauge("osu.pp.reprocess.queued_users", numQueued, tags);
+
+			if (numDropped > 0)
+			{
+				tlog::warning() << StrFormat("Too many users to reprocess. Leaving {0} of them to the next sweep.", numDropped);
+				_pDataDog->Increment("osu.pp.reprocess.dropped_users", numDropped, tags);
+			}
+		}
+	}
+}
+
+void Processor::fenceSweptUser(s64 userId)
+{
+	std::lock_guard<std::mutex> lock{_activeSweepMutex};
+	if (_pActiveSweep)
+		_pActiveSweep->FenceUser(userId);
+}
+
+bool Processor::reprocessNextUser()
+{
+	if (steady_clock::now() - _lastReprocessTime < microseconds{1000000 / std::max(_config.ReprocessUsersPerSecond, 1u)})
+		return false;
+
+	s64 userId;
+	{
+		std::lock_guard<std::mutex> lock{_reprocessMutex};
+		if (_reprocessUserIds.empty())
+			return false;
+
+		userId = _reprocessUserIds.front();
+		_reprocessUserIds.pop_front();
+		_isReprocessUserQueued.erase(userId);
 	}
+
+	// Partitions may have been handed to others since the user was queued. Skipping costs nothing, hence it
+	// does not count against the rate.
+	if (_pNewScoresLeases && !_isNewScoresPartitionOwned[userId % _config.NewScoresPartitions])
+		return true;
+
+	_lastReprocessTime = steady_clock::now();
+
+	_pUserStatsCache->Load(*_pDBSlave, {userId});
+
+	fenceSweptUser(userId);
+	processSingleUser(0, *_pDB, *_pDBSlave, *_pNewUpdatesBatch, *_pNewUpdatesBatch, userId);
+
+	_pDataDog->Increment("osu.pp.reprocess.users", 1, {StrFormat("mode:{0}", GamemodeTag(_gamemode))});
+	return true;
 }
 
 void Processor::queryBeatmapBlacklist()
@@ -847,28 +2389,71 @@ void Processor::queryBeatmapDifficultyAttributes()
 	tlog::success() << StrFormat("Retrieved {0} difficulty attributes, stored in {1} entries.", numEntries, _difficultyAttributes.size());
 }
 
+std::string Processor::userScoresQuery(s64 userId) const
+{
+	return scoresQuery(StrFormat("`user_id`={0}", userId));
+}
+
+std::string Processor::scoresQuery(const std::string& condition) const
+{
+	return StrFormat(
+		"SELECT "
+		"`score_id`,"
+		"`user_id`,"
+		"`beatmap_id`,"
+		"`score`,"
+		"`maxcombo`,"
+		"`count300`,"
+		"`count100`,"
+		"`count50`,"
+		"`countmiss`,"
+		"`countgeki`,"
+		"`countkatu`,"
+		"`enabled_mods`,"
+		"`pp` "
+		"FROM `osu_scores{0}_high` "
+		"WHERE {1}", GamemodeSuffix(_gamemode), condition
+	);
+}
+
+User Processor::processSingleUser(
+	s64 selectedScoreId,
+	DatabaseConnection& db,
+	DatabaseConnection& dbSlave,
+	UpdateBatch& newUsers,
+	UpdateBatch& newScores,
+	s64 userId,
+	const std::function<bool()>& mayWriteUser
+)
+{
+	auto res = dbSlave.Query(userScoresQuery(userId));
+	return processSingleUser(selectedScoreId, res, db, dbSlave, newUsers, newScores, userId, mayWriteUser);
+}
+
 User Processor::processSingleUser(
 	s64 selectedScoreId,
+	QueryResult& scores,
 	DatabaseConnection& db,
 	DatabaseConnection& dbSlave,
 	UpdateBatch& newUsers,
 	UpdateBatch& newScores,
-	s64 userId
+	s64 userId,
+	const std::function<bool()>& mayWriteUser
 )
 {
 	switch (_gamemode)
 	{
 	case EGamemode::Osu:
-		return processSingleUserGeneric<OsuScore>(selectedScoreId, db, dbSlave, newUsers, newScores, userId);
+		return processSingleUserGeneric<OsuScore>(selectedScoreId, scores, db, dbSlave, newUsers, newScores, userId, mayWriteUser);
 
 	case EGamemode::Taiko:
-		return processSingleUserGeneric<TaikoScore>(selectedScoreId, db, dbSlave, newUsers, newScores, userId);
+		return processSingleUserGeneric<TaikoScore>(selectedScoreId, scores, db, dbSlave, newUsers, newScores, userId, mayWriteUser);
 
 	case EGamemode::Catch:
-		return processSingleUserGeneric<CatchScore>(selectedScoreId, db, dbSlave, newUsers, newScores, userId);
+		return processSingleUserGeneric<CatchScore>(selectedScoreId, scores, db, dbSlave, newUsers, newScores, userId, mayWriteUser);
 
 	case EGamemode::Mania:
-		return processSingleUserGeneric<ManiaScore>(selectedScoreId, db, dbSlave, newUsers, newScores, userId);
+		return processSingleUserGeneric<ManiaScore>(selectedScoreId, scores, db, dbSlave, newUsers, newScores, userId, mayWriteUser);
 
 	default:
 		throw ProcessorException(SRC_POS, StrFormat("Unknown gamemode requested. ({0})", _gamemode));
@@ -878,37 +2463,21 @@ User Processor::processSingleUser(
 template <class TScore>
 User Processor::processSingleUserGeneric(
 	s64 selectedScoreId,
+	QueryResult& res,
 	DatabaseConnection& db,
 	DatabaseConnection& dbSlave,
 	UpdateBatch& newUsers,
 	UpdateBatch& newScores,
-	s64 userId
+	s64 userId,
+	const std::function<bool()>& mayWriteUser
 )
 {
 	static const f32 s_notableEventRatingThreshold = 1.0f / 21.5f;
 	static const f32 s_notableEventRatingDifferenceMinimum = 5.0f;
 
-	auto res = dbSlave.Query(StrFormat(
-		"SELECT "
-		"`score_id`,"
-		"`user_id`,"
-		"`beatmap_id`,"
-		"`score`,"
-		"`maxcombo`,"
-		"`count300`,"
-		"`count100`,"
-		"`count50`,"
-		"`countmiss`,"
-		"`countgeki`,"
-		"`countkatu`,"
-		"`enabled_mods`,"
-		"`pp` "
-		"FROM `osu_scores{0}_high` "
-		"WHERE `user_id`={1}", GamemodeSuffix(_gamemode), userId
-	));
-
 	User user{userId};
 	std::vector<TScore> scoresThatNeedDBUpdate;
+	std::vector<PPExport::ScoreRow> exportedScores;
 
 	{
 		RWLock lock{&_beatmapMutex, false};
@@ -974,14 +2543,21 @@ User Processor::processSingleUserGeneric(
 				beatmap,
 			};
 
-			user.AddScorePPRecord(score.CreatePPRecord());
+			auto record = score.CreatePPRecord();
+			user.AddScorePPRecord(record);
+
+			// Exports hold every computed score, or only the selected one if there is any
+			if (_pExport)
+			{
+				if (selectedScoreId == 0 || selectedScoreId == scoreId)
+					exportedScores.push_back({scoreId, userId, beatmapId, mods, record.Value, record.Accuracy, !res.IsNull(12), res.IsNull(12) ? 0 : (f32)res[12]});
 
-			// Column 12 is the pp value of the score from the database.
-			// Only update score if it differs a lot!
+				continue;
+			}
 
 			// always write selected scores to ensure the queue is updated.
 			// TODO: properly use queue_id or return a bool asserting whether we performed an update, rather than doing this.
-			if (res.IsNull(12) || (_config.WriteAllPPChanges && fabs((f32)res[12] - score.TotalValue()) > 0.001f) || selectedScoreId == scoreId)
+			if (isPPChanged(res, score.TotalValue()) || selectedScoreId == scoreId)
 			{
 				// Ensure the selected score is in the front if it exists
 				if (selectedScoreId == scoreId)
@@ -992,6 +2568,9 @@ User Processor::processSingleUserGeneric(
 		}
 	}
 
+	if (!exportedScores.empty())
+		_pExport->Add(exportedScores);
+
 	{
 		std::lock_guard<std::mutex> lock{newScores.Mutex()};
 
@@ -1006,6 +2585,31 @@ User Processor::processSingleUserGeneric(
 		user.ComputePPRecord();
 		auto userPPRecord = user.GetPPRecord();
 
+		// Users without stats can not be updated
+		UserStatsCache::Stats previousStats;
+		bool hasStats = _pUserStatsCache->Get(dbSlave, userId, previousStats);
+
+		// Exported as if written, including users whose pp can not be written
+		if (_pExport)
+		{
+			f64 value = previousStats.IsRanked() ? userPPRecord.Value : 0;
+			_pExport->Add(PPExport::UserRow{userId, value, userPPRecord.Accuracy, hasStats && previousStats.HasPP, previousStats.PP});
+
+			_pDataDog->Increment("osu.pp.user.amount_processed", 1, {StrFormat("mode:{0}", GamemodeTag(_gamemode))}, 0.01f);
+			return user;
+		}
+
+		// Ranked status decides the written value as much as the scores do
+		u64 fingerprint = user.ScoresFingerprint() ^ (previousStats.IsRanked() ? 0 : 0x9E3779B97F4A7C15ull);
+
+		// Nothing changed since the pp were last computed, hence neither the total nor notable events need looking at
+		if (hasStats && previousStats.Fingerprint == fingerprint)
+		{
+			_pDataDog->Increment("osu.pp.user.write_skipped", 1, {StrFormat("mode:{0}", GamemodeTag(_gamemode))}, 0.01f);
+			_pDataDog->Increment("osu.pp.user.amount_processed", 1, {StrFormat("mode:{0}", GamemodeTag(_gamemode))}, 0.01f);
+			return user;
+		}
+
 		// Check for notable event
 		if (!scoresThatNeedDBUpdate.empty() && scoresThatNeedDBUpdate.front().Id() == selectedScoreId && // Did the score actually get found (this _should_ never be false, but better make sure)
 			scoresThatNeedDBUpdate.front().TotalValue() > userPPRecord.Value * s_notableEventRatingThreshold)
@@ -1014,25 +2618,12 @@ User Processor::processSingleUserGeneric(
 
 			const auto& score = scoresThatNeedDBUpdate.front();
 
-			// Obtain user's previous pp rating for determining the difference
-			auto res = dbSlave.Query(StrFormat(
-				"SELECT `{0}` FROM `osu_user_stats{1}` WHERE `user_id`={2}",
-				_config.UserPPColumnName,
-				GamemodeSuffix(_gamemode),
-				userId
-			));
+			// The difference is determined from the user's previous pp rating
+			f64 ratingChange = hasStats && previousStats.HasPP ? userPPRecord.Value - previousStats.PP : 0;
 
-			while (res.NextRow())
+			// We don't want to log scores, that give less than a mere 5 pp
+			if (ratingChange >= s_notableEventRatingDifferenceMinimum)
 			{
-				if (res.IsNull(0))
-					continue;
-
-				f64 ratingChange = userPPRecord.Value - (f64)res[0];
-
-				// We don't want to log scores, that give less than a mere 5 pp
-				if (ratingChange < s_notableEventRatingDifferenceMinimum)
-					continue;
-
 				tlog::info() << StrFormat("Notable event: s{0} u{1} b{2}", score.Id(), userId, score.BeatmapId());
 
 				db.NonQueryBackground(StrFormat(
@@ -1047,22 +2638,39 @@ User Processor::processSingleUserGeneric(
 			}
 		}
 
-		newUsers.AppendAndCommit(StrFormat(
-			"UPDATE `osu_user_stats{0}` "
-			"SET `{1}`= CASE "
-				// Set pp to 0 if the user is inactive or restricted.
-				"WHEN (CURDATE() > DATE_ADD(`last_played`, INTERVAL 3 MONTH) OR (SELECT `user_warnings` FROM `{5}` WHERE `user_id`={4}) > 0) THEN 0 "
-				"ELSE {2} "
-			"END,"
-			"`accuracy_new`={3} "
-			"WHERE `user_id`={4} AND ABS(`{1}` - {2}) > 0.01;",
-			GamemodeSuffix(_gamemode),
-			_config.UserPPColumnName,
-			userPPRecord.Value,
-			userPPRecord.Accuracy,
-			userId,
-			_config.UserMetadataTableName
-		));
+		// Set pp to 0 if the user is inactive or restricted.
+		f64 value = previousStats.IsRanked() ? userPPRecord.Value : 0;
+
+		// Users whose pp are null are left alone, as they always have been.
+		if (hasStats && previousStats.HasPP && std::abs(previousStats.PP - value) > 0.01)
+		{
+			std::lock_guard<std::mutex> lock{newUsers.Mutex()};
+
+			// Superseded by a computation from more recent scores, which we must not overwrite
+			if (mayWriteUser && !mayWriteUser())
+			{
+				_pDataDog->Increment("osu.pp.user.write_superseded", 1, {StrFormat("mode:{0}", GamemodeTag(_gamemode))}, 0.01f);
+				return user;
+			}
+
+			std::string tableName = "osu_user_stats" + GamemodeSuffix(_gamemode);
+
+			newUsers.Builder()
+				.Append("UPDATE `").Append(tableName).Append("` ")
+				.Append("SET `").Append(_config.UserPPColumnName).Append("`=").Append(value).Append(',')
+				.Append("`accuracy_new`=").Append(userPPRecord.Accuracy).Append(' ')
+				.Append("WHERE `user_id`=").Append(userId).Append(' ')
+				// Same condition as above, checked again by the database since the cache may be behind it.
+				// Null pp fail it as well, hence they are never overwritten.
+				.Append("AND ABS(`").Append(_config.UserPPColumnName).Append("` - ").Append(value).Append(") > 0.01;");
+
+			newUsers.CommitNonThreadsafe(tableName, userId);
+
+			_pUserStatsCache->SetPP(userId, value);
+		}
+
+		if (hasStats)
+			_pUserStatsCache->SetFingerprint(userId, fingerprint);
 
 		_pDataDog->Increment("osu.pp.user.amount_processed", 1, {StrFormat("mode:{0}", GamemodeTag(_gamemode))}, 0.01f);
 	}
@@ -1072,11 +2680,16 @@ User Processor::processSingleUserGeneric(
 
 void Processor::storeCount(DatabaseConnection& db, std::string key, s64 value)
 {
-	db.NonQueryBackground(StrFormat(
+	db.NonQueryBackground(storeCountQuery(key, value));
+}
+
+std::string Processor::storeCountQuery(const std::string& key, s64 value) const
+{
+	return StrFormat(
 		"INSERT INTO `osu_counts`(`name`,`count`) VALUES('{0}',{1}) "
 		"ON DUPLICATE KEY UPDATE `name`=VALUES(`name`),`count`=VALUES(`count`)",
 		key, value
-	));
+	);
 }
 
 s64 Processor::retrieveCount(DatabaseConnection& db, std::string key)
@@ -1092,6 +2705,19 @@ s64 Processor::retrieveCount(DatabaseConnection& db, std::string key)
 	throw ProcessorException{SRC_POS, StrFormat("Unable to retrieve count '{0}'.", key)};
 }
 
+s64 Processor::retrieveCount(DatabaseConnection& db, std::string key, s64 defaultValue)
+{
+	auto res = db.Query(StrFormat(
+		"SELECT `count` FROM `osu_counts` WHERE `name`='{0}'", key
+	));
+
+	while (res.NextRow())
+		if (!res.IsNull(0))
+			return res[0];
+
+	return defaultValue;
+}
+
 std::string Processor::retrieveUserName(s64 userId, DatabaseConnection& db) const
 {
 	auto res = db.Query(StrFormat(
@@ -5,6 +5,24 @@
 
 PP_NAMESPACE_BEGIN
 
+namespace
+{
+	// Named once per gamemode, such that writing scores does not need to build the name
+	const std::string& scoresTableName(EGamemode mode)
+	{
+		static const std::string s_names[] = {
+			"osu_scores" + GamemodeSuffix(EGamemode::Osu) + "_high",
+			"osu_scores" + GamemodeSuffix(EGamemode::Taiko) + "_high",
+			"osu_scores" + GamemodeSuffix(EGamemode::Catch) + "_high",
+			"osu_scores" + GamemodeSuffix(EGamemode::Mania) + "_high",
+		};
+
+		return s_names[(size_t)mode];
+	}
+
+	const std::string s_queueTableName = "score_process_queue";
+}
+
 Score::Score(
 	s64 scoreId,
 	EGamemode mode,
@@ -39,16 +57,21 @@ _mods{mods}
 
 void Score::AppendToUpdateBatch(UpdateBatch& batch) const
 {
-	batch.AppendAndCommitNonThreadsafe(StrFormat(
-		"UPDATE `osu_scores{0}_high` "
-		"SET `pp`={1} "
-		"WHERE `score_id`={2};",
-		GamemodeSuffix(_mode),
-		TotalValue(),
-		_scoreId
-	));
-
-	batch.AppendAndCommitNonThreadsafe(StrFormat("UPDATE `score_process_queue` SET `status` = 1 WHERE `mode` = {0} AND `score_id` = {1};", static_cast<int>(_mode), _scoreId));
+	const auto& tableName = scoresTableName(_mode);
+
+	batch.Builder()
+		.Append("UPDATE `").Append(tableName).Append("` ")
+		.Append("SET `pp`=").Append(TotalValue()).Append(' ')
+		.Append("WHERE `score_id`=").Append(_scoreId).Append(';');
+
+	batch.CommitNonThreadsafe(tableName, _scoreId);
+
+	batch.Builder()
+		.Append("UPDATE `score_process_queue` SET `status` = 1 WHERE `mode` = ").Append(static_cast<s32>(_mode))
+		.Append(" AND `score_id` = ").Append(_scoreId).Append(';');
+
+	// Rows are keyed by the gamemode as well, which is the same for all scores of a batch
+	batch.CommitNonThreadsafe(s_queueTableName, _scoreId);
 }
 
 PP_NAMESPACE_END
@@ -0,0 +1,606 @@
+#include <pp/Common.h>
+#include <pp/performance/Snapshot.h>
+
+#include <pp/performance/Beatmap.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <unordered_set>
+
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+PP_NAMESPACE_BEGIN
+
+namespace
+{
+	const char s_magic[8] = {'P', 'P', 'S', 'N', 'A', 'P', 'S', 'H'};
+	const size_t s_nameSize = 48;
+	const size_t s_alignment = 64;
+
+	// Magic, version, gamemode, number of columns, and padding
+	const size_t s_headerSize = sizeof(s_magic) + 4 * sizeof(u32);
+
+	// Name, element size, padding, number of elements, and offset
+	const size_t s_entrySize = s_nameSize + 2 * sizeof(u32) + 2 * sizeof(u64);
+
+	bool startsWith(const std::string& str, const char* prefix)
+	{
+		return str.compare(0, strlen(prefix), prefix) == 0;
+	}
+
+	bool fileExists(const std::string& path)
+	{
+		return std::ifstream{path}.good();
+	}
+
+	// Reads the rows of the table in a mysqldump file. Dumps hold the table's definition followed by
+	// extended inserts of many rows each, one per line.
+	class DumpReader
+	{
+	public:
+		struct Value
+		{
+			std::string Text;
+			bool IsNull;
+		};
+
+		class Row
+		{
+		public:
+			Row(const std::vector<Value>& values, const std::vector<size_t>& indices)
+			: _values(values), _indices(indices)
+			{
+			}
+
+			bool IsNull(size_t i) const { return value(i).IsNull; }
+			const std::string& Text(size_t i) const { return value(i).Text; }
+			s64 Int(size_t i) const { return strtoll(Text(i).c_str(), nullptr, 10); }
+			f64 Float(size_t i) const { return strtod(Text(i).c_str(), nullptr); }
+
+		private:
+			const Value& value(size_t i) const
+			{
+				if (_indices[i] >= _values.size())
+					throw SnapshotException{SRC_POS, "Row holds fewer values than its table has columns."};
+
+				return _values[_indices[i]];
+			}
+
+			const std::vector<Value>& _values;
+			const std::vector<size_t>& _indices;
+		};
+
+		DumpReader(std::string path)
+		: _path{std::move(path)}, _file{_path}
+		{
+			if (!_file)
+				throw SnapshotException{SRC_POS, StrFormat("Could not open dump '{0}'.", _path)};
+		}
+
+		// Calls f for every row with the given columns, in the order they were given
+		template <typename F>
+		void ForEachRow(const std::vector<std::string>& columnNames, const F& f)
+		{
+			std::string line;
+			std::vector<std::string> tableColumns;
+			std::vector<size_t> indices;
+			std::vector<Value> values;
+
+			while (std::getline(_file, line))
+			{
+				if (startsWith(line, "CREATE TABLE"))
+				{
+					tableColumns.clear();
+
+					// One column per line until the keys
+					while (std::getline(_file, line) && startsWith(line, "  `"))
+						tableColumns.emplace_back(line.substr(3, line.find('`', 3) - 3));
+
+					continue;
+				}
+
+				if (!startsWith(line, "INSERT INTO `"))
+					continue;
+
+				size_t pos = line.find('`', 13) + 1;
+
+				// Dumps made with --complete-insert name the columns of every insert
+				while (pos < line.size() && line[pos] == ' ')
+					++pos;
+
+				if (pos < line.size() && line[pos] == '(')
+				{
+					tableColumns.clear();
+
+					size_t end = line.find(')', pos);
+					for (pos = line.find('`', pos); pos < end; pos = line.find('`', pos + 1))
+					{
+						size_t nameEnd = line.find('`', pos + 1);
+						tableColumns.emplace_back(line.substr(pos + 1, nameEnd - pos - 1));
+						pos = nameEnd;
+					}
+				}
+
+				pos = line.find("VALUES", pos);
+				if (pos == std::string::npos)
+					throw SnapshotException{SRC_POS, StrFormat("Malformed insert in '{0}'.", _path)};
+
+				pos += 6;
+				resolve(columnNames, tableColumns, indices);
+
+				while (parseTuple(line, pos, values))
+					f(Row{values, indices});
+			}
+		}
+
+	private:
+		void resolve(const std::vector<std::string>& columnNames, const std::vector<std::string>& tableColumns, std::vector<size_t>& indices)
+		{
+			indices.clear();
+
+			for (const auto& name : columnNames)
+			{
+				auto it = std::find(std::begin(tableColumns), std::end(tableColumns), name);
+				if (it == std::end(tableColumns))
+					throw SnapshotException{SRC_POS, StrFormat("Dump '{0}' has no column '{1}'.", _path, name)};
+
+				indices.emplace_back(it - std::begin(tableColumns));
+			}
+		}
+
+		// Parses the next parenthesized row starting at pos. Returns false at the end of the insert.
+		bool parseTuple(const std::string& line, size_t& pos, std::vector<Value>& values)
+		{
+			while (pos < line.size() && (line[pos] == ' ' || line[pos] == ','))
+				++pos;
+
+			if (pos >= line.size() || line[pos] == ';')
+				return false;
+
+			if (line[pos] != '(')
+				throw SnapshotException{SRC_POS, StrFormat("Malformed row in '{0}'.", _path)};
+
+			++pos;
+
+			size_t numValues = 0;
+			while (true)
+			{
+				if (values.size() <= numValues)
+					values.emplace_back();
+
+				parseValue(line, pos, values[numValues++]);
+
+				if (pos >= line.size())
+					throw SnapshotException{SRC_POS, StrFormat("Unterminated row in '{0}'.", _path)};
+
+				if (line[pos++] == ')')
+					break;
+			}
+
+			values.resize(numValues);
+			return true;
+		}
+
+		void parseValue(const std::string& line, size_t& pos, Value& value)
+		{
+			value.Text.clear();
+			value.IsNull = false;
+
+			if (line.compare(pos, 8, "_binary ") == 0)
+				pos += 8;
+
+			if (pos < line.size() && line[pos] == '\'')
+			{
+				for (++pos; pos < line.size() && line[pos] != '\''; ++pos)
+				{
+					if (line[pos] != '\\' || pos + 1 >= line.size())
+					{
+						value.Text += line[pos];
+						continue;
+					}
+
+					switch (line[++pos])
+					{
+						case '0': value.Text += '\0'; break;
+						case 'b': value.Text += '\b'; break;
+						case 'n': value.Text += '\n'; break;
+						case 'r': value.Text += '\r'; break;
+						case 't': value.Text += '\t'; break;
+						case 'Z': value.Text += '\x1A'; break;
+						default: value.Text += line[pos]; break;
+					}
+				}
+
+				// Closing quote
+				++pos;
+				return;
+			}
+
+			size_t end = line.find_first_of(",)", pos);
+			if (end == std::string::npos)
+				end = line.size();
+
+			value.Text.assign(line, pos, end - pos);
+			value.IsNull = value.Text == "NULL";
+			pos = end;
+		}
+
+		std::string _path;
+		std::ifstream _file;
+	};
+
+	// Orders the elements of a column as given by indices
+	template <typename T>
+	void permute(std::vector<T>& column, const std::vector<size_t>& order)
+	{
+		std::vector<T> permuted;
+		permuted.reserve(column.size());
+
+		for (size_t i : order)
+			permuted.emplace_back(column[i]);
+
+		column = std::move(permuted);
+	}
+
+	class SnapshotWriter
+	{
+	public:
+		// The column must stay alive until written
+		template <typename T>
+		void Add(const std::string& name, const std::vector<T>& column)
+		{
+			if (name.size() >= s_nameSize)
+				throw SnapshotException{SRC_POS, StrFormat("Column name '{0}' is too long.", name)};
+
+			_columns.push_back({name, (u32)sizeof(T), column.size(), column.data()});
+		}
+
+		void Write(const std::string& path, EGamemode gamemode, u32 version)
+		{
+			_pFile = fopen(path.c_str(), "wb");
+			if (!_pFile)
+				throw SnapshotException{SRC_POS, StrFormat("Could not open '{0}' for writing.", path)};
+
+			u32 header[4] = {version, (u32)gamemode, (u32)_columns.size(), 0};
+			write(s_magic, sizeof(s_magic));
+			write(header, sizeof(header));
+
+			u64 offset = align(s_headerSize + _columns.size() * s_entrySize);
+			for (const auto& column : _columns)
+			{
+				char name[s_nameSize] = {};
+				memcpy(name, column.Name.data(), column.Name.size());
+
+				u32 elementSize[2] = {column.ElementSize, 0};
+				u64 location[2] = {column.NumElements, offset};
+
+				write(name, sizeof(name));
+				write(elementSize, sizeof(elementSize));
+				write(location, sizeof(location));
+
+				offset = align(offset + column.NumElements * column.ElementSize);
+			}
+
+			for (const auto& column : _columns)
+			{
+				pad();
+				write(column.pData, column.NumElements * column.ElementSize);
+			}
+
+			if (fclose(_pFile) != 0)
+				throw SnapshotException{SRC_POS, StrFormat("Could not write to '{0}'.", path)};
+		}
+
+	private:
+		struct Column
+		{
+			std::string Name;
+			u32 ElementSize;
+			u64 NumElements;
+			const void* pData;
+		};
+
+		static u64 align(u64 offset)
+		{
+			return (offset + s_alignment - 1) / s_alignment * s_alignment;
+		}
+
+		void pad()
+		{
+			static const char s_zeros[s_alignment] = {};
+			write(s_zeros, align(_size) - _size);
+		}
+
+		void write(const void* pData, size_t size)
+		{
+			if (fwrite(pData, 1, size, _pFile) != size)
+				throw SnapshotException{SRC_POS, "Could not write snapshot."};
+
+			_size += size;
+		}
+
+		std::vector<Column> _columns;
+		std::FILE* _pFile = nullptr;
+		u64 _size = 0;
+	};
+
+	// Users who did not play since this date are inactive, like CURDATE() > DATE_ADD(`last_played`, INTERVAL 3 MONTH) decides
+	std::string inactivityThreshold()
+	{
+		time_t now = time(nullptr);
+		std::tm date = *localtime(&now);
+		date.tm_mon -= 3;
+		mktime(&date);
+
+		char threshold[16];
+		strftime(threshold, sizeof(threshold), "%Y-%m-%d", &date);
+		return threshold;
+	}
+}
+
+const u32 Snapshot::s_version = 1;
+
+Snapshot::Snapshot(const std::string& path)
+: _path{path}
+{
+#ifdef _WIN32
+	std::ifstream file{_path, std::ios::binary};
+	if (!file)
+		throw SnapshotException{SRC_POS, StrFormat("Could not open snapshot '{0}'.", _path)};
+
+	_mapping.Contents.assign(std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{});
+	_mapping.pData = _mapping.Contents.data();
+	_mapping.Size = _mapping.Contents.size();
+#else
+	int fd = open(_path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw SnapshotException{SRC_POS, StrFormat("Could not open snapshot '{0}'.", _path)};
+
+	struct stat status;
+	if (fstat(fd, &status) != 0)
+	{
+		close(fd);
+		throw SnapshotException{SRC_POS, StrFormat("Could not determine the size of snapshot '{0}'.", _path)};
+	}
+
+	_mapping.Size = (size_t)status.st_size;
+
+	void* pMapping = _mapping.Size > 0 ? mmap(nullptr, _mapping.Size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+
+	if (pMapping == MAP_FAILED)
+		throw SnapshotException{SRC_POS, StrFormat("Could not map snapshot '{0}'.", _path)};
+
+	_mapping.pData = static_cast<const char*>(pMapping);
+#endif
+
+	u32 header[4];
+	if (_mapping.Size < s_headerSize || memcmp(_mapping.pData, s_magic, sizeof(s_magic)) != 0)
+		throw SnapshotException{SRC_POS, StrFormat("'{0}' is not a snapshot.", _path)};
+
+	memcpy(header, _mapping.pData + sizeof(s_magic), sizeof(header));
+	if (header[0] != s_version)
+		throw SnapshotException{SRC_POS, StrFormat("Snapshot '{0}' has version {1} rather than {2}.", _path, header[0], s_version)};
+
+	_gamemode = (EGamemode)header[1];
+
+	u32 numColumns = header[2];
+	if (_mapping.Size < s_headerSize + (u64)numColumns * s_entrySize)
+		throw SnapshotException{SRC_POS, StrFormat("Snapshot '{0}' is truncated.", _path)};
+
+	for (u32 i = 0; i < numColumns; ++i)
+	{
+		const char* pEntry = _mapping.pData + s_headerSize + i * s_entrySize;
+
+		std::string name{pEntry, strnlen(pEntry, s_nameSize)};
+
+		Entry entry;
+		memcpy(&entry.ElementSize, pEntry + s_nameSize, sizeof(u32));
+		memcpy(&entry.NumElements, pEntry + s_nameSize + 2 * sizeof(u32), sizeof(u64));
+		memcpy(&entry.Offset, pEntry + s_nameSize + 2 * sizeof(u32) + sizeof(u64), sizeof(u64));
+
+		if (entry.Offset > _mapping.Size || entry.NumElements * entry.ElementSize > _mapping.Size - entry.Offset)
+			throw SnapshotException{SRC_POS, StrFormat("Column '{0}' of snapshot '{1}' is truncated.", name, _path)};
+
+		_columns[name] = entry;
+	}
+}
+
+Snapshot::Mapping::~Mapping()
+{
+#ifndef _WIN32
+	if (pData)
+		munmap(const_cast<char*>(pData), Size);
+#endif
+}
+
+void Snapshot::Convert(EGamemode gamemode, const std::string& dumpDirectory, const std::string& userPPColumnName, const std::string& path)
+{
+	auto dumpPath = [&](const std::string& table) { return StrFormat("{0}/{1}.sql", dumpDirectory, table); };
+
+	std::string suffix = GamemodeSuffix(gamemode);
+	SnapshotWriter writer;
+
+	// Attributes are stored by type, such that the snapshot does not depend on the IDs of their names
+	tlog::info() << "Converting difficulty attributes.";
+
+	std::unordered_map<s64, Beatmap::EDifficultyAttributeType> attributeTypes;
+	DumpReader{dumpPath("osu_difficulty_attribs")}.ForEachRow({"attrib_id", "name"}, [&](const DumpReader::Row& row)
+	{
+		if (Beatmap::ContainsAttribute(row.Text(1)))
+			attributeTypes[row.Int(0)] = Beatmap::DifficultyAttributeFromName(row.Text(1));
+		else
+			tlog::warning() << StrFormat("Unsupported attribute '{0}', skipping.", row.Text(1));
+	});
+
+	std::vector<s32> attribBeatmapIds;
+	std::vector<u32> attribMods;
+	std::vector<byte> attribTypes;
+	std::vector<f32> attribValues;
+
+	DumpReader{dumpPath("osu_beatmap_difficulty_attribs")}.ForEachRow({"beatmap_id", "mode", "mods", "attrib_id", "value"}, [&](const DumpReader::Row& row)
+	{
+		auto typeIt = attributeTypes.find(row.Int(3));
+		if (row.Int(1) != (s64)gamemode || typeIt == std::end(attributeTypes))
+			return;
+
+		attribBeatmapIds.emplace_back((s32)row.Int(0));
+		attribMods.emplace_back((u32)row.Int(2));
+		attribTypes.emplace_back((byte)typeIt->second);
+		attribValues.emplace_back((f32)row.Float(4));
+	});
+
+	writer.Add("attribs.beatmap_id", attribBeatmapIds);
+	writer.Add("attribs.mods", attribMods);
+	writer.Add("attribs.type", attribTypes);
+	writer.Add("attribs.value", attribValues);
+
+	tlog::info() << "Converting beatmaps.";
+
+	std::vector<s32> beatmapIds, playmodes, approved, scoreVersions, numCircles, numSliders, numSpinners;
+	DumpReader{dumpPath("osu_beatmaps")}.ForEachRow(
+		{"beatmap_id", "playmode", "approved", "score_version", "countNormal", "countSlider", "countSpinner"},
+		[&](const DumpReader::Row& row)
+	{
+		beatmapIds.emplace_back((s32)row.Int(0));
+		playmodes.emplace_back((s32)row.Int(1));
+		approved.emplace_back((s32)row.Int(2));
+		scoreVersions.emplace_back((s32)row.Int(3));
+		numCircles.emplace_back(row.IsNull(4) ? 0 : (s32)row.Int(4));
+		numSliders.emplace_back(row.IsNull(5) ? 0 : (s32)row.Int(5));
+		numSpinners.emplace_back(row.IsNull(6) ? 0 : (s32)row.Int(6));
+	});
+
+	writer.Add("beatmaps.beatmap_id", beatmapIds);
+	writer.Add("beatmaps.playmode", playmodes);
+	writer.Add("beatmaps.approved", approved);
+	writer.Add("beatmaps.score_version", scoreVersions);
+	writer.Add("beatmaps.countNormal", numCircles);
+	writer.Add("beatmaps.countSlider", numSliders);
+	writer.Add("beatmaps.countSpinner", numSpinners);
+
+	std::vector<s32> blacklistedBeatmapIds;
+	if (fileExists(dumpPath("osu_beatmap_performance_blacklist")))
+	{
+		DumpReader{dumpPath("osu_beatmap_performance_blacklist")}.ForEachRow({"beatmap_id", "mode"}, [&](const DumpReader::Row& row)
+		{
+			if (row.Int(1) == (s64)gamemode)
+				blacklistedBeatmapIds.emplace_back((s32)row.Int(0));
+		});
+	}
+
+	writer.Add("blacklist.beatmap_id", blacklistedBeatmapIds);
+
+	tlog::info() << "Converting users.";
+
+	std::unordered_set<s64> restrictedUserIds;
+	if (fileExists(dumpPath("sample_users")))
+	{
+		DumpReader{dumpPath("sample_users")}.ForEachRow({"user_id", "user_warnings"}, [&](const DumpReader::Row& row)
+		{
+			if (!row.IsNull(1) && row.Int(1) > 0)
+				restrictedUserIds.insert(row.Int(0));
+		});
+	}
+
+	std::string threshold = inactivityThreshold();
+
+	std::vector<s64> userIds;
+	std::vector<f64> userPP;
+	std::vector<byte> isRanked;
+
+	DumpReader{dumpPath(StrFormat("osu_user_stats{0}", suffix))}.ForEachRow({"user_id", userPPColumnName, "last_played"}, [&](const DumpReader::Row& row)
+	{
+		bool isInactive = !row.IsNull(2) && row.Text(2).substr(0, 10) < threshold;
+
+		userIds.emplace_back(row.Int(0));
+		userPP.emplace_back(row.IsNull(1) ? std::numeric_limits<f64>::quiet_NaN() : row.Float(1));
+		isRanked.emplace_back(!isInactive && restrictedUserIds.count(row.Int(0)) == 0);
+	});
+
+	writer.Add("users.user_id", userIds);
+	writer.Add("users.pp", userPP);
+	writer.Add("users.ranked", isRanked);
+
+	tlog::info() << "Converting scores.";
+
+	std::vector<s64> scoreIds, scoreUserIds;
+	std::vector<s32> scoreBeatmapIds, scores, maxCombos, num300, num100, num50, numMiss, numGeki, numKatu;
+	std::vector<u32> mods;
+	std::vector<f32> scorePP;
+
+	DumpReader{dumpPath(StrFormat("osu_scores{0}_high", suffix))}.ForEachRow(
+		{"score_id", "user_id", "beatmap_id", "score", "maxcombo", "count300", "count100", "count50", "countmiss", "countgeki", "countkatu", "enabled_mods", "pp"},
+		[&](const DumpReader::Row& row)
+	{
+		scoreIds.emplace_back(row.Int(0));
+		scoreUserIds.emplace_back(row.Int(1));
+		scoreBeatmapIds.emplace_back((s32)row.Int(2));
+		scores.emplace_back((s32)row.Int(3));
+		maxCombos.emplace_back((s32)row.Int(4));
+		num300.emplace_back((s32)row.Int(5));
+		num100.emplace_back((s32)row.Int(6));
+		num50.emplace_back((s32)row.Int(7));
+		numMiss.emplace_back((s32)row.Int(8));
+		numGeki.emplace_back((s32)row.Int(9));
+		numKatu.emplace_back((s32)row.Int(10));
+		mods.emplace_back((u32)row.Int(11));
+		scorePP.emplace_back(row.IsNull(12) ? std::numeric_limits<f32>::quiet_NaN() : (f32)row.Float(12));
+	});
+
+	// Scores of each user are contiguous, such that users can be processed without looking anything up
+	std::vector<size_t> order(scoreIds.size());
+	std::iota(std::begin(order), std::end(order), 0);
+	std::sort(std::begin(order), std::end(order), [&](size_t a, size_t b)
+	{
+		return scoreUserIds[a] < scoreUserIds[b] || (scoreUserIds[a] == scoreUserIds[b] && scoreIds[a] < scoreIds[b]);
+	});
+
+	permute(scoreIds, order);
+	permute(scoreUserIds, order);
+	permute(scoreBeatmapIds, order);
+	permute(scores, order);
+	permute(maxCombos, order);
+	permute(num300, order);
+	permute(num100, order);
+	permute(num50, order);
+	permute(numMiss, order);
+	permute(numGeki, order);
+	permute(numKatu, order);
+	permute(mods, order);
+	permute(scorePP, order);
+
+	writer.Add("scores.score_id", scoreIds);
+	writer.Add("scores.user_id", scoreUserIds);
+	writer.Add("scores.beatmap_id", scoreBeatmapIds);
+	writer.Add("scores.score", scores);
+	writer.Add("scores.maxcombo", maxCombos);
+	writer.Add("scores.count300", num300);
+	writer.Add("scores.count100", num100);
+	writer.Add("scores.count50", num50);
+	writer.Add("scores.countmiss", numMiss);
+	writer.Add("scores.countgeki", numGeki);
+	writer.Add("scores.countkatu", numKatu);
+	writer.Add("scores.enabled_mods", mods);
+	writer.Add("scores.pp", scorePP);
+
+	writer.Write(path, gamemode, s_version);
+
+	tlog::success() << StrFormat(
+		"Wrote snapshot of {0} scores, {1} users, and {2} beatmaps to '{3}'.",
+		scoreIds.size(), userIds.size(), beatmapIds.size(), path
+	);
+}
+
+PP_NAMESPACE_END
@@ -0,0 +1,245 @@
+#include <pp/Common.h>
+#include <pp/performance/SnapshotProcessor.h>
+
+#include <pp/performance/User.h>
+
+#include <pp/performance/osu/OsuScore.h>
+#include <pp/performance/taiko/TaikoScore.h>
+#include <pp/performance/catch/CatchScore.h>
+#include <pp/performance/mania/ManiaScore.h>
+
+#include <pp/shared/Executor.h>
+
+#include <cmath>
+#include <limits>
+#include <unordered_set>
+
+using namespace std::chrono;
+
+PP_NAMESPACE_BEGIN
+
+const s64 SnapshotProcessor::s_numUsersPerBlock = 256;
+
+SnapshotProcessor::SnapshotProcessor(const std::string& snapshotPath)
+: _snapshot{snapshotPath}, _gamemode{_snapshot.Gamemode()}
+{
+	tlog::none()
+		<< "---------------------------------------------------\n"
+		<< "---- pp processor for gamemode " << GamemodeName(_gamemode) << " from a snapshot\n"
+		<< "---------------------------------------------------";
+
+	loadBeatmaps();
+	findUsers();
+}
+
+void SnapshotProcessor::ProcessAllUsers(u32 numThreads, PPExport* pExport)
+{
+	const size_t numUsers = _userOffsets.size() - 1;
+
+	tlog::info() << StrFormat("Processing {0} users.", numUsers);
+	auto progress = tlog::progress(numUsers);
+
+	Executor executor{numThreads};
+	Latch latch;
+
+	executor.ParallelFor(0, numUsers, s_numUsersPerBlock, [&](s64 begin, s64 end) {
+		processUsers((size_t)begin, (size_t)end, pExport);
+	}, latch);
+
+	while (!latch.WaitFor(milliseconds{100}))
+		progress.update(_numUsersProcessed);
+
+	f64 seconds = duration_cast<duration<f64>>(progress.duration()).count();
+
+	tlog::success() << StrFormat(
+		"Processed {0} scores of {1} users for {2}. ({3} scores per second)",
+		_numScoresProcessed.load(),
+		numUsers,
+		tlog::durationToString(progress.duration()),
+		(u64)(seconds > 0 ? _numScoresProcessed / seconds : 0)
+	);
+}
+
+void SnapshotProcessor::loadBeatmaps()
+{
+	// Same as the statuses whose scores the processor counts
+	static const s32 s_minRankedStatus = Beatmap::Ranked;
+	static const s32 s_maxRankedStatus = Beatmap::Approved;
+
+	tlog::info() << "Loading beatmap difficulties.";
+
+	auto blacklistedIds = _snapshot.Get<s32>("blacklist.beatmap_id");
+	std::unordered_set<s32> blacklist{blacklistedIds.pData, blacklistedIds.pData + blacklistedIds.Size};
+
+	auto ids = _snapshot.Get<s32>("beatmaps.beatmap_id");
+	auto playmodes = _snapshot.Get<s32>("beatmaps.playmode");
+	auto approved = _snapshot.Get<s32>("beatmaps.approved");
+	auto scoreVersions = _snapshot.Get<s32>("beatmaps.score_version");
+	auto numCircles = _snapshot.Get<s32>("beatmaps.countNormal");
+	auto numSliders = _snapshot.Get<s32>("beatmaps.countSlider");
+	auto numSpinners = _snapshot.Get<s32>("beatmaps.countSpinner");
+
+	std::unordered_map<s32, size_t> beatmapIndices;
+	for (size_t i = 0; i < ids.Size; ++i)
+	{
+		bool isPlayable = playmodes[i] == 0 || playmodes[i] == (s32)_gamemode;
+		if (isPlayable && approved[i] >= s_minRankedStatus && approved[i] <= s_maxRankedStatus && blacklist.count(ids[i]) == 0)
+			beatmapIndices[ids[i]] = i;
+	}
+
+	auto attribBeatmapIds = _snapshot.Get<s32>("attribs.beatmap_id");
+	auto attribMods = _snapshot.Get<u32>("attribs.mods");
+	auto attribTypes = _snapshot.Get<byte>("attribs.type");
+	auto attribValues = _snapshot.Get<f32>("attribs.value");
+
+	// Like in the database, beatmaps without difficulty attributes are unknown
+	for (size_t i = 0; i < attribBeatmapIds.Size; ++i)
+	{
+		s32 id = attribBeatmapIds[i];
+
+		auto indexIt = beatmapIndices.find(id);
+		if (indexIt == std::end(beatmapIndices))
+			continue;
+
+		auto beatmapIt = _beatmaps.find(id);
+		if (beatmapIt == std::end(_beatmaps))
+		{
+			size_t index = indexIt->second;
+
+			beatmapIt = _beatmaps.emplace(std::make_pair(id, Beatmap{id})).first;
+
+			auto& beatmap = beatmapIt->second;
+			beatmap.SetRankedStatus((Beatmap::ERankedStatus)approved[index]);
+			beatmap.SetScoreVersion((Beatmap::EScoreVersion)scoreVersions[index]);
+			beatmap.SetNumHitCircles(numCircles[index]);
+			beatmap.SetNumSliders(numSliders[index]);
+			beatmap.SetNumSpinners(numSpinners[index]);
+			beatmap.SetMode(_gamemode);
+		}
+
+		beatmapIt->second.SetDifficultyAttribute((EMods)attribMods[i], (Beatmap::EDifficultyAttributeType)attribTypes[i], attribValues[i]);
+	}
+
+	tlog::success() << StrFormat("Loaded difficulties for a total of {0} beatmaps.", _beatmaps.size());
+}
+
+void SnapshotProcessor::findUsers()
+{
+	auto userIds = _snapshot.Get<s64>("scores.user_id");
+
+	// Scores are ordered by user
+	for (size_t i = 0; i < userIds.Size; ++i)
+		if (i == 0 || userIds[i] != userIds[i - 1])
+			_userOffsets.emplace_back(i);
+
+	_userOffsets.emplace_back(userIds.Size);
+
+	auto statsUserIds = _snapshot.Get<s64>("users.user_id");
+	for (size_t i = 0; i < statsUserIds.Size; ++i)
+		_userStatsIndices[statsUserIds[i]] = i;
+}
+
+void SnapshotProcessor::processUsers(size_t begin, size_t end, PPExport* pExport)
+{
+	switch (_gamemode)
+	{
+	case EGamemode::Osu:
+		return processUsersGeneric<OsuScore>(begin, end, pExport);
+
+	case EGamemode::Taiko:
+		return processUsersGeneric<TaikoScore>(begin, end, pExport);
+
+	case EGamemode::Catch:
+		return processUsersGeneric<CatchScore>(begin, end, pExport);
+
+	case EGamemode::Mania:
+		return processUsersGeneric<ManiaScore>(begin, end, pExport);
+
+	default:
+		throw SnapshotException(SRC_POS, StrFormat("Unknown gamemode requested. ({0})", _gamemode));
+	}
+}
+
+template <class TScore>
+void SnapshotProcessor::processUsersGeneric(size_t begin, size_t end, PPExport* pExport)
+{
+	auto scoreIds = _snapshot.Get<s64>("scores.score_id");
+	auto userIds = _snapshot.Get<s64>("scores.user_id");
+	auto beatmapIds = _snapshot.Get<s32>("scores.beatmap_id");
+	auto scores = _snapshot.Get<s32>("scores.score");
+	auto maxCombos = _snapshot.Get<s32>("scores.maxcombo");
+	auto num300 = _snapshot.Get<s32>("scores.count300");
+	auto num100 = _snapshot.Get<s32>("scores.count100");
+	auto num50 = _snapshot.Get<s32>("scores.count50");
+	auto numMiss = _snapshot.Get<s32>("scores.countmiss");
+	auto numGeki = _snapshot.Get<s32>("scores.countgeki");
+	auto numKatu = _snapshot.Get<s32>("scores.countkatu");
+	auto mods = _snapshot.Get<u32>("scores.enabled_mods");
+	auto storedPP = _snapshot.Get<f32>("scores.pp");
+
+	auto userPP = _snapshot.Get<f64>("users.pp");
+	auto isRanked = _snapshot.Get<byte>("users.ranked");
+
+	std::vector<PPExport::ScoreRow> exportedScores;
+	u64 numScores = 0;
+
+	for (size_t u = begin; u < end; ++u)
+	{
+		s64 userId = userIds[_userOffsets[u]];
+		User user{userId};
+
+		for (size_t i = _userOffsets[u]; i < _userOffsets[u + 1]; ++i)
+		{
+			auto beatmapIt = _beatmaps.find(beatmapIds[i]);
+			if (beatmapIt == std::end(_beatmaps))
+				continue;
+
+			TScore score{
+				scoreIds[i],
+				_gamemode,
+				userId,
+				beatmapIds[i],
+				scores[i],
+				maxCombos[i],
+				num300[i],
+				num100[i],
+				num50[i],
+				numMiss[i],
+				numGeki[i],
+				numKatu[i],
+				(EMods)mods[i],
+				beatmapIt->second,
+			};
+
+			auto record = score.CreatePPRecord();
+			user.AddScorePPRecord(record);
+
+			if (pExport)
+				exportedScores.push_back({scoreIds[i], userId, beatmapIds[i], (EMods)mods[i], record.Value, record.Accuracy, !std::isnan(storedPP[i]), storedPP[i]});
+		}
+
+		numScores += user.NumScores();
+		user.ComputePPRecord();
+
+		if (pExport)
+		{
+			auto statsIt = _userStatsIndices.find(userId);
+			bool hasStats = statsIt != std::end(_userStatsIndices);
+
+			// Set pp to 0 if the user is inactive or restricted, just like the processor
+			f64 value = !hasStats || isRanked[statsIt->second] ? user.GetPPRecord().Value : 0;
+			// Users without stats have no stored pp to compare against rather than 0
+			f64 previousPP = hasStats ? userPP[statsIt->second] : std::numeric_limits<f64>::quiet_NaN();
+
+			pExport->Add(exportedScores);
+			pExport->Add(PPExport::UserRow{userId, value, user.GetPPRecord().Accuracy, !std::isnan(previousPP), previousPP});
+
+			exportedScores.clear();
+		}
+	}
+
+	_numScoresProcessed += numScores;
+	_numUsersProcessed += end - begin;
+}
+
+PP_NAMESPACE_END
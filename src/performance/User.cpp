@@ -1,6 +1,8 @@
 #include <pp/Common.h>
 #include <pp/performance/User.h>
 
+#include <cstring>
+
 PP_NAMESPACE_BEGIN
 
 // Our own implementation of unique ensures that the first unique element
@@ -63,6 +65,24 @@ void User::ComputePPRecord()
 		_rating.Accuracy *= 100.0 / (20 * (1 - pow(0.95, _scores.size())));
 }
 
+u64 User::ScoresFingerprint() const
+{
+	Fnv1aHash hash;
+
+	// Scores are deduplicated and sorted at this point
+	for (const auto& score : _scores)
+	{
+		u32 valueBits;
+		memcpy(&valueBits, &score.Value, sizeof(valueBits));
+
+		hash.Combine((u64)score.ScoreId);
+		hash.Combine(valueBits);
+	}
+
+	// 0 stands for unknown fingerprints
+	return hash.Value() == 0 ? 1 : hash.Value();
+}
+
 Score::PPRecord User::XthBestScorePPRecord(unsigned int i)
 {
 	if (i >= _scores.size())
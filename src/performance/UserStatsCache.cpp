@@ -0,0 +1,163 @@
+#include <pp/Common.h>
+#include <pp/performance/UserStatsCache.h>
+
+#include <cmath>
+
+PP_NAMESPACE_BEGIN
+
+// Roughly 100 MB. Users are loaded right before being processed, hence the least recently used ones are long done.
+const size_t UserStatsCache::s_maxNumEntries = 1000000;
+const size_t UserStatsCache::s_numUsersPerQuery = 1000;
+
+UserStatsCache::UserStatsCache(EGamemode gamemode, std::string ppColumnName, std::string userMetadataTableName)
+: _gamemode{gamemode}, _ppColumnName{std::move(ppColumnName)}, _userMetadataTableName{std::move(userMetadataTableName)}
+{
+}
+
+std::string UserStatsCache::SelectQuery(const std::string& condition) const
+{
+	return StrFormat(
+		"SELECT `s`.`user_id`,`s`.`{0}`,"
+		"CURDATE() > DATE_ADD(`s`.`last_played`, INTERVAL 3 MONTH),"
+		"`m`.`user_warnings` > 0,"
+		"`s`.`playcount` "
+		"FROM `osu_user_stats{1}` `s` LEFT JOIN `{2}` `m` ON `m`.`user_id`=`s`.`user_id` "
+		"WHERE {3}",
+		_ppColumnName, GamemodeSuffix(_gamemode), _userMetadataTableName, condition
+	);
+}
+
+void UserStatsCache::Insert(const QueryResult& res)
+{
+	store(res[0], parse(res));
+}
+
+void UserStatsCache::Load(DatabaseConnection& dbSlave, const std::vector<s64>& userIds)
+{
+	for (size_t begin = 0; begin < userIds.size(); begin += s_numUsersPerQuery)
+	{
+		size_t end = std::min(begin + s_numUsersPerQuery, userIds.size());
+
+		std::string idList;
+		for (size_t i = begin; i < end; ++i)
+		{
+			if (i > begin)
+				idList += ',';
+			idList += std::to_string(userIds[i]);
+		}
+
+		auto res = dbSlave.Query(SelectQuery(StrFormat("`s`.`user_id` IN ({0})", idList)));
+		while (res.NextRow())
+			Insert(res);
+	}
+}
+
+bool UserStatsCache::Get(DatabaseConnection& dbSlave, s64 userId, Stats& stats)
+{
+	{
+		std::lock_guard<std::mutex> lock{_mutex};
+
+		auto it = _stats.find(userId);
+		if (it != std::end(_stats))
+		{
+			touchNonThreadsafe(it->second);
+			stats = it->second.UserStats;
+			return true;
+		}
+	}
+
+	auto res = dbSlave.Query(SelectQuery(StrFormat("`s`.`user_id`={0}", userId)));
+	if (!res.NextRow())
+		return false;
+
+	stats = parse(res);
+	store(userId, stats);
+
+	return true;
+}
+
+void UserStatsCache::SetPP(s64 userId, f64 pp)
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	auto it = _stats.find(userId);
+	if (it == std::end(_stats))
+		return;
+
+	it->second.UserStats.HasPP = true;
+	it->second.UserStats.PP = pp;
+}
+
+void UserStatsCache::SetFingerprint(s64 userId, u64 fingerprint)
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	auto it = _stats.find(userId);
+	if (it != std::end(_stats))
+		it->second.UserStats.Fingerprint = fingerprint;
+}
+
+u64 UserStatsCache::EstimateCost(s64 userId) const
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	auto it = _stats.find(userId);
+	return it == std::end(_stats) ? 0 : it->second.UserStats.Playcount;
+}
+
+size_t UserStatsCache::Size() const
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+	return _stats.size();
+}
+
+UserStatsCache::Stats UserStatsCache::parse(const QueryResult& res)
+{
+	Stats stats;
+	stats.HasPP = !res.IsNull(1);
+	stats.PP = stats.HasPP ? (f64)res[1] : 0;
+
+	// Null comparisons are false in the same way they were when these were decided within the update itself
+	stats.IsInactive = !res.IsNull(2) && (bool)res[2];
+	stats.IsRestricted = !res.IsNull(3) && (bool)res[3];
+
+	stats.Playcount = res.IsNull(4) ? 0 : (u32)res[4];
+
+	return stats;
+}
+
+void UserStatsCache::store(s64 userId, const Stats& stats)
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	auto it = _stats.find(userId);
+	if (it == std::end(_stats))
+	{
+		while (_stats.size() >= s_maxNumEntries)
+		{
+			_stats.erase(_recentUserIds.back());
+			_recentUserIds.pop_back();
+		}
+
+		_recentUserIds.push_front(userId);
+		_stats[userId] = Entry{stats, std::begin(_recentUserIds)};
+		return;
+	}
+
+	Entry& entry = it->second;
+	touchNonThreadsafe(entry);
+
+	// Whatever the pp were computed from is unknown if somebody else wrote them
+	const Stats& previous = entry.UserStats;
+	u64 fingerprint = previous.HasPP == stats.HasPP && std::abs(previous.PP - stats.PP) <= 0.01 ? previous.Fingerprint : 0;
+
+	entry.UserStats = stats;
+	entry.UserStats.Fingerprint = fingerprint;
+}
+
+void UserStatsCache::touchNonThreadsafe(Entry& entry)
+{
+	_recentUserIds.splice(std::begin(_recentUserIds), _recentUserIds, entry.RecentIt);
+}
+
+PP_NAMESPACE_END
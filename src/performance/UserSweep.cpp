@@ -0,0 +1,385 @@
+#include <pp/Common.h>
+#include <pp/performance/UserSweep.h>
+
+using namespace std::chrono;
+
+PP_NAMESPACE_BEGIN
+
+Processor::UserSweep::UserSweep(Processor& processor, u32 numThreads)
+: _processor{processor}, _numThreads{numThreads}, _executor{numThreads, processor._config.ExecutorHighPriorityWeight}
+{
+	_processor.instrumentExecutor(_executor);
+
+	u32 numAsyncConnections = _processor._config.MySqlAsyncConnections;
+	if (numAsyncConnections > 0)
+	{
+		// Reads are multiplexed over a few non-blocking connections
+		// rather than each thread blocking on its own connection.
+		_pAsyncDBSlave = _processor.newAsyncDBConnectionSlave(numAsyncConnections);
+	}
+	else
+	{
+		u32 poolSize = _processor._config.MySqlPoolSize;
+		_pDBSlavePool = _processor.newConnectionPoolSlave(poolSize > 0 ? poolSize : numThreads);
+	}
+
+	// Keep every connection busy while threads are computing previously fetched users.
+	_maxNumUsersDispatched = 4 * std::max(numAsyncConnections, numThreads);
+
+	// Only users waiting to be dispatched are reordered. They merely take up their ID.
+	_maxNumUsersPending = std::max(_maxNumUsersDispatched, _processor._config.SweepScheduleWindow);
+
+	// Updates of users are ordered with those of new scores, which are written through the master connection,
+	// such that a fenced user's update is executed ahead of theirs.
+	_isFencing = _processor._isServing;
+	_unflushedUserIds.resize(numThreads);
+
+	_workerDBs.resize(_executor.NumThreads());
+	_workerDBSlaves.resize(_executor.NumThreads());
+
+	// Batches are written by the shared writer. Distinct ordering keys let them spread across its connections.
+	for (u32 i = 0; i < numThreads; ++i)
+	{
+		_newUsersBatches.emplace_back(_processor._pWriteQueue, _isFencing ? _processor._pDB->OrderingKey() : i, 10000);
+		_newScoresBatches.emplace_back(_processor._pWriteQueue, i, 10000);
+	}
+
+	if (_isFencing)
+	{
+		std::lock_guard<std::mutex> lock{_processor._activeSweepMutex};
+		_processor._pActiveSweep = this;
+	}
+}
+
+Processor::UserSweep::~UserSweep()
+{
+	if (_isFencing)
+	{
+		std::lock_guard<std::mutex> lock{_processor._activeSweepMutex};
+		_processor._pActiveSweep = nullptr;
+	}
+}
+
+void Processor::UserSweep::FenceUser(s64 userId)
+{
+	u32 batchIdx;
+	{
+		std::lock_guard<std::mutex> lock{_fenceMutex};
+
+		auto fencedIt = _isUserFenced.find(userId);
+		if (fencedIt != std::end(_isUserFenced))
+			fencedIt->second = true;
+
+		auto batchIt = _unflushedUserBatches.find(userId);
+		if (batchIt == std::end(_unflushedUserBatches))
+			return;
+
+		batchIdx = batchIt->second;
+	}
+
+	// Our update must not wait behind bulk writes either, or it would hold up the caller's
+	flushUsersBatch(batchIdx, EPriority::High);
+}
+
+void Processor::UserSweep::Enqueue(s64 userId)
+{
+	// New scores take precedence if they are monitored by the same process
+	_processor.yieldToNewScores();
+
+	// Fetching and computing more users is pointless while their updates can not be written.
+	_processor._pWriteQueue->Throttle();
+
+	// Cost varies by orders of magnitude between users. Starting expensive ones
+	// late would leave the other threads idle while they finish.
+	u64 cost = _processor._pUserStatsCache->EstimateCost(userId);
+
+	{
+		std::unique_lock<std::mutex> lock{_pendingMutex};
+		_pendingCondition.wait(lock, [this]() { return _numUsersPending < _maxNumUsersPending; });
+		++_numUsersPending;
+
+		u64 userIdx = _progress.Start(userId);
+		_nextWindow.push_back(ScheduledUser{cost, userId, userIdx});
+	}
+
+	dispatch();
+}
+
+void Processor::UserSweep::dispatch()
+{
+	while (true)
+	{
+		ScheduledUser user;
+		u32 batchIdx;
+
+		{
+			std::lock_guard<std::mutex> lock{_pendingMutex};
+			if (_numUsersDispatched >= _maxNumUsersDispatched)
+				return;
+
+			// Heavy users keep arriving, hence reordering across windows would postpone cheap users indefinitely
+			if (_schedule.empty())
+			{
+				for (const auto& nextUser : _nextWindow)
+					_schedule.push(nextUser);
+
+				_nextWindow.clear();
+			}
+
+			if (_schedule.empty())
+				return;
+
+			user = _schedule.top();
+			_schedule.pop();
+			++_numUsersDispatched;
+
+			batchIdx = _currentBatch;
+			_currentBatch = (_currentBatch + 1) % _numThreads;
+		}
+
+		if (_pAsyncDBSlave)
+			launchAsync(user, batchIdx);
+		else
+			launch(user, batchIdx);
+	}
+}
+
+void Processor::UserSweep::launch(const ScheduledUser& user, u32 batchIdx)
+{
+	s64 userId = user.UserId;
+	u64 userIdx = user.UserIdx;
+
+	// Sweeps are throughput-oriented and yield to latency-sensitive work
+	_executor.Submit(
+		[this, userId, userIdx, batchIdx]()
+		{
+			try
+			{
+				auto dbSlave = _pDBSlavePool->Checkout();
+
+				beginUser(userId);
+				_processor.processSingleUser(
+					0, // We want to update _all_ scores
+					workerDB(),
+					*dbSlave,
+					_newUsersBatches[batchIdx],
+					_newScoresBatches[batchIdx],
+					userId,
+					[this, userId, batchIdx]() { return mayWriteUser(userId, batchIdx); }
+				);
+			}
+			catch (...)
+			{
+				finishUser(userIdx, false);
+				throw;
+			}
+
+			++_numUsersProcessed;
+			finishUser(userIdx, true);
+		},
+		EPriority::Low
+	);
+}
+
+void Processor::UserSweep::launchAsync(const ScheduledUser& user, u32 batchIdx)
+{
+	s64 userId = user.UserId;
+	u64 userIdx = user.UserIdx;
+
+	beginUser(userId);
+	_pAsyncDBSlave->Query(
+		_processor.userScoresQuery(userId),
+		[this, userId, userIdx, batchIdx](QueryResult& result)
+		{
+			// The event loop must not be blocked by computation, hence we hand the result over to the thread pool.
+			auto pScores = std::make_shared<QueryResult>(std::move(result));
+
+			_executor.Submit([this, userId, userIdx, batchIdx, pScores]()
+			{
+				try
+				{
+					_processor.processSingleUser(
+						0, // We want to update _all_ scores
+						*pScores,
+						workerDB(),
+						workerDBSlave(),
+						_newUsersBatches[batchIdx],
+						_newScoresBatches[batchIdx],
+						userId,
+						[this, userId, batchIdx]() { return mayWriteUser(userId, batchIdx); }
+					);
+				}
+				catch (...)
+				{
+					finishUser(userIdx, false);
+					throw;
+				}
+
+				++_numUsersProcessed;
+				finishUser(userIdx, true);
+			}, EPriority::Low);
+		},
+		[this, userIdx]() { finishUser(userIdx, false); }
+	);
+}
+
+DatabaseConnection& Processor::UserSweep::workerDB()
+{
+	auto& pDB = _workerDBs.at(_executor.CurrentWorkerIdx());
+	if (!pDB)
+		pDB = _processor.newDBConnectionMaster();
+
+	return *pDB;
+}
+
+DatabaseConnection& Processor::UserSweep::workerDBSlave()
+{
+	auto& pDBSlave = _workerDBSlaves.at(_executor.CurrentWorkerIdx());
+	if (!pDBSlave)
+		pDBSlave = _processor.newDBConnectionSlave();
+
+	return *pDBSlave;
+}
+
+void Processor::UserSweep::finishUser(u64 userIdx, bool isSuccessful)
+{
+	if (!isSuccessful)
+		++_numUsersFailed;
+
+	s64 userId;
+	{
+		std::lock_guard<std::mutex> lock{_pendingMutex};
+		--_numUsersPending;
+		--_numUsersDispatched;
+
+		userId = isSuccessful ? _progress.Finish(userIdx) : _progress.Fail(userIdx);
+	}
+
+	if (_isFencing)
+	{
+		std::lock_guard<std::mutex> lock{_fenceMutex};
+		_isUserFenced.erase(userId);
+	}
+
+	_pendingCondition.notify_all();
+
+	// Make room for the next scheduled user
+	dispatch();
+}
+
+void Processor::UserSweep::beginUser(s64 userId)
+{
+	if (!_isFencing)
+		return;
+
+	std::lock_guard<std::mutex> lock{_fenceMutex};
+	_isUserFenced[userId] = false;
+}
+
+bool Processor::UserSweep::mayWriteUser(s64 userId, u32 batchIdx)
+{
+	if (!_isFencing)
+		return true;
+
+	std::lock_guard<std::mutex> lock{_fenceMutex};
+	if (_isUserFenced[userId])
+		return false;
+
+	// Until flushed, the update may still be overtaken by the fencing one
+	if (_unflushedUserBatches.emplace(userId, batchIdx).second)
+		_unflushedUserIds[batchIdx].emplace_back(userId);
+
+	return true;
+}
+
+s64 Processor::UserSweep::Checkpoint()
+{
+	s64 lastFinishedUserId;
+	{
+		std::lock_guard<std::mutex> lock{_pendingMutex};
+		lastFinishedUserId = _progress.LastFinishedId();
+	}
+
+	// Updates of users finished before this point are sitting in the batches at the latest
+	flushBatches();
+
+	// Only executed updates count, even if they are journaled. A journaled write which keeps failing
+	// is eventually set aside, and the checkpoint must not have skipped its user by then.
+	auto pLastWrittenUserId = _pLastWrittenUserId;
+	_processor._pWriteQueue->Fence([pLastWrittenUserId, lastFinishedUserId]()
+	{
+		if (lastFinishedUserId > *pLastWrittenUserId)
+			*pLastWrittenUserId = lastFinishedUserId;
+	});
+
+	// Fences pass failed writes as well. Failures are recorded before any fence passes them, hence
+	// checking afterwards ensures that the checkpoint never skips over a failed write.
+	s64 lastWrittenUserId = *_pLastWrittenUserId;
+	_processor._pWriteQueue->ThrowIfFailed();
+
+	return lastWrittenUserId;
+}
+
+void Processor::UserSweep::ResetCheckpoint()
+{
+	std::lock_guard<std::mutex> lock{_pendingMutex};
+	_progress.ResetLastFinishedId();
+
+	// Fences of earlier checkpoints may still pass, hence they keep their own
+	_pLastWrittenUserId = std::make_shared<std::atomic<s64>>(-1);
+}
+
+void Processor::UserSweep::flushBatches()
+{
+	for (u32 i = 0; i < _newUsersBatches.size(); ++i)
+		flushUsersBatch(i, EPriority::Low);
+
+	for (auto& batch : _newScoresBatches)
+		batch.Flush();
+}
+
+void Processor::UserSweep::flushUsersBatch(u32 batchIdx, EPriority priority)
+{
+	// Users committed to the batch in the meantime must stay tracked, hence the batch is locked throughout
+	std::lock_guard<std::mutex> batchLock{_newUsersBatches[batchIdx].Mutex()};
+	_newUsersBatches[batchIdx].FlushNonThreadsafe(priority);
+
+	if (!_isFencing)
+		return;
+
+	std::lock_guard<std::mutex> lock{_fenceMutex};
+
+	auto& userIds = _unflushedUserIds[batchIdx];
+	for (s64 userId : userIds)
+		_unflushedUserBatches.erase(userId);
+
+	userIds.clear();
+}
+
+void Processor::UserSweep::WaitUntilFinished(const std::function<void()>& onProgress)
+{
+	{
+		// Completion is signalled. We only wake up periodically to report progress.
+		std::unique_lock<std::mutex> lock{_pendingMutex};
+		while (!_pendingCondition.wait_for(lock, milliseconds{100}, [this]() { return _numUsersPending == 0; }))
+		{
+			lock.unlock();
+
+			onProgress();
+			_processor.reportWriteQueueDepth("background");
+			_processor.reportExecutorDepth(_executor);
+
+			lock.lock();
+		}
+	}
+
+	onProgress();
+
+	flushBatches();
+
+	// Journaled writes survive crashes, hence there is no need to wait for the database
+	if (!_processor._pWriteQueue->IsJournaled())
+		_processor._pWriteQueue->WaitUntilEmpty();
+}
+
+PP_NAMESPACE_END
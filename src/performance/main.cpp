@@ -1,5 +1,6 @@
 ﻿#include <pp/Common.h>
 #include <pp/performance/Processor.h>
+#include <pp/performance/SnapshotProcessor.h>
 
 #include <args.hxx>
 
@@ -45,6 +46,28 @@ int main(s32 argc, char* argv[])
 			"config.json",
 		};
 
+		args::ValueFlag<std::string> outputFlag{
+			argumentsGroup,
+			"OUTPUT",
+			"Write computed pp to the given file instead of the database. Used by 'all', 'sql', 'users', 'scores', and 'offline'.\n"
+			"Files ending in '.csv' are written as CSV, others in a compact columnar format.",
+			{"output"},
+		};
+
+		args::Flag differencesFlag{
+			argumentsGroup,
+			"DIFFERENCES",
+			"Summarize how the pp written to the output differ from the stored ones.",
+			{"differences"},
+		};
+
+		// Exports leave the database untouched
+		auto exportIfRequested = [&](Processor& processor)
+		{
+			if (!args::get(outputFlag).empty())
+				processor.ExportTo(args::get(outputFlag), differencesFlag);
+		};
+
 		args::HelpFlag helpFlag{
 			argumentsGroup,
 			"HELP",
@@ -79,12 +102,35 @@ int main(s32 argc, char* argv[])
 				1,
 			};
 
+			args::Flag outdatedFlag{
+				parser,
+				"OUTDATED",
+				"Only compute users with scores on beatmaps whose difficulty changed since the last complete run. "
+				"Everybody is computed if the formula changed.",
+				{'o', "outdated"},
+			};
+
+			args::Flag workerFlag{
+				parser,
+				"WORKER",
+				"Share the computation with other processes which were given this flag. "
+				"Joins the run in progress, if any.",
+				{'w', "worker"},
+			};
+
 			parser.Parse();
 
 			u32 numThreads = args::get(threadsFlag);
 
 			Processor processor{ToGamemode(args::get(modePositional)), args::get(configFlag)};
-			processor.ProcessAllUsers(!continueFlag, numThreads);
+			exportIfRequested(processor);
+
+			if (workerFlag)
+				processor.ProcessAllUsersDistributed(!continueFlag, numThreads);
+			else
+				processor.ProcessAllUsers(!continueFlag, numThreads, outdatedFlag);
+
+			processor.FinishExport();
 		});
 
 		args::Command sqlCommand(commands, "sql", "Compute pp of users given by a SQL select statement", [&](args::Subparser &parser) {
@@ -110,7 +156,44 @@ int main(s32 argc, char* argv[])
 			u32 numThreads = args::get(threadsFlag);
 
 			Processor processor{ToGamemode(args::get(modePositional)), args::get(configFlag)};
+			exportIfRequested(processor);
+
 			processor.ProcessSQL(numThreads, sqlString);
+			processor.FinishExport();
+		});
+
+		args::Command serveCommand(commands, "serve", "Continually poll for new scores while recomputing all users in the background", [&](args::Subparser& parser)
+		{
+			args::ValueFlag<u32> threadsFlag{
+				parser,
+				"THREADS",
+				"Number of threads to use for the background recomputation.\n"
+				"Default: 1",
+				{'t', "threads"},
+				1,
+			};
+
+			parser.Parse();
+
+			Processor processor{ToGamemode(args::get(modePositional)), args::get(configFlag)};
+			processor.Serve(args::get(threadsFlag));
+		});
+
+		args::Command rpcCommand(commands, "rpc", "Answer requests for pp over a local socket, keeping beatmaps in memory", [&](args::Subparser& parser)
+		{
+			args::ValueFlag<u32> threadsFlag{
+				parser,
+				"THREADS",
+				"Number of threads answering requests.\n"
+				"Default: 4",
+				{'t', "threads"},
+				4,
+			};
+
+			parser.Parse();
+
+			Processor processor{ToGamemode(args::get(modePositional)), args::get(configFlag)};
+			processor.ServeRPC(args::get(threadsFlag));
 		});
 
 		args::Command usersCommand(commands, "users", "Compute pp of specific users", [&](args::Subparser &parser) {
@@ -123,7 +206,10 @@ int main(s32 argc, char* argv[])
 			parser.Parse();
 
 			Processor processor{ToGamemode(args::get(modePositional)), args::get(configFlag)};
+			exportIfRequested(processor);
+
 			processor.ProcessUsers(args::get(usersPositional));
+			processor.FinishExport();
 		});
 
 		args::Command scoresCommand(commands, "scores", "Compute pp of specific scores", [&](args::Subparser& parser)
@@ -137,7 +223,93 @@ int main(s32 argc, char* argv[])
 			parser.Parse();
 
 			Processor processor{ToGamemode(args::get(modePositional)), args::get(configFlag)};
+			exportIfRequested(processor);
+
 			processor.ProcessScores(args::get(scoresPositional));
+			processor.FinishExport();
+		});
+
+		args::Command beatmapsCommand(commands, "beatmaps", "Compute pp of all scores on specific beatmaps and of their players", [&](args::Subparser& parser)
+		{
+			args::PositionalList<s32> beatmapsPositional{
+				parser,
+				"beatmaps",
+				"Beatmap IDs to recompute pp for.",
+			};
+
+			args::ValueFlag<u32> threadsFlag{
+				parser,
+				"THREADS",
+				"Number of threads to use for recomputing the affected users.\n"
+				"Default: 1",
+				{'t', "threads"},
+				1,
+			};
+
+			parser.Parse();
+
+			Processor processor{ToGamemode(args::get(modePositional)), args::get(configFlag)};
+			processor.ProcessBeatmaps(args::get(beatmapsPositional), args::get(threadsFlag));
+		});
+
+		args::Command snapshotCommand(commands, "snapshot", "Convert table dumps into a snapshot for the 'offline' command", [&](args::Subparser& parser)
+		{
+			args::Positional<std::string> dumpsPositional{
+				parser,
+				"dumps",
+				"Directory holding the table dumps written by scripts/dump_sample_tables.sh.",
+			};
+
+			args::Positional<std::string> snapshotPositional{
+				parser,
+				"snapshot",
+				"The snapshot file to write.",
+			};
+
+			args::ValueFlag<std::string> ppColumnFlag{
+				parser,
+				"PP_COLUMN",
+				"The column of osu_user_stats holding the pp of users.\n"
+				"Default: 'rank_score'",
+				{"pp-column"},
+				"rank_score",
+			};
+
+			parser.Parse();
+
+			Snapshot::Convert(ToGamemode(args::get(modePositional)), args::get(dumpsPositional), args::get(ppColumnFlag), args::get(snapshotPositional));
+		});
+
+		args::Command offlineCommand(commands, "offline", "Compute pp of all users in a snapshot without any database", [&](args::Subparser& parser)
+		{
+			args::Positional<std::string> snapshotPositional{
+				parser,
+				"snapshot",
+				"The snapshot written by the 'snapshot' command.",
+			};
+
+			args::ValueFlag<u32> threadsFlag{
+				parser,
+				"THREADS",
+				"Number of threads to use.\n"
+				"Default: the number of hardware threads",
+				{'t', "threads"},
+				std::max(std::thread::hardware_concurrency(), 1u),
+			};
+
+			parser.Parse();
+
+			// The gamemode is that of the snapshot
+			SnapshotProcessor processor{args::get(snapshotPositional)};
+
+			std::unique_ptr<PPExport> pExport;
+			if (!args::get(outputFlag).empty())
+				pExport = std::make_unique<PPExport>(args::get(outputFlag), differencesFlag);
+
+			processor.ProcessAllUsers(args::get(threadsFlag), pExport.get());
+
+			if (pExport)
+				pExport->Finish();
 		});
 
 		args::GlobalOptions argumentsGlobal{parser, argumentsGroup};
@@ -0,0 +1,673 @@
+#include <pp/Common.h>
+#include <pp/shared/AsyncDatabase.h>
+#include <pp/shared/DatabaseConnection.h>
+#include <pp/shared/QueryBuilder.h>
+
+#include <cstring>
+#include <limits>
+
+#include <mysql.h>
+
+#ifdef PP_MYSQL_NONBLOCKING
+	#ifdef _WIN32
+		#include <winsock2.h>
+		#define poll WSAPoll
+	#else
+		#include <fcntl.h>
+		#include <poll.h>
+		#include <unistd.h>
+	#endif
+#endif
+
+using namespace std::chrono;
+
+PP_NAMESPACE_BEGIN
+
+namespace
+{
+	const std::string s_skippedError = "Skipped, since an earlier statement failed.";
+}
+
+AsyncDatabase::AsyncDatabase(
+	std::string host,
+	s32 port,
+	std::string username,
+	std::string password,
+	std::string database,
+	u32 numConnections
+) : _host{std::move(host)}, _port{port}, _username{std::move(username)}, _password{std::move(password)}, _database{std::move(database)}
+{
+	if (numConnections == 0)
+		throw DatabaseException(SRC_POS, "Asynchronous database requires at least one connection.");
+
+	for (u32 i = 0; i < numConnections; ++i)
+	{
+		_connections.emplace_back(std::make_unique<Connection>());
+		auto& connection = *_connections.back();
+
+#ifdef PP_MYSQL_NONBLOCKING
+		if (!mysql_init(&connection.MySQL))
+			throw DatabaseException(SRC_POS, "MySQL struct could not be initialized.");
+
+		mysql_options(&connection.MySQL, MYSQL_OPT_NONBLOCK, 0);
+
+		// Connecting happens only once, hence we do not bother doing it asynchronously.
+		if (!mysql_real_connect(&connection.MySQL, _host.c_str(), _username.c_str(), _password.c_str(), _database.c_str(), _port, nullptr, CLIENT_MULTI_STATEMENTS))
+			throw DatabaseException(SRC_POS, StrFormat("Could not connect. ({0})", mysql_error(&connection.MySQL)));
+#else
+		connection.pDB = std::make_unique<DatabaseConnection>(_host, _port, _username, _password, _database);
+		connection.Thread = std::thread{&AsyncDatabase::runConnection, this, std::ref(connection)};
+#endif
+	}
+
+#ifdef PP_MYSQL_NONBLOCKING
+#ifdef _WIN32
+	// Windows can not poll pipes, hence the event loop is woken up through a UDP socket sending to itself.
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+		throw DatabaseException(SRC_POS, "Could not initialize winsock.");
+
+	_wakeSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (_wakeSocket == INVALID_SOCKET)
+		throw DatabaseException(SRC_POS, "Could not create wake-up socket.");
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	s32 addressLength = sizeof(address);
+	if (bind(_wakeSocket, (sockaddr*)&address, sizeof(address)) != 0 ||
+		getsockname(_wakeSocket, (sockaddr*)&address, &addressLength) != 0 ||
+		connect(_wakeSocket, (sockaddr*)&address, sizeof(address)) != 0)
+		throw DatabaseException(SRC_POS, "Could not bind wake-up socket.");
+
+	u_long isNonBlocking = 1;
+	ioctlsocket(_wakeSocket, FIONBIO, &isNonBlocking);
+#else
+	if (pipe(_wakePipe) != 0)
+		throw DatabaseException(SRC_POS, "Could not create wake-up pipe.");
+
+	for (s32 fd : _wakePipe)
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	_eventLoopThread = std::thread{&AsyncDatabase::runEventLoop, this};
+#endif
+}
+
+AsyncDatabase::~AsyncDatabase()
+{
+	{
+		std::lock_guard<std::mutex> lock{_mutex};
+		_shallShutdown = true;
+	}
+
+	_requestCondition.notify_all();
+
+#ifdef PP_MYSQL_NONBLOCKING
+	wake();
+	if (_eventLoopThread.joinable())
+		_eventLoopThread.join();
+
+	for (auto& pConnection : _connections)
+		mysql_close(&pConnection->MySQL);
+
+#ifdef _WIN32
+	if (_wakeSocket != INVALID_SOCKET)
+		closesocket(_wakeSocket);
+
+	WSACleanup();
+#else
+	for (s32 fd : _wakePipe)
+		if (fd != -1)
+			close(fd);
+#endif
+#else
+	for (auto& pConnection : _connections)
+		if (pConnection->Thread.joinable())
+			pConnection->Thread.join();
+#endif
+}
+
+void AsyncDatabase::Query(std::string queryString, ResultCallback onResult, DoneCallback onError)
+{
+	size_t connectionIdx = 0;
+
+	{
+		// Pick the connection with the least amount of work
+		std::lock_guard<std::mutex> lock{_mutex};
+
+		size_t minLoad = std::numeric_limits<size_t>::max();
+		for (size_t i = 0; i < _connections.size(); ++i)
+		{
+			size_t load = _connections[i]->NumRequests() + (_connections[i]->IsBusy ? 1 : 0);
+			if (load < minLoad)
+			{
+				minLoad = load;
+				connectionIdx = i;
+			}
+		}
+	}
+
+	submit(connectionIdx, EPriority::Low, Request{std::move(queryString), 0, std::move(onResult), nullptr, std::move(onError)});
+}
+
+void AsyncDatabase::NonQuery(std::string queryString, u64 orderingKey, EPriority priority, DoneCallback onDone, DoneCallback onError)
+{
+	submit(orderingKey % _connections.size(), priority, Request{std::move(queryString), orderingKey, nullptr, std::move(onDone), std::move(onError)});
+}
+
+void AsyncDatabase::ThrowIfFailed()
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+	if (!_error.empty())
+		throw DatabaseException(SRC_POS, StrFormat("Background statement failed. ({0})", _error));
+}
+
+void AsyncDatabase::WaitUntilIdle()
+{
+	{
+		std::unique_lock<std::mutex> lock{_mutex};
+		_idleCondition.wait(lock, [this]() { return _numPending == 0; });
+	}
+
+	ThrowIfFailed();
+}
+
+void AsyncDatabase::submit(size_t connectionIdx, EPriority priority, Request&& request)
+{
+	{
+		std::lock_guard<std::mutex> lock{_mutex};
+
+		if (_shallShutdown)
+			throw DatabaseException(SRC_POS, "Asynchronous database is shutting down.");
+
+		if (!_error.empty())
+			throw DatabaseException(SRC_POS, StrFormat("Background statement failed. ({0})", _error));
+
+		++_numPending;
+		_connections[connectionIdx]->PushRequest(priority, std::move(request));
+	}
+
+#ifdef PP_MYSQL_NONBLOCKING
+	wake();
+#else
+	_requestCondition.notify_all();
+#endif
+}
+
+void AsyncDatabase::complete(Request& request, QueryResult* pResult, const std::string& error)
+{
+	// Failed queries are handled by their callbacks. Failed statements are recorded before theirs run,
+	// such that whoever is notified of the failure by them also sees it when calling ThrowIfFailed.
+	if (!error.empty() && !request.OnResult)
+	{
+		std::lock_guard<std::mutex> lock{_mutex};
+		if (_error.empty())
+			_error = error;
+	}
+
+	std::string callbackError;
+
+	try
+	{
+		if (!error.empty())
+		{
+			if (request.OnError)
+				request.OnError();
+		}
+		else if (pResult)
+			request.OnResult(*pResult);
+		else if (request.OnDone)
+			request.OnDone();
+	}
+	catch (const Exception& e)
+	{
+		e.Log();
+		callbackError = e.Description();
+	}
+	catch (const std::exception& e)
+	{
+		tlog::error() << StrFormat("Uncaught exception in database callback: {0}", e.what());
+		callbackError = e.what();
+	}
+
+	QueryBuilder::Recycle(std::move(request.QueryString));
+
+	{
+		std::lock_guard<std::mutex> lock{_mutex};
+
+		if (_error.empty())
+			_error = callbackError;
+
+		--_numPending;
+	}
+
+	_idleCondition.notify_all();
+}
+
+bool AsyncDatabase::isSkippedNonThreadsafe(const Request& request) const
+{
+	return !_error.empty() && !request.OnResult;
+}
+
+bool AsyncDatabase::Connection::HasRequests() const
+{
+	for (const auto& requests : Requests)
+		if (!requests.empty())
+			return true;
+
+	return false;
+}
+
+size_t AsyncDatabase::Connection::NumRequests() const
+{
+	size_t numRequests = 0;
+	for (const auto& requests : Requests)
+		numRequests += requests.size();
+
+	return numRequests;
+}
+
+void AsyncDatabase::Connection::PushRequest(EPriority priority, Request&& request)
+{
+	auto& lowRequests = Requests[(size_t)EPriority::Low];
+
+	// Queries are not ordered
+	if (request.OnResult)
+	{
+		Requests[(size_t)priority].emplace_back(std::move(request));
+		return;
+	}
+
+	if (priority == EPriority::Low)
+	{
+		++NumLowStatements[request.OrderingKey];
+		lowRequests.emplace_back(std::move(request));
+		return;
+	}
+
+	// Earlier statements of the same ordering key are promoted, such that they still execute first
+	auto it = NumLowStatements.find(request.OrderingKey);
+	if (it != std::end(NumLowStatements))
+	{
+		NumLowStatements.erase(it);
+
+		std::deque<Request> remainingRequests;
+		for (auto& lowRequest : lowRequests)
+		{
+			if (!lowRequest.OnResult && lowRequest.OrderingKey == request.OrderingKey)
+				Requests[(size_t)EPriority::High].emplace_back(std::move(lowRequest));
+			else
+				remainingRequests.emplace_back(std::move(lowRequest));
+		}
+
+		lowRequests = std::move(remainingRequests);
+	}
+
+	Requests[(size_t)EPriority::High].emplace_back(std::move(request));
+}
+
+AsyncDatabase::Request AsyncDatabase::Connection::PopRequest()
+{
+	// Priorities are ordered from high to low
+	for (size_t i = 0; i < s_numPriorities; ++i)
+	{
+		auto& requests = Requests[i];
+		if (requests.empty())
+			continue;
+
+		Request request = std::move(requests.front());
+		requests.pop_front();
+
+		if (i == (size_t)EPriority::Low && !request.OnResult)
+		{
+			auto it = NumLowStatements.find(request.OrderingKey);
+			if (--it->second == 0)
+				NumLowStatements.erase(it);
+		}
+
+		return request;
+	}
+
+	throw DatabaseException(SRC_POS, "No request to pop.");
+}
+
+#ifdef PP_MYSQL_NONBLOCKING
+
+void AsyncDatabase::runEventLoop()
+{
+	std::vector<pollfd> pollFds;
+	std::vector<Connection*> polledConnections;
+
+	std::vector<Request> skipped;
+
+	while (true)
+	{
+		{
+			std::lock_guard<std::mutex> lock{_mutex};
+
+			if (_shallShutdown && _numPending == 0)
+				break;
+
+			for (auto& pConnection : _connections)
+			{
+				while (!pConnection->IsBusy && pConnection->HasRequests())
+				{
+					Request request = pConnection->PopRequest();
+					if (isSkippedNonThreadsafe(request))
+					{
+						skipped.emplace_back(std::move(request));
+						continue;
+					}
+
+					pConnection->Current = std::move(request);
+
+					pConnection->IsBusy = true;
+					pConnection->IsWaiting = false;
+					pConnection->Phase = EPhase::Querying;
+				}
+			}
+		}
+
+		for (auto& request : skipped)
+			complete(request, nullptr, s_skippedError);
+
+		skipped.clear();
+
+		for (auto& pConnection : _connections)
+			if (pConnection->IsBusy && !pConnection->IsWaiting)
+				advance(*pConnection, 0);
+
+		pollFds.clear();
+		polledConnections.clear();
+
+		auto now = steady_clock::now();
+
+		// Idle connections leave only the wake-up signal to wait for
+		s32 timeoutMs = 100;
+#ifdef _WIN32
+		pollFds.push_back(pollfd{_wakeSocket, POLLIN, 0});
+#else
+		pollFds.push_back(pollfd{_wakePipe[0], POLLIN, 0});
+#endif
+		polledConnections.push_back(nullptr);
+
+		for (auto& pConnection : _connections)
+		{
+			if (!pConnection->IsBusy || !pConnection->IsWaiting)
+				continue;
+
+			short events = 0;
+			if (pConnection->WaitStatus & MYSQL_WAIT_READ)
+				events |= POLLIN;
+			if (pConnection->WaitStatus & MYSQL_WAIT_WRITE)
+				events |= POLLOUT;
+			if (pConnection->WaitStatus & MYSQL_WAIT_EXCEPT)
+				events |= POLLPRI;
+
+			if (pConnection->WaitStatus & MYSQL_WAIT_TIMEOUT)
+			{
+				auto remaining = duration_cast<milliseconds>(pConnection->Deadline - now).count();
+				timeoutMs = std::max(0, std::min(timeoutMs, (s32)remaining));
+			}
+
+			pollFds.push_back(pollfd{mysql_get_socket(&pConnection->MySQL), events, 0});
+			polledConnections.push_back(pConnection.get());
+		}
+
+		if (poll(pollFds.data(), (u32)pollFds.size(), timeoutMs) < 0)
+			continue;
+
+		now = steady_clock::now();
+
+		for (size_t i = 0; i < pollFds.size(); ++i)
+		{
+			Connection* pConnection = polledConnections[i];
+			if (!pConnection)
+			{
+				// Drain the wake-up signals
+				char buffer[64];
+#ifdef _WIN32
+				while (recv(_wakeSocket, buffer, sizeof(buffer), 0) > 0) {}
+#else
+				while (read(_wakePipe[0], buffer, sizeof(buffer)) > 0) {}
+#endif
+				continue;
+			}
+
+			s32 readyStatus = 0;
+			if (pollFds[i].revents & POLLIN)
+				readyStatus |= MYSQL_WAIT_READ;
+			if (pollFds[i].revents & POLLOUT)
+				readyStatus |= MYSQL_WAIT_WRITE;
+			if (pollFds[i].revents & POLLPRI)
+				readyStatus |= MYSQL_WAIT_EXCEPT;
+			if (readyStatus == 0 && (pConnection->WaitStatus & MYSQL_WAIT_TIMEOUT) && now >= pConnection->Deadline)
+				readyStatus = MYSQL_WAIT_TIMEOUT;
+
+			// Errors and hangups are reported to the client library as readiness; it will notice the failure itself.
+			if (readyStatus == 0 && (pollFds[i].revents & (POLLERR | POLLHUP)))
+				readyStatus = pConnection->WaitStatus & (MYSQL_WAIT_READ | MYSQL_WAIT_WRITE);
+
+			if (readyStatus != 0)
+				advance(*pConnection, readyStatus);
+		}
+	}
+}
+
+void AsyncDatabase::advance(Connection& connection, s32 readyStatus)
+{
+	while (connection.IsBusy)
+	{
+		s32 waitStatus = connection.IsWaiting ? continuePhase(connection, readyStatus) : startPhase(connection);
+		if (waitStatus != 0)
+		{
+			connection.IsWaiting = true;
+			connection.WaitStatus = waitStatus;
+
+			if (waitStatus & MYSQL_WAIT_TIMEOUT)
+				connection.Deadline = steady_clock::now() + milliseconds{mysql_get_timeout_value_ms(&connection.MySQL)};
+
+			return;
+		}
+
+		connection.IsWaiting = false;
+		finishPhase(connection);
+	}
+}
+
+s32 AsyncDatabase::startPhase(Connection& connection)
+{
+	MYSQL* pMySQL = &connection.MySQL;
+	const std::string& queryString = connection.Current.QueryString;
+
+	switch (connection.Phase)
+	{
+	case EPhase::Querying:
+		return mysql_real_query_start(&connection.Status, pMySQL, queryString.c_str(), (unsigned long)queryString.size());
+	case EPhase::StoringResult:
+		return mysql_store_result_start(&connection.pResult, pMySQL);
+	case EPhase::NextResult:
+		return mysql_next_result_start(&connection.Status, pMySQL);
+	default:
+		throw DatabaseException(SRC_POS, "Unknown asynchronous query phase.");
+	}
+}
+
+s32 AsyncDatabase::continuePhase(Connection& connection, s32 readyStatus)
+{
+	MYSQL* pMySQL = &connection.MySQL;
+
+	switch (connection.Phase)
+	{
+	case EPhase::Querying:
+		return mysql_real_query_cont(&connection.Status, pMySQL, readyStatus);
+	case EPhase::StoringResult:
+		return mysql_store_result_cont(&connection.pResult, pMySQL, readyStatus);
+	case EPhase::NextResult:
+		return mysql_next_result_cont(&connection.Status, pMySQL, readyStatus);
+	default:
+		throw DatabaseException(SRC_POS, "Unknown asynchronous query phase.");
+	}
+}
+
+void AsyncDatabase::finishPhase(Connection& connection)
+{
+	MYSQL* pMySQL = &connection.MySQL;
+	bool isQuery = (bool)connection.Current.OnResult;
+
+	switch (connection.Phase)
+	{
+	case EPhase::Querying:
+		if (connection.Status != 0)
+		{
+			std::string error = StrFormat("Error executing query {0}. ({1})", connection.Current.QueryString, mysql_error(pMySQL));
+			tlog::error() << error;
+			finishRequest(connection, nullptr, error);
+			return;
+		}
+
+		connection.Phase = EPhase::StoringResult;
+		return;
+
+	case EPhase::StoringResult:
+	{
+		MYSQL_RES* pRes = connection.pResult;
+		connection.pResult = nullptr;
+
+		if (isQuery)
+		{
+			if (pRes == nullptr)
+			{
+				std::string error = StrFormat("Error getting result. ({0})", mysql_error(pMySQL));
+				tlog::error() << error;
+				finishRequest(connection, nullptr, error);
+				return;
+			}
+
+			QueryResult result{pRes};
+			finishRequest(connection, &result, "");
+			return;
+		}
+
+		if (pRes != nullptr)
+			mysql_free_result(pRes);
+		else if (mysql_field_count(pMySQL) != 0)
+		{
+			std::string error = StrFormat("Error getting result. ({0})", mysql_error(pMySQL));
+			tlog::error() << error;
+			finishRequest(connection, nullptr, error);
+			return;
+		}
+
+		connection.Phase = EPhase::NextResult;
+		return;
+	}
+
+	case EPhase::NextResult:
+		/* more results? -1 = no, >0 = error, 0 = yes (keep looping) */
+		if (connection.Status > 0)
+		{
+			std::string error = StrFormat("Error executing query {0}. ({1})", connection.Current.QueryString, mysql_error(pMySQL));
+			tlog::error() << error;
+			finishRequest(connection, nullptr, error);
+		}
+		else if (connection.Status == 0)
+			connection.Phase = EPhase::StoringResult;
+		else
+			finishRequest(connection, nullptr, "");
+
+		return;
+	}
+}
+
+void AsyncDatabase::finishRequest(Connection& connection, QueryResult* pResult, const std::string& error)
+{
+	Request request = std::move(connection.Current);
+
+	{
+		std::lock_guard<std::mutex> lock{_mutex};
+		connection.IsBusy = false;
+		connection.IsWaiting = false;
+	}
+
+	complete(request, pResult, error);
+}
+
+void AsyncDatabase::wake()
+{
+	char signal = 0;
+	// A full pipe or socket buffer already guarantees a wake-up, hence failures can be ignored.
+#ifdef _WIN32
+	if (send(_wakeSocket, &signal, 1, 0) < 0) {}
+#else
+	if (write(_wakePipe[1], &signal, 1) < 0) {}
+#endif
+}
+
+#else
+
+void AsyncDatabase::runConnection(Connection& connection)
+{
+	while (true)
+	{
+		Request request;
+		bool isSkipped;
+
+		{
+			std::unique_lock<std::mutex> lock{_mutex};
+			_requestCondition.wait(lock, [&]() { return _shallShutdown || connection.HasRequests(); });
+
+			if (!connection.HasRequests())
+				break;
+
+			request = connection.PopRequest();
+			isSkipped = isSkippedNonThreadsafe(request);
+			connection.IsBusy = !isSkipped;
+		}
+
+		if (isSkipped)
+		{
+			complete(request, nullptr, s_skippedError);
+			continue;
+		}
+
+		std::string error;
+
+		try
+		{
+			if (request.OnResult)
+			{
+				auto result = connection.pDB->Query(request.QueryString);
+
+				{
+					std::lock_guard<std::mutex> lock{_mutex};
+					connection.IsBusy = false;
+				}
+
+				complete(request, &result, "");
+				continue;
+			}
+
+			connection.pDB->NonQuery(request.QueryString);
+		}
+		catch (const DatabaseException& e)
+		{
+			// Already logged upon construction
+			error = e.Description();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock{_mutex};
+			connection.IsBusy = false;
+		}
+
+		complete(request, nullptr, error);
+	}
+}
+
+#endif
+
+PP_NAMESPACE_END
@@ -0,0 +1,136 @@
+#include <pp/Common.h>
+#include <pp/shared/ConnectionPool.h>
+
+#include <exception>
+
+using namespace std::chrono;
+
+PP_NAMESPACE_BEGIN
+
+const seconds ConnectionPool::s_healthCheckIdleTime{30};
+
+ConnectionPool::ConnectionPool(Factory factory, u32 size, bool isThreadAffine, WaitCallback onWait)
+: _factory{std::move(factory)}, _isThreadAffine{isThreadAffine}, _onWait{std::move(onWait)}, _numAvailable{size}
+{
+	if (size == 0)
+		throw DatabaseException(SRC_POS, "Connection pool requires at least one connection.");
+
+	_entries.resize(size);
+	for (auto& entry : _entries)
+	{
+		entry.pConnection = _factory();
+		entry.LastUsed = steady_clock::now();
+	}
+}
+
+ConnectionPool::Lease::Lease(ConnectionPool* pPool, size_t idx, std::shared_ptr<DatabaseConnection> pConnection)
+: _pPool{pPool}, _idx{idx}, _pConnection{std::move(pConnection)}
+{
+}
+
+ConnectionPool::Lease::Lease(Lease&& other)
+: _pPool{other._pPool}, _idx{other._idx}, _pConnection{std::move(other._pConnection)}
+{
+	other._pPool = nullptr;
+}
+
+ConnectionPool::Lease::~Lease()
+{
+	// A connection returned during stack unwinding may have been left in a broken state.
+	if (_pPool)
+		_pPool->giveBack(_idx, std::uncaught_exception());
+}
+
+ConnectionPool::Lease ConnectionPool::Checkout()
+{
+	auto startTime = steady_clock::now();
+
+	size_t idx;
+	bool needsHealthCheck;
+
+	{
+		std::unique_lock<std::mutex> lock{_mutex};
+		_availableCondition.wait(lock, [this]() { return _numAvailable > 0; });
+
+		idx = takeAvailableEntry();
+
+		auto& entry = _entries[idx];
+		needsHealthCheck = entry.NeedsHealthCheck || startTime - entry.LastUsed > s_healthCheckIdleTime;
+	}
+
+	if (_onWait)
+		_onWait(duration_cast<microseconds>(steady_clock::now() - startTime));
+
+	auto& entry = _entries[idx];
+
+	// Only the holder of the lease touches the entry's connection, hence no lock is required.
+	if (needsHealthCheck && !entry.pConnection->Ping())
+	{
+		tlog::warning() << "Pooled database connection is broken. Reconnecting.";
+
+		try
+		{
+			entry.pConnection = _factory();
+		}
+		catch (...)
+		{
+			giveBack(idx, true);
+			throw;
+		}
+	}
+
+	entry.NeedsHealthCheck = false;
+	return Lease{this, idx, entry.pConnection};
+}
+
+u32 ConnectionPool::NumAvailable() const
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+	return _numAvailable;
+}
+
+size_t ConnectionPool::takeAvailableEntry()
+{
+	size_t idx = _entries.size();
+
+	if (_isThreadAffine)
+	{
+		auto affinityIt = _affinities.find(std::this_thread::get_id());
+		if (affinityIt != std::end(_affinities) && _entries[affinityIt->second].IsAvailable)
+			idx = affinityIt->second;
+	}
+
+	if (idx == _entries.size())
+	{
+		// Prefer the most recently used connection; it is the least likely to have timed out.
+		for (size_t i = 0; i < _entries.size(); ++i)
+			if (_entries[i].IsAvailable && (idx == _entries.size() || _entries[i].LastUsed > _entries[idx].LastUsed))
+				idx = i;
+
+		if (_isThreadAffine)
+			_affinities[std::this_thread::get_id()] = idx;
+	}
+
+	_entries[idx].IsAvailable = false;
+	--_numAvailable;
+
+	return idx;
+}
+
+void ConnectionPool::giveBack(size_t idx, bool needsHealthCheck)
+{
+	{
+		std::lock_guard<std::mutex> lock{_mutex};
+
+		auto& entry = _entries[idx];
+		entry.IsAvailable = true;
+		entry.NeedsHealthCheck = entry.NeedsHealthCheck || needsHealthCheck;
+		entry.LastUsed = steady_clock::now();
+
+		++_numAvailable;
+	}
+
+	_availableCondition.notify_one();
+}
+
+PP_NAMESPACE_END
@@ -1,17 +1,28 @@
 #include <pp/Common.h>
 #include <pp/shared/DatabaseConnection.h>
+#include <pp/shared/WriteQueue.h>
+
+#include <atomic>
 
 #include <mysql.h>
 
 PP_NAMESPACE_BEGIN
 
+namespace
+{
+	std::atomic<u64> s_nextOrderingKey{0};
+}
+
 DatabaseConnection::DatabaseConnection(
 	std::string host,
 	s32 port,
 	std::string username,
 	std::string password,
-	std::string database
-) : _host{std::move(host)}, _port{port}, _username{std::move(username)}, _password{std::move(password)}, _database{std::move(database)}
+	std::string database,
+	std::shared_ptr<WriteQueue> pWriteQueue
+) :
+_pWriteQueue{std::move(pWriteQueue)}, _orderingKey{s_nextOrderingKey++},
+_host{std::move(host)}, _port{port}, _username{std::move(username)}, _password{std::move(password)}, _database{std::move(database)}
 {
 	if (!mysql_init(&_mySQL))
 		throw DatabaseException(SRC_POS, StrFormat("MySQL struct could not be initialized. ({0})", Error()));
@@ -19,8 +30,6 @@ DatabaseConnection::DatabaseConnection(
 	_isInitialized = true;
 
 	connect();
-
-	_pActive = Active::Create();
 }
 
 DatabaseConnection::DatabaseConnection(DatabaseConnection&& other)
@@ -30,15 +39,8 @@ DatabaseConnection::DatabaseConnection(DatabaseConnection&& other)
 
 DatabaseConnection& DatabaseConnection::operator=(DatabaseConnection&& other)
 {
-	if (!other._pActive || other._pActive->IsBusy())
-	{
-		// Deconstruct the previous connection's active object
-		// to force background tasks to finish.
-		other._pActive = nullptr;
-		_pActive = Active::Create();
-	}
-	else
-		_pActive = std::move(other._pActive);
+	_pWriteQueue = std::move(other._pWriteQueue);
+	_orderingKey = other._orderingKey;
 
 	_host = std::move(other._host);
 	_port = other._port;
@@ -56,8 +58,6 @@ DatabaseConnection& DatabaseConnection::operator=(DatabaseConnection&& other)
 
 DatabaseConnection::~DatabaseConnection()
 {
-	// Destruct our active object before closing the mysql connection.
-	_pActive = nullptr;
 	if (_isInitialized)
 		mysql_close(&_mySQL);
 }
@@ -69,14 +69,18 @@ void DatabaseConnection::connect()
 		throw DatabaseException(SRC_POS, StrFormat("Could not connect. ({0})", Error()));
 }
 
-void DatabaseConnection::NonQueryBackground(const std::string& queryString)
+void DatabaseConnection::NonQueryBackground(const std::string& queryString, EPriority priority)
+{
+	NonQueryBackground(std::string{queryString}, priority);
+}
+
+void DatabaseConnection::NonQueryBackground(std::string&& queryString, EPriority priority)
 {
-	// We arbitrarily decide, that we don't want to have more than 1000 pending queries
-	while (NumPendingQueries() > 1000)
-		// Avoid to have the processor "spinning" at full power if there is no work to do in Update()
-		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	if (!_pWriteQueue)
+		throw DatabaseException(SRC_POS, "Connection has no write queue.");
 
-	_pActive->Send([=]() { NonQuery(queryString); });
+	// Blocks while the queue is full. The query's buffer is recycled once it was executed.
+	_pWriteQueue->Push(std::move(queryString), _orderingKey, priority);
 }
 
 void DatabaseConnection::NonQuery(const std::string& queryString)
@@ -133,4 +137,16 @@ u32 DatabaseConnection::AffectedRows()
 	return u32(mysql_affected_rows(&_mySQL));
 }
 
+bool DatabaseConnection::Ping()
+{
+	// We don't want concurrent queries
+	std::lock_guard<std::recursive_mutex> lock{_dbMutex};
+	return mysql_ping(&_mySQL) == 0;
+}
+
+size_t DatabaseConnection::NumPendingQueries() const
+{
+	return _pWriteQueue ? _pWriteQueue->NumStatements() : 0;
+}
+
 PP_NAMESPACE_END
@@ -0,0 +1,317 @@
+#include <pp/Common.h>
+#include <pp/shared/Executor.h>
+
+using namespace std::chrono;
+
+PP_NAMESPACE_BEGIN
+
+namespace
+{
+	// Identifies the executor and worker the current thread belongs to, if any
+	thread_local const void* s_pCurrentExecutor = nullptr;
+	thread_local size_t s_currentWorkerIdx = 0;
+}
+
+Task::Task(Task&& other)
+{
+	*this = std::move(other);
+}
+
+Task& Task::operator=(Task&& other)
+{
+	if (this == &other)
+		return *this;
+
+	reset();
+
+	if (other._pOps)
+	{
+		other._pOps->Move(&_storage, &other._storage);
+		_pOps = other._pOps;
+		other.reset();
+	}
+
+	return *this;
+}
+
+Task::~Task()
+{
+	reset();
+}
+
+void Task::reset()
+{
+	if (!_pOps)
+		return;
+
+	_pOps->Destroy(&_storage);
+	_pOps = nullptr;
+}
+
+Latch::Latch(u32 count)
+: _count{count}
+{
+}
+
+void Latch::Add(u32 count)
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+	_count += count;
+}
+
+bool Latch::CountDown(u32 count)
+{
+	// Notifying while locked, since waiters may destroy the latch as soon as they see it done
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	if (_count == 0)
+		return false;
+
+	_count -= std::min(count, _count);
+	if (_count != 0)
+		return false;
+
+	_doneCondition.notify_all();
+	return true;
+}
+
+bool Latch::IsDone() const
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+	return _count == 0;
+}
+
+void Latch::Wait()
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+	_doneCondition.wait(lock, [this]() { return _count == 0; });
+}
+
+bool Latch::WaitFor(microseconds duration)
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+	return _doneCondition.wait_for(lock, duration, [this]() { return _count == 0; });
+}
+
+Executor::Executor(u32 numThreads, u32 highPriorityWeight)
+: _highPriorityWeight{highPriorityWeight}
+{
+	for (auto& numQueued : _numQueued)
+		numQueued = 0;
+
+	numThreads = std::max(numThreads, 1u);
+
+	for (u32 i = 0; i < numThreads; ++i)
+		_workers.emplace_back(std::make_unique<Worker>());
+
+	// Only start threads once all workers exist, since they steal from each other
+	for (size_t i = 0; i < _workers.size(); ++i)
+		_workers[i]->Thread = std::thread{&Executor::run, this, i};
+}
+
+Executor::~Executor()
+{
+	{
+		std::lock_guard<std::mutex> lock{_sleepMutex};
+		_shallShutdown = true;
+	}
+
+	_sleepCondition.notify_all();
+
+	for (auto& pWorker : _workers)
+		pWorker->Thread.join();
+}
+
+void Executor::Submit(Task&& task, EPriority priority)
+{
+	push(std::move(task), priority);
+	wakeOne();
+}
+
+void Executor::Wait(Latch& latch)
+{
+	size_t workerIdx = CurrentWorkerIdx();
+	if (workerIdx == _workers.size())
+	{
+		latch.Wait();
+		return;
+	}
+
+	while (!latch.IsDone())
+	{
+		QueuedTask task;
+		if (tryAcquire(workerIdx, task))
+		{
+			execute(task);
+			continue;
+		}
+
+		// The remaining blocks are being run by others. Sleep until either they are done or more work arrives.
+		std::unique_lock<std::mutex> lock{_sleepMutex};
+		_sleepCondition.wait(lock, [this, &latch]() { return latch.IsDone() || hasQueued(); });
+	}
+}
+
+void Executor::SetStartCallback(TaskCallback onStart)
+{
+	_onStart = std::move(onStart);
+}
+
+void Executor::push(Task&& task, EPriority priority)
+{
+	// Tasks submitted from within a task stay with the submitting worker, such that related work
+	// runs on the same core. Everything else is spread across all workers.
+	size_t workerIdx = CurrentWorkerIdx();
+	if (workerIdx == _workers.size())
+		workerIdx = _nextWorkerIdx++ % _workers.size();
+
+	Worker& worker = *_workers[workerIdx];
+	{
+		std::lock_guard<std::mutex> lock{worker.Mutex};
+		worker.Tasks[(size_t)priority].emplace_back(QueuedTask{std::move(task), priority, steady_clock::now()});
+	}
+
+	++_numQueued[(size_t)priority];
+}
+
+void Executor::wakeOne()
+{
+	// Sleeping workers check for queued tasks while holding the mutex, so passing through
+	// it guarantees they either see the new task or receive the notification.
+	{
+		std::lock_guard<std::mutex> lock{_sleepMutex};
+	}
+
+	_sleepCondition.notify_one();
+}
+
+void Executor::wakeAll()
+{
+	{
+		std::lock_guard<std::mutex> lock{_sleepMutex};
+	}
+
+	_sleepCondition.notify_all();
+}
+
+bool Executor::hasQueued() const
+{
+	for (const auto& numQueued : _numQueued)
+		if (numQueued > 0)
+			return true;
+
+	return false;
+}
+
+bool Executor::tryAcquire(size_t workerIdx, QueuedTask& task)
+{
+	Worker& worker = *_workers[workerIdx];
+
+	bool isLowPriorityDue = _highPriorityWeight > 0 && worker.NumHighPriorityInARow >= _highPriorityWeight;
+	EPriority first = isLowPriorityDue ? EPriority::Low : EPriority::High;
+	EPriority second = isLowPriorityDue ? EPriority::High : EPriority::Low;
+
+	if (!tryAcquire(workerIdx, first, task) && !tryAcquire(workerIdx, second, task))
+		return false;
+
+	if (task.Priority == EPriority::High)
+		++worker.NumHighPriorityInARow;
+	else
+		worker.NumHighPriorityInARow = 0;
+
+	return true;
+}
+
+bool Executor::tryAcquire(size_t workerIdx, EPriority priority, QueuedTask& task)
+{
+	size_t priorityIdx = (size_t)priority;
+	if (_numQueued[priorityIdx] == 0)
+		return false;
+
+	// Own work is taken oldest first, such that tasks start in the order they were submitted. Callers such as
+	// the user sweep rely on this when submitting their most important work first.
+	{
+		Worker& worker = *_workers[workerIdx];
+		std::lock_guard<std::mutex> lock{worker.Mutex};
+
+		auto& tasks = worker.Tasks[priorityIdx];
+		if (!tasks.empty())
+		{
+			task = std::move(tasks.front());
+			tasks.pop_front();
+			--_numQueued[priorityIdx];
+			return true;
+		}
+	}
+
+	// Others' work is stolen from the opposite end, away from where its owner takes work
+	for (size_t i = 1; i < _workers.size(); ++i)
+	{
+		Worker& victim = *_workers[(workerIdx + i) % _workers.size()];
+		std::lock_guard<std::mutex> lock{victim.Mutex};
+
+		auto& tasks = victim.Tasks[priorityIdx];
+		if (!tasks.empty())
+		{
+			task = std::move(tasks.back());
+			tasks.pop_back();
+			--_numQueued[priorityIdx];
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void Executor::execute(QueuedTask& task)
+{
+	if (_onStart)
+		_onStart(task.Priority, duration_cast<microseconds>(steady_clock::now() - task.SubmitTime));
+
+	try
+	{
+		task.Work();
+	}
+	catch (const Exception& e)
+	{
+		e.Log();
+	}
+	catch (const std::exception& e)
+	{
+		tlog::error() << StrFormat("Uncaught exception in executor: {0}", e.what());
+	}
+	catch (...)
+	{
+		tlog::error() << "Uncaught unknown exception in executor.";
+	}
+}
+
+void Executor::run(size_t workerIdx)
+{
+	s_pCurrentExecutor = this;
+	s_currentWorkerIdx = workerIdx;
+
+	while (true)
+	{
+		QueuedTask task;
+		if (tryAcquire(workerIdx, task))
+		{
+			execute(task);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock{_sleepMutex};
+		_sleepCondition.wait(lock, [this]() { return _shallShutdown || hasQueued(); });
+
+		// Only shut down once everything was run
+		if (_shallShutdown && !hasQueued())
+			break;
+	}
+}
+
+size_t Executor::CurrentWorkerIdx() const
+{
+	return s_pCurrentExecutor == this ? s_currentWorkerIdx : _workers.size();
+}
+
+PP_NAMESPACE_END
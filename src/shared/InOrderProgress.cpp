@@ -0,0 +1,45 @@
+#include <pp/Common.h>
+#include <pp/shared/InOrderProgress.h>
+
+PP_NAMESPACE_BEGIN
+
+u64 InOrderProgress::Start(s64 id)
+{
+	_unfinishedIds.push_back(id);
+	_states.push_back(EState::Running);
+
+	return _firstUnfinishedIdx + _unfinishedIds.size() - 1;
+}
+
+s64 InOrderProgress::Finish(u64 idx)
+{
+	return end(idx, EState::Finished);
+}
+
+s64 InOrderProgress::Fail(u64 idx)
+{
+	return end(idx, EState::Failed);
+}
+
+s64 InOrderProgress::end(u64 idx, EState state)
+{
+	s64 id = _unfinishedIds[idx - _firstUnfinishedIdx];
+	_states[idx - _firstUnfinishedIdx] = state;
+
+	while (!_states.empty() && _states.front() != EState::Running)
+	{
+		// Later items are still dropped, but no longer count as progress
+		if (_states.front() == EState::Failed)
+			_hasFailed = true;
+		else if (!_hasFailed)
+			_lastFinishedId = _unfinishedIds.front();
+
+		_unfinishedIds.pop_front();
+		_states.pop_front();
+		++_firstUnfinishedIdx;
+	}
+
+	return id;
+}
+
+PP_NAMESPACE_END
@@ -0,0 +1,129 @@
+#include <pp/Common.h>
+#include <pp/shared/DatabaseConnection.h>
+#include <pp/shared/LeaseSet.h>
+
+PP_NAMESPACE_BEGIN
+
+LeaseSet::LeaseSet(std::shared_ptr<DatabaseConnection> pDB, std::string prefix)
+: _pDB{std::move(pDB)}, _prefix{std::move(prefix)}
+{
+}
+
+LeaseSet::~LeaseSet()
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	for (const auto& name : _held)
+	{
+		try
+		{
+			_pDB->Query(StrFormat("SELECT RELEASE_LOCK('{0}')", lockName(name)));
+		}
+		catch (const DatabaseException&)
+		{
+			// The lease ends with our connection anyways
+		}
+	}
+}
+
+bool LeaseSet::TryAcquire(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	// Locks are counted by the server. Acquiring one twice would require releasing it twice.
+	if (_held.count(name) > 0)
+		return true;
+
+	// A timeout of 0 fails right away if the lock is taken
+	auto res = _pDB->Query(StrFormat("SELECT GET_LOCK('{0}', 0)", lockName(name)));
+	if (!res.NextRow() || res.IsNull(0) || !(bool)res[0])
+		return false;
+
+	_held.insert(name);
+	return true;
+}
+
+void LeaseSet::Release(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	if (_held.erase(name) == 0)
+		return;
+
+	_pDB->Query(StrFormat("SELECT RELEASE_LOCK('{0}')", lockName(name)));
+}
+
+std::vector<std::string> LeaseSet::Verify()
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	std::vector<std::string> lost;
+	if (_held.empty())
+		return lost;
+
+	std::string query = "SELECT ";
+	for (const auto& name : _held)
+		query += StrFormat("IS_USED_LOCK('{0}')=CONNECTION_ID(),", lockName(name));
+
+	query.pop_back();
+
+	auto res = _pDB->Query(query);
+	if (!res.NextRow())
+		throw DatabaseException(SRC_POS, "Could not verify leases.");
+
+	size_t i = 0;
+	for (const auto& name : _held)
+	{
+		// Locks nobody holds yield null
+		if (res.IsNull(i) || !(bool)res[i])
+			lost.emplace_back(name);
+
+		++i;
+	}
+
+	for (const auto& name : lost)
+		_held.erase(name);
+
+	return lost;
+}
+
+std::vector<bool> LeaseSet::AreLeased(const std::vector<std::string>& names)
+{
+	std::vector<bool> areLeased;
+	if (names.empty())
+		return areLeased;
+
+	std::string query = "SELECT ";
+	for (const auto& name : names)
+		query += StrFormat("IS_FREE_LOCK('{0}'),", lockName(name));
+
+	query.pop_back();
+
+	auto res = _pDB->Query(query);
+	if (!res.NextRow())
+		throw DatabaseException(SRC_POS, "Could not query leases.");
+
+	for (size_t i = 0; i < names.size(); ++i)
+		areLeased.emplace_back(res.IsNull(i) || !(bool)res[i]);
+
+	return areLeased;
+}
+
+bool LeaseSet::IsHeld(const std::string& name) const
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+	return _held.count(name) > 0;
+}
+
+size_t LeaseSet::NumHeld() const
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+	return _held.size();
+}
+
+std::string LeaseSet::lockName(const std::string& name) const
+{
+	return StrFormat("{0}.{1}", _prefix, name);
+}
+
+PP_NAMESPACE_END
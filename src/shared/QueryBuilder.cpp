@@ -0,0 +1,228 @@
+#include <pp/Common.h>
+#include <pp/shared/QueryBuilder.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+PP_NAMESPACE_BEGIN
+
+namespace
+{
+	// Buffers beyond this amount are simply freed when recycled.
+	const size_t s_maxNumFreeBuffers = 64;
+
+	std::mutex s_freeBuffersMutex;
+	std::vector<std::string> s_freeBuffers;
+
+	const u64 s_powersOfTen[] = {
+		1ull,
+		10ull,
+		100ull,
+		1000ull,
+		10000ull,
+		100000ull,
+		1000000ull,
+		10000000ull,
+		100000000ull,
+		1000000000ull,
+	};
+
+	const u32 s_maxPrecision = sizeof(s_powersOfTen) / sizeof(s_powersOfTen[0]) - 1;
+}
+
+QueryBuilder::QueryBuilder(size_t capacity)
+: _capacity{capacity}, _buffer{acquire(capacity)}
+{
+}
+
+QueryBuilder::~QueryBuilder()
+{
+	Recycle(std::move(_buffer));
+}
+
+QueryBuilder::QueryBuilder(QueryBuilder&& other)
+: _capacity{other._capacity}, _buffer{std::move(other._buffer)}
+{
+}
+
+QueryBuilder& QueryBuilder::operator=(QueryBuilder&& other)
+{
+	Recycle(std::move(_buffer));
+
+	_capacity = other._capacity;
+	_buffer = std::move(other._buffer);
+
+	return *this;
+}
+
+QueryBuilder& QueryBuilder::Append(const char* str)
+{
+	_buffer.append(str, strlen(str));
+	return *this;
+}
+
+QueryBuilder& QueryBuilder::Append(const char* str, size_t size)
+{
+	_buffer.append(str, size);
+	return *this;
+}
+
+QueryBuilder& QueryBuilder::Append(const std::string& str)
+{
+	_buffer.append(str);
+	return *this;
+}
+
+QueryBuilder& QueryBuilder::Append(char c)
+{
+	_buffer.push_back(c);
+	return *this;
+}
+
+QueryBuilder& QueryBuilder::Append(s32 value)
+{
+	return Append((s64)value);
+}
+
+QueryBuilder& QueryBuilder::Append(u32 value)
+{
+	appendUnsigned(value);
+	return *this;
+}
+
+QueryBuilder& QueryBuilder::Append(s64 value)
+{
+	if (value < 0)
+	{
+		_buffer.push_back('-');
+		// Negate in unsigned arithmetic such that the smallest s64 does not overflow
+		appendUnsigned(0ull - (u64)value);
+	}
+	else
+		appendUnsigned((u64)value);
+
+	return *this;
+}
+
+QueryBuilder& QueryBuilder::Append(u64 value)
+{
+	appendUnsigned(value);
+	return *this;
+}
+
+QueryBuilder& QueryBuilder::AppendFixed(f64 value, u32 precision)
+{
+	// MySQL has no literal for NaN or infinity. Writing them would break the entire batch.
+	if (!std::isfinite(value))
+	{
+		_buffer.push_back('0');
+		return *this;
+	}
+
+	precision = std::min(precision, s_maxPrecision);
+
+	bool isNegative = value < 0;
+	f64 scaled = std::fabs(value) * (f64)s_powersOfTen[precision] + 0.5;
+
+	// Values which do not fit into 64 bits after scaling are rare enough to take the slow path.
+	if (scaled >= 1.8e19)
+	{
+		char buffer[512];
+		s32 length = snprintf(buffer, sizeof(buffer), "%.*f", (s32)precision, value);
+		if (length > 0)
+			_buffer.append(buffer, std::min((size_t)length, sizeof(buffer) - 1));
+
+		return *this;
+	}
+
+	u64 fixed = (u64)scaled;
+	if (fixed == 0)
+	{
+		_buffer.push_back('0');
+		return *this;
+	}
+
+	if (isNegative)
+		_buffer.push_back('-');
+
+	u64 fraction = fixed % s_powersOfTen[precision];
+	appendUnsigned(fixed / s_powersOfTen[precision]);
+
+	if (fraction == 0)
+		return *this;
+
+	// Strip trailing zeros
+	while (fraction % 10 == 0)
+	{
+		fraction /= 10;
+		--precision;
+	}
+
+	char digits[s_maxPrecision];
+	for (u32 i = precision; i > 0; --i)
+	{
+		digits[i - 1] = (char)('0' + fraction % 10);
+		fraction /= 10;
+	}
+
+	_buffer.push_back('.');
+	_buffer.append(digits, precision);
+
+	return *this;
+}
+
+std::string QueryBuilder::Release()
+{
+	std::string result = std::move(_buffer);
+	_buffer = acquire(_capacity);
+	return result;
+}
+
+void QueryBuilder::Recycle(std::string&& buffer)
+{
+	if (buffer.capacity() == 0)
+		return;
+
+	std::lock_guard<std::mutex> lock{s_freeBuffersMutex};
+	if (s_freeBuffers.size() < s_maxNumFreeBuffers)
+		s_freeBuffers.emplace_back(std::move(buffer));
+}
+
+std::string QueryBuilder::acquire(size_t capacity)
+{
+	std::string result;
+
+	{
+		std::lock_guard<std::mutex> lock{s_freeBuffersMutex};
+		if (!s_freeBuffers.empty())
+		{
+			result = std::move(s_freeBuffers.back());
+			s_freeBuffers.pop_back();
+		}
+	}
+
+	result.clear();
+	result.reserve(capacity);
+	return result;
+}
+
+void QueryBuilder::appendUnsigned(u64 value)
+{
+	char digits[20];
+	char* pEnd = digits + sizeof(digits);
+	char* pBegin = pEnd;
+
+	do
+	{
+		*--pBegin = (char)('0' + value % 10);
+		value /= 10;
+	}
+	while (value != 0);
+
+	_buffer.append(pBegin, pEnd);
+}
+
+PP_NAMESPACE_END
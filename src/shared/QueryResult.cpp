@@ -20,4 +20,13 @@ bool QueryResult::NextRow()
 	return ((_row = mysql_fetch_row(_pRes.get())) != nullptr);
 }
 
+void QueryResult::Rewind()
+{
+	if (!_pRes)
+		return;
+
+	mysql_data_seek(_pRes.get(), 0);
+	_row = nullptr;
+}
+
 PP_NAMESPACE_END
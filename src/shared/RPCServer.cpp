@@ -0,0 +1,401 @@
+#include <pp/Common.h>
+#include <pp/shared/RPCServer.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <poll.h>
+	#include <sys/socket.h>
+	#include <sys/un.h>
+	#include <unistd.h>
+#endif
+
+using namespace std::chrono;
+using json = nlohmann::json;
+
+PP_NAMESPACE_BEGIN
+
+const size_t RPCServer::s_maxLineSize = 64 * 1024 * 1024;
+const size_t RPCServer::s_maxNumUnsentBytes = 16 * 1024 * 1024;
+
+RPCServer::Connection::~Connection()
+{
+#ifndef _WIN32
+	if (Fd != -1)
+		close(Fd);
+#endif
+}
+
+RPCServer::RPCServer(std::string path, u32 numThreads)
+: _path{std::move(path)}, _executor{numThreads}
+{
+#ifdef _WIN32
+	throw RPCException(SRC_POS, "The RPC server is not supported on Windows.");
+#else
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+
+	if (_path.size() >= sizeof(address.sun_path))
+		throw RPCException(SRC_POS, StrFormat("RPC socket path '{0}' is too long.", _path));
+
+	strncpy(address.sun_path, _path.c_str(), sizeof(address.sun_path) - 1);
+
+	_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (_fd == -1)
+		throw RPCException(SRC_POS, "Could not create RPC socket.");
+
+	unlink(_path.c_str());
+	if (bind(_fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(_fd, SOMAXCONN) != 0)
+	{
+		close(_fd);
+		throw RPCException(SRC_POS, StrFormat("Could not listen at '{0}'. ({1})", _path, strerror(errno)));
+	}
+
+	if (pipe(_wakePipe) != 0)
+	{
+		close(_fd);
+		unlink(_path.c_str());
+		throw RPCException(SRC_POS, "Could not create wake-up pipe.");
+	}
+
+	for (s32 fd : _wakePipe)
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#endif
+}
+
+RPCServer::~RPCServer()
+{
+#ifndef _WIN32
+	if (_fd == -1)
+		return;
+
+	close(_fd);
+	unlink(_path.c_str());
+
+	for (s32 fd : _wakePipe)
+		close(fd);
+#endif
+}
+
+void RPCServer::Register(std::string method, Handler handler)
+{
+	_handlers[std::move(method)] = std::move(handler);
+}
+
+void RPCServer::SetLatencyCallback(LatencyCallback onLatency, milliseconds interval)
+{
+	_onLatency = std::move(onLatency);
+	_latencyInterval = interval;
+}
+
+void RPCServer::Run(const std::atomic<bool>& shallShutdown)
+{
+#ifndef _WIN32
+	std::vector<std::shared_ptr<Connection>> connections;
+	auto lastReportTime = steady_clock::now();
+
+	while (!shallShutdown)
+	{
+		std::vector<pollfd> pollFds;
+		pollFds.push_back(pollfd{_fd, POLLIN, 0});
+		pollFds.push_back(pollfd{_wakePipe[0], POLLIN, 0});
+		for (const auto& pConnection : connections)
+		{
+			std::lock_guard<std::mutex> lock{pConnection->Mutex};
+			size_t numUnsentBytes = pConnection->Unsent.size() - pConnection->UnsentOffset;
+
+			short events = 0;
+			if (!pConnection->IsEndOfInput && numUnsentBytes < s_maxNumUnsentBytes)
+				events |= POLLIN;
+			if (numUnsentBytes > 0)
+				events |= POLLOUT;
+
+			pollFds.push_back(pollfd{pConnection->Fd, events, 0});
+		}
+
+		// Wakes up regularly to notice shutdown requests and report latencies
+		if (poll(pollFds.data(), pollFds.size(), 100) < 0 && errno != EINTR)
+			throw RPCException(SRC_POS, StrFormat("Could not poll RPC sockets. ({0})", strerror(errno)));
+
+		if (pollFds[1].revents & POLLIN)
+		{
+			char buffer[64];
+			while (read(_wakePipe[0], buffer, sizeof(buffer)) > 0) {}
+		}
+
+		// Connections are removed back to front such that indices into pollFds stay valid
+		for (size_t i = connections.size(); i > 0; --i)
+		{
+			auto& pConnection = connections[i - 1];
+			short revents = pollFds[i + 1].revents;
+
+			bool isClosed = false;
+			if (revents & POLLOUT)
+				send(*pConnection, isClosed);
+
+			if (!isClosed && (revents & POLLIN))
+				receive(pConnection, isClosed);
+			else if (revents & (POLLERR | POLLHUP | POLLNVAL))
+				isClosed = true;
+
+			// Clients which finished sending are still answered
+			if (!isClosed && pConnection->IsEndOfInput)
+			{
+				std::lock_guard<std::mutex> lock{pConnection->Mutex};
+				isClosed = !pConnection->IsBusy && pConnection->Unsent.empty();
+			}
+
+			if (isClosed)
+				connections.erase(std::begin(connections) + (i - 1));
+		}
+
+		if (pollFds[0].revents & POLLIN)
+		{
+			s32 fd = accept(_fd, nullptr, nullptr);
+			if (fd != -1)
+			{
+				fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+				connections.emplace_back(std::make_shared<Connection>());
+				connections.back()->Fd = fd;
+			}
+		}
+
+		if (_onLatency && steady_clock::now() - lastReportTime > _latencyInterval)
+		{
+			reportLatencies();
+			lastReportTime = steady_clock::now();
+		}
+	}
+#endif
+}
+
+void RPCServer::receive(const std::shared_ptr<Connection>& pConnection, bool& isClosed)
+{
+#ifndef _WIN32
+	char buffer[64 * 1024];
+	ssize_t numBytes = recv(pConnection->Fd, buffer, sizeof(buffer), 0);
+	if (numBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+
+	if (numBytes == 0)
+	{
+		pConnection->IsEndOfInput = true;
+		return;
+	}
+
+	if (numBytes < 0)
+	{
+		isClosed = true;
+		return;
+	}
+
+	auto& received = pConnection->Received;
+	received.append(buffer, numBytes);
+
+	std::vector<std::string> lines;
+	size_t lineBegin = 0;
+	for (size_t newline = received.find('\n'); newline != std::string::npos; newline = received.find('\n', lineBegin))
+	{
+		if (newline > lineBegin)
+			lines.emplace_back(received.substr(lineBegin, newline - lineBegin));
+
+		lineBegin = newline + 1;
+	}
+
+	received.erase(0, lineBegin);
+	if (received.size() > s_maxLineSize)
+	{
+		tlog::warning() << StrFormat("Closing RPC connection sending a line of more than {0} bytes.", s_maxLineSize);
+		isClosed = true;
+		return;
+	}
+
+	if (lines.empty())
+		return;
+
+	bool needsWorker;
+	{
+		std::lock_guard<std::mutex> lock{pConnection->Mutex};
+		for (auto& line : lines)
+			pConnection->Lines.emplace_back(std::move(line));
+
+		// Only one worker at a time answers the lines of a connection, which keeps them in order
+		needsWorker = !pConnection->IsBusy;
+		pConnection->IsBusy = true;
+	}
+
+	if (needsWorker)
+		_executor.Submit([this, pConnection]() { answer(pConnection); }, EPriority::High);
+#endif
+}
+
+void RPCServer::answer(std::shared_ptr<Connection> pConnection)
+{
+#ifndef _WIN32
+	while (true)
+	{
+		std::string line;
+		{
+			std::lock_guard<std::mutex> lock{pConnection->Mutex};
+			if (pConnection->Lines.empty())
+			{
+				pConnection->IsBusy = false;
+				return;
+			}
+
+			line = std::move(pConnection->Lines.front());
+			pConnection->Lines.pop_front();
+		}
+
+		json response;
+		try
+		{
+			json request = json::parse(line);
+			if (request.is_array())
+			{
+				// Batches are spread across the workers. The waiting worker helps out in the meantime.
+				response = json::array();
+				std::vector<json> responses(request.size());
+				_executor.ParallelFor(0, (s64)request.size(), 1, [&](s64 begin, s64 end)
+				{
+					for (s64 i = begin; i < end; ++i)
+						responses[i] = handle(request[i]);
+				});
+
+				for (auto& r : responses)
+					response.push_back(std::move(r));
+			}
+			else
+				response = handle(request);
+		}
+		catch (const std::exception& e)
+		{
+			response = {{"error", StrFormat("Malformed request: {0}", e.what())}};
+		}
+
+		std::string output = response.dump();
+		output += '\n';
+
+		// The client may have gone away, in which case the remaining lines are answered in vain
+		{
+			std::lock_guard<std::mutex> lock{pConnection->Mutex};
+			pConnection->Unsent += output;
+		}
+
+		wake();
+	}
+#endif
+}
+
+void RPCServer::send(Connection& connection, bool& isClosed)
+{
+#ifndef _WIN32
+	std::lock_guard<std::mutex> lock{connection.Mutex};
+
+	auto& unsent = connection.Unsent;
+	while (connection.UnsentOffset < unsent.size())
+	{
+		ssize_t numBytes = ::send(connection.Fd, unsent.data() + connection.UnsentOffset, unsent.size() - connection.UnsentOffset, MSG_NOSIGNAL);
+		if (numBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			break;
+
+		if (numBytes <= 0)
+		{
+			isClosed = true;
+			return;
+		}
+
+		connection.UnsentOffset += numBytes;
+	}
+
+	// Sent bytes are only dropped once it is worth moving the remainder
+	if (connection.UnsentOffset == unsent.size())
+	{
+		unsent.clear();
+		connection.UnsentOffset = 0;
+	}
+	else if (connection.UnsentOffset > unsent.size() / 2)
+	{
+		unsent.erase(0, connection.UnsentOffset);
+		connection.UnsentOffset = 0;
+	}
+#endif
+}
+
+void RPCServer::wake()
+{
+#ifndef _WIN32
+	char signal = 0;
+	// A full pipe already guarantees a wake-up, hence failures can be ignored.
+	if (write(_wakePipe[1], &signal, 1) < 0) {}
+#endif
+}
+
+json RPCServer::handle(const json& request)
+{
+	auto startTime = steady_clock::now();
+
+	std::string method = request.is_object() && request.count("method") > 0 && request["method"].is_string() ? request["method"].get<std::string>() : "";
+
+	auto handlerIt = _handlers.find(method);
+	if (handlerIt == std::end(_handlers))
+		return {{"error", StrFormat("Unknown method '{0}'.", method)}};
+
+	json response;
+	try
+	{
+		response = {{"result", handlerIt->second(request.count("params") > 0 ? request["params"] : json::object())}};
+	}
+	catch (const Exception& e)
+	{
+		response = {{"error", e.Description()}};
+	}
+	catch (const std::exception& e)
+	{
+		response = {{"error", e.what()}};
+	}
+
+	recordLatency(method, duration_cast<microseconds>(steady_clock::now() - startTime));
+	return response;
+}
+
+void RPCServer::recordLatency(const std::string& method, microseconds latency)
+{
+	if (!_onLatency)
+		return;
+
+	std::lock_guard<std::mutex> lock{_latencyMutex};
+	_latencies[method].emplace_back(latency);
+}
+
+void RPCServer::reportLatencies()
+{
+	std::unordered_map<std::string, std::vector<microseconds>> latencies;
+	{
+		std::lock_guard<std::mutex> lock{_latencyMutex};
+		std::swap(latencies, _latencies);
+	}
+
+	for (auto& entry : latencies)
+	{
+		auto& values = entry.second;
+		if (values.empty())
+			continue;
+
+		auto percentile = [&values](f64 p)
+		{
+			auto it = std::begin(values) + std::min(values.size() - 1, (size_t)(p * values.size()));
+			std::nth_element(std::begin(values), it, std::end(values));
+			return *it;
+		};
+
+		_onLatency(entry.first, percentile(0.5), percentile(0.99), values.size());
+	}
+}
+
+PP_NAMESPACE_END
@@ -1,19 +1,29 @@
 #include <pp/Common.h>
 #include <pp/shared/DatabaseConnection.h>
 #include <pp/shared/UpdateBatch.h>
+#include <pp/shared/WriteQueue.h>
+
+using namespace std::chrono;
 
 PP_NAMESPACE_BEGIN
 
 UpdateBatch::UpdateBatch(std::shared_ptr<DatabaseConnection> pDB, u32 sizeThreshold)
-: _pDB{std::move(pDB)}, _sizeThreshold{sizeThreshold}
+: _sizeThreshold{sizeThreshold}, _pDB{std::move(pDB)}, _query{sizeThreshold + s_capacitySlack}
+{
+}
+
+UpdateBatch::UpdateBatch(std::shared_ptr<WriteQueue> pWriteQueue, u64 orderingKey, u32 sizeThreshold)
+: _sizeThreshold{sizeThreshold}, _pWriteQueue{std::move(pWriteQueue)}, _orderingKey{orderingKey}, _query{sizeThreshold + s_capacitySlack}
 {
-	reset();
 }
 
 UpdateBatch::~UpdateBatch()
 {
+	if (_pCoalescer)
+		_pCoalescer->DrainInto(_query);
+
 	// If we are not empty we want to commit what's left in here
-	if (!_empty)
+	if (!_query.Empty())
 		execute();
 }
 
@@ -28,9 +38,15 @@ UpdateBatch& UpdateBatch::operator=(UpdateBatch&& other)
 	std::lock_guard<std::mutex> lock{_batchMutex};
 
 	_sizeThreshold = other._sizeThreshold;
-	_empty = other._empty;
 	_pDB = std::move(other._pDB);
+	_pWriteQueue = std::move(other._pWriteQueue);
+	_orderingKey = other._orderingKey;
+	_priority = other._priority;
 	_query = std::move(other._query);
+	_commitOffset = other._commitOffset;
+	_pCoalescer = std::move(other._pCoalescer);
+	_latencyBudget = other._latencyBudget;
+	_firstCommitTime = other._firstCommitTime;
 
 	return *this;
 }
@@ -43,38 +59,138 @@ void UpdateBatch::AppendAndCommit(const std::string& values)
 
 void UpdateBatch::AppendAndCommitNonThreadsafe(const std::string& values)
 {
-	append(values);
+	_query.Append(values);
+	CommitNonThreadsafe();
+}
 
-	if (Size() > _sizeThreshold)
-	{
+void UpdateBatch::CommitNonThreadsafe()
+{
+	// The first statement of a batch starts the clock
+	if (_commitOffset == 0 && !_query.Empty())
+		_firstCommitTime = steady_clock::now();
+
+	if (Size() > _sizeThreshold || isLatencyBudgetExhausted())
 		execute();
-		reset();
+
+	_commitOffset = _query.Size();
+}
+
+void UpdateBatch::CommitNonThreadsafe(const std::string& table, s64 primaryKey)
+{
+	if (!_pCoalescer)
+	{
+		CommitNonThreadsafe();
+		return;
 	}
+
+	// Move the statement out of the buffer and into the coalescer
+	_pCoalescer->Put(table, primaryKey, _query.Str().data() + _commitOffset, _query.Size() - _commitOffset);
+	_query.Truncate(_commitOffset);
+
+	if (_pCoalescer->IsDue())
+		flushCoalescer();
 }
 
-void UpdateBatch::reset()
+void UpdateBatch::CommitAfterHeldBackNonThreadsafe()
 {
-	_query = "";//"START TRANSACTION;";
-	_empty = true;
+	if (_pCoalescer)
+	{
+		// Held back statements are placed ahead of the one being built
+		std::string statement = _query.Str().substr(_commitOffset);
+		_query.Truncate(_commitOffset);
+
+		_pCoalescer->DrainInto(_query);
+		_query.Append(statement);
+	}
+
+	CommitNonThreadsafe();
 }
 
-const std::string& UpdateBatch::query()
+void UpdateBatch::EnableCoalescing(u32 maxNumRows, std::chrono::milliseconds window)
 {
-	//m_Query += "COMMIT;";
-	return _query;
+	std::lock_guard<std::mutex> lock{_batchMutex};
+	_pCoalescer = std::make_unique<WriteCoalescer>(maxNumRows, window);
 }
 
-void UpdateBatch::execute()
+void UpdateBatch::SetLatencyBudget(microseconds latencyBudget)
 {
-	_pDB->NonQueryBackground(query());
+	std::lock_guard<std::mutex> lock{_batchMutex};
+	_latencyBudget = latencyBudget;
+}
 
-	/*FILE* pFile = fopen("./updates.log", "ab");
+void UpdateBatch::SetSizeThreshold(u32 sizeThreshold)
+{
+	std::lock_guard<std::mutex> lock{_batchMutex};
+	_sizeThreshold = sizeThreshold;
+}
 
-	if(pFile != nullptr)
-	{
-		fputs(m_Query.c_str(), pFile);
-		fclose(pFile);
-	}*/
+void UpdateBatch::SetPriority(EPriority priority)
+{
+	std::lock_guard<std::mutex> lock{_batchMutex};
+	_priority = priority;
+}
+
+void UpdateBatch::Flush()
+{
+	std::lock_guard<std::mutex> lock{_batchMutex};
+	FlushNonThreadsafe(_priority);
+}
+
+void UpdateBatch::FlushNonThreadsafe(EPriority priority)
+{
+	if (_pCoalescer)
+		_pCoalescer->DrainInto(_query);
+
+	if (!_query.Empty())
+		execute(priority);
+}
+
+void UpdateBatch::FlushIfDue()
+{
+	std::lock_guard<std::mutex> lock{_batchMutex};
+	if (_pCoalescer && _pCoalescer->IsDue())
+		flushCoalescer();
+
+	if (isLatencyBudgetExhausted())
+		execute();
+}
+
+u64 UpdateBatch::NumCoalesced()
+{
+	std::lock_guard<std::mutex> lock{_batchMutex};
+	return _pCoalescer ? _pCoalescer->NumCoalesced() : 0;
+}
+
+bool UpdateBatch::isLatencyBudgetExhausted() const
+{
+	// Only committed statements count. One which is currently being built is not ready to be executed.
+	if (_latencyBudget.count() == 0 || _commitOffset == 0)
+		return false;
+
+	return steady_clock::now() - _firstCommitTime >= _latencyBudget;
+}
+
+void UpdateBatch::flushCoalescer()
+{
+	_pCoalescer->DrainInto(_query);
+	CommitNonThreadsafe();
+}
+
+void UpdateBatch::execute()
+{
+	execute(_priority);
+}
+
+void UpdateBatch::execute(EPriority priority)
+{
+	// Hand the buffer over to the background thread rather than copying it.
+	// It is recycled once the query ran.
+	if (_pWriteQueue)
+		_pWriteQueue->Push(_query.Release(), _orderingKey, priority);
+	else
+		_pDB->NonQueryBackground(_query.Release(), priority);
+
+	_commitOffset = 0;
 }
 
 PP_NAMESPACE_END
@@ -0,0 +1,94 @@
+#include <pp/Common.h>
+#include <pp/shared/WakeupSocket.h>
+
+#include <cerrno>
+#include <cstring>
+
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <poll.h>
+	#include <sys/socket.h>
+	#include <sys/un.h>
+	#include <unistd.h>
+#endif
+
+using namespace std::chrono;
+
+PP_NAMESPACE_BEGIN
+
+WakeupSocket::WakeupSocket(std::string path)
+: _path{std::move(path)}
+{
+#ifdef _WIN32
+	throw WakeupException(SRC_POS, "Wake-up sockets are not supported on Windows.");
+#else
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+
+	if (_path.size() >= sizeof(address.sun_path))
+		throw WakeupException(SRC_POS, StrFormat("Wake-up socket path '{0}' is too long.", _path));
+
+	strncpy(address.sun_path, _path.c_str(), sizeof(address.sun_path) - 1);
+
+	_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (_fd == -1)
+		throw WakeupException(SRC_POS, "Could not create wake-up socket.");
+
+	fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL, 0) | O_NONBLOCK);
+
+	// Connecting only succeeds while another process is bound to the path. Replacing its socket file
+	// would silently cut it off from all signals, hence refuse instead.
+	s32 probeFd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (probeFd != -1)
+	{
+		bool isOwned = connect(probeFd, (sockaddr*)&address, sizeof(address)) == 0;
+		close(probeFd);
+
+		if (isOwned)
+		{
+			close(_fd);
+			throw WakeupException(SRC_POS, StrFormat("Wake-up socket '{0}' is in use by another process.", _path));
+		}
+	}
+
+	unlink(_path.c_str());
+	if (bind(_fd, (sockaddr*)&address, sizeof(address)) != 0)
+	{
+		close(_fd);
+		throw WakeupException(SRC_POS, StrFormat("Could not bind wake-up socket to '{0}'. ({1})", _path, strerror(errno)));
+	}
+#endif
+}
+
+WakeupSocket::~WakeupSocket()
+{
+#ifndef _WIN32
+	if (_fd == -1)
+		return;
+
+	close(_fd);
+	unlink(_path.c_str());
+#endif
+}
+
+bool WakeupSocket::Wait(milliseconds timeout)
+{
+#ifdef _WIN32
+	return false;
+#else
+	pollfd pollFd{_fd, POLLIN, 0};
+	if (poll(&pollFd, 1, (int)timeout.count()) <= 0)
+		return false;
+
+	// Drain everything, such that a burst of signals results in a single wake-up
+	char buffer[64];
+	bool isSignalled = false;
+	while (recv(_fd, buffer, sizeof(buffer), 0) >= 0)
+		isSignalled = true;
+
+	return isSignalled;
+#endif
+}
+
+PP_NAMESPACE_END
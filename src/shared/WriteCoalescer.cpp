@@ -0,0 +1,63 @@
+#include <pp/Common.h>
+#include <pp/shared/QueryBuilder.h>
+#include <pp/shared/WriteCoalescer.h>
+
+using namespace std::chrono;
+
+PP_NAMESPACE_BEGIN
+
+WriteCoalescer::WriteCoalescer(u32 maxNumRows, milliseconds window)
+: _maxNumRows{std::max(maxNumRows, 1u)}, _window{window}
+{
+}
+
+void WriteCoalescer::Put(const std::string& table, s64 primaryKey, const char* statement, size_t size)
+{
+	if (_statements.empty())
+		_windowStart = steady_clock::now();
+
+	Statement entry{_buffer.size(), size};
+	_buffer.append(statement, size);
+
+	auto result = _rowIndices.emplace(RowKey{tableIdx(table), primaryKey}, _statements.size());
+	if (result.second)
+	{
+		_statements.emplace_back(entry);
+		return;
+	}
+
+	// The row already has a pending write, which is superseded by this one.
+	_statements[result.first->second] = entry;
+
+	++_numCoalesced;
+}
+
+bool WriteCoalescer::IsDue() const
+{
+	if (_statements.empty())
+		return false;
+
+	return _statements.size() >= _maxNumRows || steady_clock::now() - _windowStart >= _window;
+}
+
+void WriteCoalescer::DrainInto(QueryBuilder& query)
+{
+	for (const auto& statement : _statements)
+		query.Append(_buffer.data() + statement.Offset, statement.Size);
+
+	_buffer.clear();
+	_statements.clear();
+	_rowIndices.clear();
+}
+
+u32 WriteCoalescer::tableIdx(const std::string& table)
+{
+	for (u32 i = 0; i < _tables.size(); ++i)
+		if (_tables[i] == table)
+			return i;
+
+	_tables.emplace_back(table);
+	return (u32)_tables.size() - 1;
+}
+
+PP_NAMESPACE_END
@@ -0,0 +1,464 @@
+#include <pp/Common.h>
+#include <pp/shared/WriteJournal.h>
+
+#include <cstring>
+#include <map>
+
+#ifdef _WIN32
+	#include <io.h>
+#else
+	#include <unistd.h>
+#endif
+
+using namespace std::chrono;
+
+PP_NAMESPACE_BEGIN
+
+namespace
+{
+	const char s_recordWrite = 'W';
+	const char s_recordComplete = 'C';
+
+	// Follows the write record of a replayed write. Its ordering key holds how often the write was replayed.
+	const char s_recordAttempts = 'A';
+
+	// Type, sequence, ordering key and statement length
+	const size_t s_headerSize = sizeof(char) + 2 * sizeof(u64) + sizeof(u32);
+
+	// Anything longer must stem from a corrupted header
+	const u32 s_maxStatementLength = 256 * 1024 * 1024;
+
+	u32 fnv1a(const char* pData, size_t size, u32 hash = 2166136261u)
+	{
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash ^= (unsigned char)pData[i];
+			hash *= 16777619u;
+		}
+
+		return hash;
+	}
+
+	void syncDescriptor(int fd)
+	{
+#ifdef _WIN32
+		_commit(fd);
+#else
+		fsync(fd);
+#endif
+	}
+
+	void syncFile(std::FILE* pFile)
+	{
+		fflush(pFile);
+		syncDescriptor(fileno(pFile));
+	}
+
+	bool copyRange(std::FILE* pSource, u64 offset, u64 size, std::FILE* pDestination, std::string& buffer)
+	{
+		buffer.resize((size_t)size);
+		return
+			fseek(pSource, (long)offset, SEEK_SET) == 0 &&
+			fread(&buffer[0], 1, buffer.size(), pSource) == buffer.size() &&
+			fwrite(buffer.data(), 1, buffer.size(), pDestination) == buffer.size();
+	}
+}
+
+// Journals beyond this size are compacted once less than half of them is outstanding.
+const u64 WriteJournal::s_compactionSize = 64ull * 1024 * 1024;
+const u32 WriteJournal::s_maxNumReplays = 3;
+
+WriteJournal::WriteJournal(std::string path, milliseconds syncInterval)
+: _path{std::move(path)}, _syncInterval{syncInterval}
+{
+	read();
+	rewrite();
+
+	_syncThread = std::thread{&WriteJournal::runSyncLoop, this};
+}
+
+WriteJournal::~WriteJournal()
+{
+	{
+		std::lock_guard<std::mutex> lock{_mutex};
+		_shallShutdown = true;
+	}
+
+	_wakeCondition.notify_all();
+	_syncThread.join();
+
+	// Missing if replacing the journal failed
+	if (!_pFile)
+		return;
+
+	syncNonThreadsafe();
+	fclose(_pFile);
+}
+
+std::vector<WriteJournal::Entry> WriteJournal::TakeUnfinished()
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+	return std::move(_unfinished);
+}
+
+u64 WriteJournal::Append(u64 orderingKey, const std::string& statement)
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	u64 sequence = _nextSequence++;
+	u64 offset = _size;
+
+	writeRecord(s_recordWrite, sequence, orderingKey, statement);
+
+	_outstanding[sequence] = Record{offset, _size - offset};
+	_numOutstandingBytes += _size - offset;
+
+	return sequence;
+}
+
+void WriteJournal::Complete(u64 sequence)
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+
+	auto it = _outstanding.find(sequence);
+	if (it == std::end(_outstanding))
+		throw JournalException(SRC_POS, StrFormat("Write {0} is not outstanding in journal '{1}'.", sequence, _path));
+
+	writeRecord(s_recordComplete, sequence, 0, std::string{});
+
+	_numOutstandingBytes -= it->second.Size;
+	_outstanding.erase(it);
+
+	// Everything before the oldest outstanding write, and whatever was completed after it, is not needed anymore.
+	// Copying only what is outstanding keeps the journal from growing forever even if some writes never complete.
+	// The copy is left to the sync thread, such that neither we nor whoever appends waits for it.
+	if (!_isCompactionDue && _size > s_compactionSize && _numOutstandingBytes < _size / 2)
+	{
+		_isCompactionDue = true;
+		_wakeCondition.notify_all();
+	}
+}
+
+size_t WriteJournal::NumOutstanding()
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+	return _outstanding.size();
+}
+
+u64 WriteJournal::Size()
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+	return _size;
+}
+
+void WriteJournal::Sync()
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+	syncNonThreadsafe();
+}
+
+void WriteJournal::read()
+{
+	std::FILE* pFile = fopen(_path.c_str(), "rb");
+	if (!pFile)
+		// No journal yet
+		return;
+
+	struct Pending
+	{
+		Entry Write;
+		u32 NumReplays;
+	};
+
+	std::map<u64, Pending> pending;
+
+	char header[s_headerSize];
+	while (fread(header, 1, s_headerSize, pFile) == s_headerSize)
+	{
+		char type = header[0];
+
+		u64 sequence;
+		u64 orderingKey;
+		u32 length;
+		memcpy(&sequence, header + 1, sizeof(u64));
+		memcpy(&orderingKey, header + 1 + sizeof(u64), sizeof(u64));
+		memcpy(&length, header + 1 + 2 * sizeof(u64), sizeof(u32));
+
+		if ((type != s_recordWrite && type != s_recordComplete && type != s_recordAttempts) || length > s_maxStatementLength)
+			break;
+
+		std::string statement(length, '\0');
+		u32 checksum;
+		if (fread(&statement[0], 1, length, pFile) != length || fread(&checksum, 1, sizeof(u32), pFile) != sizeof(u32))
+			break;
+
+		// A torn record can only be the last one, since it was being written during the crash.
+		if (checksum != fnv1a(statement.data(), statement.size(), fnv1a(header, s_headerSize)))
+			break;
+
+		_nextSequence = std::max(_nextSequence, sequence + 1);
+
+		if (type == s_recordWrite)
+			pending[sequence] = Pending{Entry{sequence, orderingKey, std::move(statement)}, 0};
+		else if (type == s_recordComplete)
+			pending.erase(sequence);
+		else if (pending.count(sequence) > 0)
+			pending[sequence].NumReplays = (u32)orderingKey;
+	}
+
+	fclose(pFile);
+
+	// Writes which keep failing would otherwise be replayed, and fail, on every start
+	std::vector<std::pair<Entry, u32>> rejected;
+	for (auto& entry : pending)
+	{
+		if (entry.second.NumReplays >= s_maxNumReplays)
+			rejected.emplace_back(std::move(entry.second.Write), entry.second.NumReplays);
+		else
+		{
+			_unfinished.emplace_back(std::move(entry.second.Write));
+			_numReplays.emplace_back(entry.second.NumReplays + 1);
+		}
+	}
+
+	if (!rejected.empty())
+		reject(rejected);
+
+	if (!_unfinished.empty())
+		tlog::warning() << StrFormat("Journal '{0}' contains {1} unfinished writes.", _path, _unfinished.size());
+}
+
+void WriteJournal::reject(const std::vector<std::pair<Entry, u32>>& rejected)
+{
+	std::string rejectedPath = _path + ".rejected";
+
+	std::FILE* pFile = fopen(rejectedPath.c_str(), "ab");
+	if (!pFile)
+		throw JournalException(SRC_POS, StrFormat("Could not open '{0}' to set aside rejected writes.", rejectedPath));
+
+	bool success = true;
+	for (const auto& entry : rejected)
+	{
+		std::string text = StrFormat(
+			"-- Write {0} with ordering key {1} failed after {2} replays\n{3}\n",
+			entry.first.Sequence, entry.first.OrderingKey, entry.second, entry.first.Statement
+		);
+
+		success = success && fwrite(text.data(), 1, text.size(), pFile) == text.size();
+	}
+
+	if (success)
+		syncFile(pFile);
+
+	fclose(pFile);
+
+	// The writes would be lost otherwise, hence they stay in the journal unless they were set aside
+	if (!success)
+		throw JournalException(SRC_POS, StrFormat("Could not set aside rejected writes in '{0}'.", rejectedPath));
+
+	tlog::error() << StrFormat(
+		"Set aside {0} writes of journal '{1}' which failed {2} replays in a row into '{3}'.",
+		rejected.size(), _path, s_maxNumReplays, rejectedPath
+	);
+}
+
+void WriteJournal::rewrite()
+{
+	// Write the unfinished entries into a fresh file and only then replace the old one.
+	// A crash in between leaves the old journal intact.
+	std::string tmpPath = _path + ".tmp";
+
+	_pFile = fopen(tmpPath.c_str(), "wb");
+	if (!_pFile)
+		throw JournalException(SRC_POS, StrFormat("Could not create journal '{0}'.", tmpPath));
+
+	for (size_t i = 0; i < _unfinished.size(); ++i)
+	{
+		const auto& entry = _unfinished[i];
+
+		// Counts this run's replay ahead of time, since the write may crash it
+		u64 offset = _size;
+		writeRecord(s_recordWrite, entry.Sequence, entry.OrderingKey, entry.Statement);
+		writeRecord(s_recordAttempts, entry.Sequence, _numReplays[i], std::string{});
+
+		_outstanding[entry.Sequence] = Record{offset, _size - offset};
+		_numOutstandingBytes += _size - offset;
+	}
+
+	syncNonThreadsafe();
+	fclose(_pFile);
+	_pFile = nullptr;
+
+	replace(tmpPath);
+}
+
+void WriteJournal::compact(std::unique_lock<std::mutex>& lock)
+{
+	if (!_pFile)
+		throw JournalException(SRC_POS, StrFormat("Journal '{0}' is not open.", _path));
+
+	std::string tmpPath = _path + ".tmp";
+
+	// Outstanding records are read back from the journal itself rather than being held in memory.
+	// The bulk of them is copied without holding the lock; whatever is appended meanwhile is copied afterwards.
+	fflush(_pFile);
+	std::map<u64, Record> outstanding = _outstanding;
+	u64 copiedSize = _size;
+
+	lock.unlock();
+
+	std::FILE* pSource = fopen(_path.c_str(), "rb");
+	std::FILE* pCompacted = pSource ? fopen(tmpPath.c_str(), "wb") : nullptr;
+
+	std::map<u64, Record> compacted;
+	u64 size = 0;
+	std::string buffer;
+
+	bool success = pSource && pCompacted;
+	if (success)
+	{
+		for (const auto& entry : outstanding)
+		{
+			if (!copyRange(pSource, entry.second.Offset, entry.second.Size, pCompacted, buffer))
+			{
+				success = false;
+				break;
+			}
+
+			compacted[entry.first] = Record{size, entry.second.Size};
+			size += entry.second.Size;
+		}
+	}
+
+	if (success)
+		syncFile(pCompacted);
+
+	lock.lock();
+
+	// Appended while copying. Completions among these cancel copied writes when the journal is read.
+	if (success)
+	{
+		fflush(_pFile);
+		success = copyRange(pSource, copiedSize, _size - copiedSize, pCompacted, buffer);
+	}
+
+	if (success)
+		syncFile(pCompacted);
+
+	if (pSource)
+		fclose(pSource);
+
+	if (pCompacted)
+		fclose(pCompacted);
+
+	// The current journal stays in use if anything went wrong
+	if (!success)
+	{
+		remove(tmpPath.c_str());
+		throw JournalException(SRC_POS, StrFormat("Could not compact journal '{0}'.", _path));
+	}
+
+	std::map<u64, Record> remaining;
+	for (const auto& entry : _outstanding)
+	{
+		auto compactedIt = compacted.find(entry.first);
+		if (compactedIt != std::end(compacted))
+			remaining[entry.first] = compactedIt->second;
+		else
+			remaining[entry.first] = Record{size + entry.second.Offset - copiedSize, entry.second.Size};
+	}
+
+	fclose(_pFile);
+	_pFile = nullptr;
+
+	replace(tmpPath);
+
+	_outstanding = std::move(remaining);
+	_size = size + _size - copiedSize;
+	_isDirty = false;
+}
+
+void WriteJournal::replace(const std::string& tmpPath)
+{
+	// Renaming does not replace existing files on windows
+	remove(_path.c_str());
+	if (rename(tmpPath.c_str(), _path.c_str()) != 0)
+		throw JournalException(SRC_POS, StrFormat("Could not replace journal '{0}'.", _path));
+
+	_pFile = fopen(_path.c_str(), "ab");
+	if (!_pFile)
+		throw JournalException(SRC_POS, StrFormat("Could not open journal '{0}'.", _path));
+}
+
+void WriteJournal::writeRecord(char type, u64 sequence, u64 orderingKey, const std::string& statement)
+{
+	if (!_pFile)
+		throw JournalException(SRC_POS, StrFormat("Journal '{0}' is not open.", _path));
+
+	char header[s_headerSize];
+	u32 length = (u32)statement.size();
+
+	header[0] = type;
+	memcpy(header + 1, &sequence, sizeof(u64));
+	memcpy(header + 1 + sizeof(u64), &orderingKey, sizeof(u64));
+	memcpy(header + 1 + 2 * sizeof(u64), &length, sizeof(u32));
+
+	u32 checksum = fnv1a(statement.data(), statement.size(), fnv1a(header, s_headerSize));
+
+	if (fwrite(header, 1, s_headerSize, _pFile) != s_headerSize ||
+		fwrite(statement.data(), 1, length, _pFile) != length ||
+		fwrite(&checksum, 1, sizeof(u32), _pFile) != sizeof(u32))
+		throw JournalException(SRC_POS, StrFormat("Could not append to journal '{0}'.", _path));
+
+	_size += s_headerSize + length + sizeof(u32);
+	_isDirty = true;
+}
+
+void WriteJournal::syncNonThreadsafe()
+{
+	if (!_isDirty || !_pFile)
+		return;
+
+	syncFile(_pFile);
+	_isDirty = false;
+}
+
+void WriteJournal::runSyncLoop()
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+
+	while (!_shallShutdown)
+	{
+		// Many appends share a single sync
+		_wakeCondition.wait_for(lock, _syncInterval, [this]() { return _shallShutdown || _isCompactionDue; });
+
+		if (_isCompactionDue)
+		{
+			_isCompactionDue = false;
+
+			try
+			{
+				compact(lock);
+			}
+			catch (const JournalException& e)
+			{
+				// Retried once the next write completes
+				e.Log();
+			}
+		}
+
+		if (!_isDirty || !_pFile)
+			continue;
+
+		// Only this thread closes the file while running, hence it can be synced without holding the lock
+		fflush(_pFile);
+		int fd = fileno(_pFile);
+		_isDirty = false;
+
+		lock.unlock();
+		syncDescriptor(fd);
+		lock.lock();
+	}
+}
+
+PP_NAMESPACE_END
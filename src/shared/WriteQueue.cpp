@@ -0,0 +1,288 @@
+#include <pp/Common.h>
+#include <pp/shared/AsyncDatabase.h>
+#include <pp/shared/WriteQueue.h>
+
+using namespace std::chrono;
+
+PP_NAMESPACE_BEGIN
+
+WriteQueue::WriteQueue(
+	std::shared_ptr<AsyncDatabase> pWriter,
+	size_t maxNumBytes,
+	size_t maxNumStatements,
+	f32 highWatermark,
+	f32 lowWatermark
+) :
+_pWriter{std::move(pWriter)},
+_maxNumBytes{std::max<size_t>(maxNumBytes, 1)}, _maxNumStatements{std::max<size_t>(maxNumStatements, 1)},
+_highWatermark{highWatermark}, _lowWatermark{std::min(lowWatermark, highWatermark)}
+{
+}
+
+WriteQueue::~WriteQueue()
+{
+	// Completion callbacks refer to us, hence we may not go away before all of them ran.
+	// Failures are left to whoever waited for the queue before.
+	std::unique_lock<std::mutex> lock{_mutex};
+	_drainedCondition.wait(lock, [this]() { return _numStatements == 0; });
+}
+
+void WriteQueue::Push(std::string&& statement, u64 orderingKey, EPriority priority)
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+
+	size_t numBytes = statement.size();
+	if (fits(numBytes, priority))
+	{
+		admit(lock, std::move(statement), orderingKey, priority);
+		return;
+	}
+
+	auto startTime = steady_clock::now();
+	_spaceCondition.wait(lock, [&]() { return fits(numBytes, priority); });
+	auto waitTime = duration_cast<microseconds>(steady_clock::now() - startTime);
+
+	auto onWait = _onWait;
+	admit(lock, std::move(statement), orderingKey, priority);
+
+	if (onWait)
+		onWait(priority, waitTime);
+}
+
+bool WriteQueue::TryPush(std::string& statement, u64 orderingKey, EPriority priority)
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+
+	if (!fits(statement.size(), priority))
+		return false;
+
+	admit(lock, std::move(statement), orderingKey, priority);
+	return true;
+}
+
+void WriteQueue::SetWatermarkCallbacks(WatermarkCallback onHighWatermark, WatermarkCallback onLowWatermark)
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+	_onHighWatermark = std::move(onHighWatermark);
+	_onLowWatermark = std::move(onLowWatermark);
+}
+
+void WriteQueue::SetWaitCallback(WaitCallback onWait)
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+	_onWait = std::move(onWait);
+}
+
+void WriteQueue::EnableJournal(std::unique_ptr<WriteJournal> pJournal)
+{
+	auto unfinished = pJournal->TakeUnfinished();
+	_pJournal = std::move(pJournal);
+
+	if (unfinished.empty())
+		return;
+
+	tlog::info() << StrFormat("Replaying {0} journaled writes.", unfinished.size());
+
+	// Replayed writes keep their place in the journal rather than being appended again
+	for (auto& entry : unfinished)
+	{
+		std::unique_lock<std::mutex> lock{_mutex};
+
+		size_t numBytes = entry.Statement.size();
+		_spaceCondition.wait(lock, [&]() { return fits(numBytes, EPriority::Low); });
+
+		admit(lock, std::move(entry.Statement), entry.OrderingKey, EPriority::Low, entry.Sequence);
+	}
+}
+
+void WriteQueue::Throttle(EPriority priority)
+{
+	std::unique_lock<std::mutex> lock{_mutex};
+
+	if (priority == EPriority::High)
+		_drainedCondition.wait(lock, [this]() { return fits(0, EPriority::High); });
+	else
+		_drainedCondition.wait(lock, [this]() { return !_isCongested; });
+}
+
+void WriteQueue::WaitUntilEmpty()
+{
+	{
+		std::unique_lock<std::mutex> lock{_mutex};
+		_drainedCondition.wait(lock, [this]() { return _numStatements == 0; });
+	}
+
+	ThrowIfFailed();
+}
+
+void WriteQueue::ThrowIfFailed()
+{
+	_pWriter->ThrowIfFailed();
+}
+
+void WriteQueue::Fence(std::function<void()> onPassed)
+{
+	{
+		std::lock_guard<std::mutex> lock{_mutex};
+
+		if (!_outstandingTickets.empty())
+		{
+			_fences.emplace_back(PendingFence{_nextTicket, std::move(onPassed)});
+			return;
+		}
+	}
+
+	onPassed();
+}
+
+size_t WriteQueue::NumStatements() const
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+	return _numStatements;
+}
+
+size_t WriteQueue::NumStatements(EPriority priority) const
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+	return _numStatementsByPriority[(size_t)priority];
+}
+
+size_t WriteQueue::NumBytes() const
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+	return _numBytes;
+}
+
+size_t WriteQueue::NumBytes(EPriority priority) const
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+	return _numBytesByPriority[(size_t)priority];
+}
+
+bool WriteQueue::IsCongested() const
+{
+	std::lock_guard<std::mutex> lock{_mutex};
+	return _isCongested;
+}
+
+bool WriteQueue::fits(size_t numBytes, EPriority priority) const
+{
+	// Low priority statements are bounded by everything in the queue, high priority ones only by their own kind.
+	size_t numQueuedStatements = priority == EPriority::High ? _numStatementsByPriority[(size_t)priority] : _numStatements;
+	size_t numQueuedBytes = priority == EPriority::High ? _numBytesByPriority[(size_t)priority] : _numBytes;
+
+	// A single statement larger than the entire queue is still admitted when there is nothing else.
+	// Otherwise it could never be written.
+	if (numQueuedStatements == 0)
+		return true;
+
+	return numQueuedStatements < _maxNumStatements && numQueuedBytes + numBytes <= _maxNumBytes;
+}
+
+void WriteQueue::admit(std::unique_lock<std::mutex>& lock, std::string&& statement, u64 orderingKey, EPriority priority, u64 journalSequence)
+{
+	size_t numBytes = statement.size();
+
+	u64 ticket = _nextTicket++;
+	_outstandingTickets.insert(ticket);
+
+	// Journaling while locked keeps the journal in the order in which writes are submitted
+	if (_pJournal && journalSequence == s_notJournaled)
+		journalSequence = _pJournal->Append(orderingKey, statement);
+
+	_numBytes += numBytes;
+	++_numStatements;
+	_numBytesByPriority[(size_t)priority] += numBytes;
+	++_numStatementsByPriority[(size_t)priority];
+
+	WatermarkCallback onHighWatermark;
+	if (!_isCongested && (
+		_numBytes >= _highWatermark * _maxNumBytes ||
+		_numStatements >= _highWatermark * _maxNumStatements
+	))
+	{
+		_isCongested = true;
+		onHighWatermark = _onHighWatermark;
+	}
+
+	lock.unlock();
+
+	if (onHighWatermark)
+		onHighWatermark();
+
+	auto onDone = [this, numBytes, priority, journalSequence, ticket]() { release(numBytes, priority, journalSequence, ticket); };
+
+	// Failed writes are not completed in the journal, such that they are replayed by the next run.
+	// The writer reports the failure to whoever pushes or waits next.
+	auto onError = [this, numBytes, priority, ticket]() { release(numBytes, priority, s_notJournaled, ticket); };
+
+	try
+	{
+		_pWriter->NonQuery(std::move(statement), orderingKey, priority, onDone, onError);
+	}
+	catch (...)
+	{
+		// Not completed in the journal, such that the write is replayed by the next run
+		release(numBytes, priority, s_notJournaled, ticket);
+		throw;
+	}
+}
+
+void WriteQueue::release(size_t numBytes, EPriority priority, u64 journalSequence, u64 ticket)
+{
+	// The write leaves the queue even if the journal fails to complete it, such that nobody waits for it forever
+	struct ReleaseGuard
+	{
+		WriteQueue& Queue;
+		size_t NumBytes;
+		EPriority Priority;
+		u64 Ticket;
+
+		~ReleaseGuard() { Queue.releaseCapacity(NumBytes, Priority, Ticket); }
+	} guard{*this, numBytes, priority, ticket};
+
+	if (journalSequence != s_notJournaled)
+		_pJournal->Complete(journalSequence);
+}
+
+void WriteQueue::releaseCapacity(size_t numBytes, EPriority priority, u64 ticket)
+{
+	WatermarkCallback onLowWatermark;
+	std::vector<std::function<void()>> passedFences;
+
+	{
+		std::lock_guard<std::mutex> lock{_mutex};
+
+		_numBytes -= numBytes;
+		--_numStatements;
+		_numBytesByPriority[(size_t)priority] -= numBytes;
+		--_numStatementsByPriority[(size_t)priority];
+
+		_outstandingTickets.erase(ticket);
+		while (!_fences.empty() && (_outstandingTickets.empty() || *_outstandingTickets.begin() >= _fences.front().Ticket))
+		{
+			passedFences.emplace_back(std::move(_fences.front().OnPassed));
+			_fences.pop_front();
+		}
+
+		if (_isCongested &&
+			_numBytes <= _lowWatermark * _maxNumBytes &&
+			_numStatements <= _lowWatermark * _maxNumStatements
+		)
+		{
+			_isCongested = false;
+			onLowWatermark = _onLowWatermark;
+		}
+	}
+
+	_spaceCondition.notify_all();
+	_drainedCondition.notify_all();
+
+	if (onLowWatermark)
+		onLowWatermark();
+
+	for (const auto& onPassed : passedFences)
+		onPassed();
+}
+
+PP_NAMESPACE_END
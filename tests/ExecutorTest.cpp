@@ -0,0 +1,151 @@
+#include "Test.h"
+
+#include <pp/shared/Executor.h>
+
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+using namespace pp;
+using namespace std::chrono;
+
+// Holds a worker busy until opened, such that tasks queue up behind it
+class Gate
+{
+public:
+	void Wait()
+	{
+		_entered.CountDown();
+		_opened.Wait();
+	}
+
+	void WaitUntilEntered() { _entered.Wait(); }
+	void Open() { _opened.CountDown(); }
+
+private:
+	Latch _entered{1};
+	Latch _opened{1};
+};
+
+// Every index is visited exactly once, even by blocks which wait for blocks they submitted themselves
+static void testNestedParallelFor()
+{
+	Executor executor{4};
+
+	std::vector<std::atomic<u32>> numVisits(64 * 100);
+	for (auto& n : numVisits)
+		n = 0;
+
+	executor.ParallelFor(0, 64, 1, [&](s64 begin, s64 end)
+	{
+		for (s64 i = begin; i < end; ++i)
+			executor.ParallelFor(0, 100, 7, [&, i](s64 innerBegin, s64 innerEnd)
+			{
+				for (s64 j = innerBegin; j < innerEnd; ++j)
+					++numVisits[i * 100 + j];
+			});
+	});
+
+	for (const auto& n : numVisits)
+		CHECK(n == 1);
+}
+
+// Blocks which throw still count down, such that nobody waits forever
+static void testThrowingParallelFor()
+{
+	Executor executor{2};
+
+	std::atomic<u32> numBlocks{0};
+	executor.ParallelFor(0, 10, 1, [&](s64, s64)
+	{
+		++numBlocks;
+		throw std::runtime_error{"Expected by the test."};
+	});
+
+	CHECK(numBlocks == 10);
+}
+
+// Returns the priorities in the order in which a single worker ran the given tasks
+static std::vector<EPriority> runInOrder(u32 highPriorityWeight, const std::vector<EPriority>& priorities)
+{
+	std::vector<EPriority> order;
+	std::mutex orderMutex;
+	Gate gate;
+
+	{
+		// Running a low priority task first starts the count of high priority ones in a row from zero
+		Executor executor{1, highPriorityWeight};
+		executor.Submit([&gate]() { gate.Wait(); }, EPriority::Low);
+		gate.WaitUntilEntered();
+
+		for (EPriority priority : priorities)
+		{
+			executor.Submit([&order, &orderMutex, priority]()
+			{
+				std::lock_guard<std::mutex> lock{orderMutex};
+				order.emplace_back(priority);
+			}, priority);
+		}
+
+		gate.Open();
+	}
+
+	return order;
+}
+
+static void testStrictPriority()
+{
+	const EPriority H = EPriority::High;
+	const EPriority L = EPriority::Low;
+
+	auto order = runInOrder(0, {L, H, L, H, L, H});
+	CHECK((order == std::vector<EPriority>{H, H, H, L, L, L}));
+}
+
+// Low priority tasks get a turn after every few high priority ones
+static void testWeightedPriority()
+{
+	const EPriority H = EPriority::High;
+	const EPriority L = EPriority::Low;
+
+	auto order = runInOrder(2, {L, L, H, H, H, H, H, H});
+	CHECK((order == std::vector<EPriority>{H, H, L, H, H, L, H, H}));
+}
+
+// Tasks submitted from within a task stay on its worker, hence idle workers have to steal them
+static void testStealing()
+{
+	std::set<std::thread::id> threadIds;
+	std::mutex threadIdsMutex;
+
+	{
+		Executor executor{2};
+		executor.Submit([&]()
+		{
+			for (u32 i = 0; i < 50; ++i)
+			{
+				executor.Submit([&]()
+				{
+					std::this_thread::sleep_for(milliseconds{1});
+
+					std::lock_guard<std::mutex> lock{threadIdsMutex};
+					threadIds.insert(std::this_thread::get_id());
+				}, EPriority::Low);
+			}
+		}, EPriority::Low);
+	}
+
+	CHECK(threadIds.size() == 2);
+}
+
+int main()
+{
+	testNestedParallelFor();
+	testThrowingParallelFor();
+	testStrictPriority();
+	testWeightedPriority();
+	testStealing();
+
+	return 0;
+}
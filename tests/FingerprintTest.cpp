@@ -0,0 +1,116 @@
+#include "Test.h"
+
+#include <pp/performance/Beatmap.h>
+#include <pp/performance/User.h>
+
+using namespace pp;
+
+// Matches the reference FNV-1a of the bytes, least significant first
+static void testFnv1aHash()
+{
+	Fnv1aHash hash;
+	CHECK(hash.Value() == 0xcbf29ce484222325ull);
+
+	// "abcdefgh"
+	hash.Combine(0x6867666564636261ull);
+	CHECK(hash.Value() == 0x25da8c1836a8d66dull);
+}
+
+static Beatmap makeBeatmap(bool isReversed)
+{
+	Beatmap beatmap{10};
+	beatmap.SetMode(EGamemode::Osu);
+	beatmap.SetRankedStatus(Beatmap::Ranked);
+	beatmap.SetScoreVersion(Beatmap::ScoreV1);
+	beatmap.SetNumHitCircles(500);
+	beatmap.SetNumSliders(200);
+	beatmap.SetNumSpinners(2);
+
+	if (isReversed)
+	{
+		beatmap.SetDifficultyAttribute(DoubleTime, Beatmap::Aim, 4.5f);
+		beatmap.SetDifficultyAttribute(Nomod, Beatmap::Speed, 2.5f);
+		beatmap.SetDifficultyAttribute(Nomod, Beatmap::Aim, 3.0f);
+	}
+	else
+	{
+		beatmap.SetDifficultyAttribute(Nomod, Beatmap::Aim, 3.0f);
+		beatmap.SetDifficultyAttribute(Nomod, Beatmap::Speed, 2.5f);
+		beatmap.SetDifficultyAttribute(DoubleTime, Beatmap::Aim, 4.5f);
+	}
+
+	return beatmap;
+}
+
+static void testDifficultyHash()
+{
+	Beatmap beatmap = makeBeatmap(false);
+	u64 hash = beatmap.DifficultyHash(false);
+
+	// Independent of the order attributes were loaded in
+	CHECK(makeBeatmap(true).DifficultyHash(false) == hash);
+
+	// Mods which do not affect difficulty are masked away
+	Beatmap hidden = makeBeatmap(false);
+	hidden.SetDifficultyAttribute((EMods)(DoubleTime | Hidden), Beatmap::Aim, 4.5f);
+	CHECK(hidden.DifficultyHash(false) == hash);
+
+	CHECK(beatmap.DifficultyHash(true) != hash);
+
+	Beatmap changed = makeBeatmap(false);
+	changed.SetDifficultyAttribute(DoubleTime, Beatmap::Aim, 4.75f);
+	CHECK(changed.DifficultyHash(false) != hash);
+
+	Beatmap loved = makeBeatmap(false);
+	loved.SetRankedStatus(Beatmap::Loved);
+	CHECK(loved.DifficultyHash(false) != hash);
+
+	Beatmap moreCircles = makeBeatmap(false);
+	moreCircles.SetNumHitCircles(501);
+	CHECK(moreCircles.DifficultyHash(false) != hash);
+}
+
+static u64 fingerprint(const std::vector<Score::PPRecord>& scores)
+{
+	User user{1};
+	for (const auto& score : scores)
+		user.AddScorePPRecord(score);
+
+	user.ComputePPRecord();
+	return user.ScoresFingerprint();
+}
+
+static void testScoresFingerprint()
+{
+	Score::PPRecord first{1, 10, 100.0f, 0.99f};
+	Score::PPRecord second{2, 11, 80.0f, 0.95f};
+	Score::PPRecord worseOnSameBeatmap{3, 10, 50.0f, 0.9f};
+
+	u64 hash = fingerprint({first, second});
+
+	// Only the scores which count matter, regardless of their order
+	CHECK(fingerprint({second, first}) == hash);
+	CHECK(fingerprint({worseOnSameBeatmap, second, first}) == hash);
+
+	CHECK(fingerprint({first}) != hash);
+
+	Score::PPRecord changed = second;
+	changed.Value = 80.5f;
+	CHECK(fingerprint({first, changed}) != hash);
+
+	Score::PPRecord replaced = second;
+	replaced.ScoreId = 4;
+	CHECK(fingerprint({first, replaced}) != hash);
+
+	// 0 stands for unknown fingerprints, hence users without scores have a known one
+	CHECK(fingerprint({}) != 0);
+}
+
+int main()
+{
+	testFnv1aHash();
+	testDifficultyHash();
+	testScoresFingerprint();
+
+	return 0;
+}
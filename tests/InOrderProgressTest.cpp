@@ -0,0 +1,114 @@
+#include "Test.h"
+
+#include <pp/shared/InOrderProgress.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace pp;
+
+// Progress stops at the first unfinished item, no matter how many later ones finished
+static void testOutOfOrder()
+{
+	InOrderProgress progress;
+	CHECK(progress.LastFinishedId() == -1);
+
+	u64 first = progress.Start(10);
+	u64 second = progress.Start(20);
+	u64 third = progress.Start(30);
+
+	CHECK(progress.Finish(third) == 30);
+	CHECK(progress.LastFinishedId() == -1);
+
+	CHECK(progress.Finish(first) == 10);
+	CHECK(progress.LastFinishedId() == 10);
+
+	CHECK(progress.Finish(second) == 20);
+	CHECK(progress.LastFinishedId() == 30);
+}
+
+// After a reset, only items finishing afterwards count, including ones started before the reset
+static void testReset()
+{
+	InOrderProgress progress;
+
+	progress.Finish(progress.Start(10));
+	u64 unfinished = progress.Start(20);
+
+	progress.ResetLastFinishedId();
+	CHECK(progress.LastFinishedId() == -1);
+
+	u64 next = progress.Start(30);
+	CHECK(progress.Finish(next) == 30);
+	CHECK(progress.LastFinishedId() == -1);
+
+	progress.Finish(unfinished);
+	CHECK(progress.LastFinishedId() == 30);
+}
+
+// Progress stops right before a failed item, even once everything after it finished
+static void testFailure()
+{
+	InOrderProgress progress;
+
+	u64 first = progress.Start(10);
+	u64 second = progress.Start(20);
+	u64 third = progress.Start(30);
+
+	CHECK(progress.Finish(third) == 30);
+	CHECK(progress.Fail(second) == 20);
+	CHECK(progress.LastFinishedId() == -1);
+
+	progress.Finish(first);
+	CHECK(progress.LastFinishedId() == 10);
+
+	progress.Finish(progress.Start(40));
+	CHECK(progress.LastFinishedId() == 10);
+
+	// Failures of earlier items do not hold back items finishing after a reset
+	progress.ResetLastFinishedId();
+
+	progress.Finish(progress.Start(50));
+	CHECK(progress.LastFinishedId() == 50);
+}
+
+// Whatever the order, the last finished item is the end of the longest finished prefix
+static void testRandomOrder()
+{
+	std::mt19937 rng{42};
+
+	for (u32 round = 0; round < 100; ++round)
+	{
+		InOrderProgress progress;
+
+		std::vector<u64> indices;
+		for (s64 id = 0; id < 100; ++id)
+			indices.emplace_back(progress.Start(id));
+
+		std::shuffle(std::begin(indices), std::end(indices), rng);
+
+		std::vector<bool> isFinished(indices.size(), false);
+		for (u64 idx : indices)
+		{
+			progress.Finish(idx);
+			isFinished[idx] = true;
+
+			s64 expected = -1;
+			while (expected + 1 < (s64)isFinished.size() && isFinished[expected + 1])
+				++expected;
+
+			CHECK(progress.LastFinishedId() == expected);
+		}
+	}
+}
+
+int main()
+{
+	testOutOfOrder();
+	testReset();
+	testFailure();
+	testRandomOrder();
+
+	return 0;
+}
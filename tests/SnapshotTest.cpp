@@ -0,0 +1,218 @@
+#include "Test.h"
+
+#include <pp/performance/Beatmap.h>
+#include <pp/performance/Snapshot.h>
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+using namespace pp;
+
+static const char* s_path = "SnapshotTest.snapshot";
+
+static const std::vector<std::string> s_tables = {
+	"osu_difficulty_attribs",
+	"osu_beatmap_difficulty_attribs",
+	"osu_beatmaps",
+	"osu_beatmap_performance_blacklist",
+	"sample_users",
+	"osu_user_stats",
+	"osu_scores_high",
+};
+
+static void writeDump(const std::string& table, const std::string& content)
+{
+	std::ofstream file{table + ".sql"};
+	file << content;
+	CHECK(file.good());
+}
+
+// Dumps in the format written by mysqldump, including escaped strings and columns the snapshot does not need
+static void writeDumps()
+{
+	writeDump("osu_difficulty_attribs",
+		"CREATE TABLE `osu_difficulty_attribs` (\n"
+		"  `attrib_id` smallint unsigned NOT NULL,\n"
+		"  `name` varchar(256) NOT NULL,\n"
+		"  `visible` tinyint(1) NOT NULL DEFAULT '0',\n"
+		"  PRIMARY KEY (`attrib_id`)\n"
+		") ENGINE=InnoDB;\n"
+		"INSERT INTO `osu_difficulty_attribs` VALUES (1,'Aim',1),(3,'Speed',1),(23,'It\\'s new',0);\n"
+	);
+
+	writeDump("osu_beatmap_difficulty_attribs",
+		"CREATE TABLE `osu_beatmap_difficulty_attribs` (\n"
+		"  `beatmap_id` mediumint unsigned NOT NULL,\n"
+		"  `mode` tinyint unsigned NOT NULL,\n"
+		"  `mods` int unsigned NOT NULL,\n"
+		"  `attrib_id` tinyint unsigned NOT NULL,\n"
+		"  `value` float DEFAULT NULL\n"
+		") ENGINE=InnoDB;\n"
+		"INSERT INTO `osu_beatmap_difficulty_attribs` VALUES (10,0,0,1,3.5),(10,0,64,3,2.25),(10,1,0,1,9),(10,0,0,23,1);\n"
+	);
+
+	writeDump("osu_beatmaps",
+		"CREATE TABLE `osu_beatmaps` (\n"
+		"  `beatmap_id` int unsigned NOT NULL,\n"
+		"  `version` varchar(80) NOT NULL,\n"
+		"  `countNormal` smallint unsigned NOT NULL DEFAULT '0',\n"
+		"  `countSlider` smallint unsigned NOT NULL DEFAULT '0',\n"
+		"  `countSpinner` smallint unsigned NOT NULL DEFAULT '0',\n"
+		"  `playmode` tinyint unsigned NOT NULL DEFAULT '0',\n"
+		"  `approved` tinyint NOT NULL DEFAULT '0',\n"
+		"  `score_version` tinyint unsigned NOT NULL DEFAULT '1'\n"
+		") ENGINE=InnoDB;\n"
+		"INSERT INTO `osu_beatmaps` VALUES (10,'Insane (it\\'s, hard)',500,200,2,0,1,1),(11,'Hard',NULL,100,1,0,2,1);\n"
+	);
+
+	writeDump("osu_beatmap_performance_blacklist",
+		"CREATE TABLE `osu_beatmap_performance_blacklist` (\n"
+		"  `beatmap_id` int unsigned NOT NULL,\n"
+		"  `mode` tinyint unsigned NOT NULL DEFAULT '0'\n"
+		");\n"
+		"INSERT INTO `osu_beatmap_performance_blacklist` VALUES (11,0),(10,1);\n"
+	);
+
+	writeDump("sample_users",
+		"CREATE TABLE `sample_users` (\n"
+		"  `user_id` int NOT NULL,\n"
+		"  `username` varchar(255) NOT NULL DEFAULT '',\n"
+		"  `user_warnings` tinyint NOT NULL DEFAULT '0'\n"
+		");\n"
+		"INSERT INTO `sample_users` VALUES (3,'a\\'b,c)',0),(5,'x',0),(9,'y',1);\n"
+	);
+
+	writeDump("osu_user_stats",
+		"CREATE TABLE `osu_user_stats` (\n"
+		"  `user_id` int unsigned NOT NULL,\n"
+		"  `rank_score` float unsigned NOT NULL,\n"
+		"  `last_played` timestamp NOT NULL\n"
+		") ENGINE=InnoDB;\n"
+		"INSERT INTO `osu_user_stats` VALUES (3,1000.5,'2099-01-01 00:00:00'),(5,800,'2001-01-01 00:00:00'),(9,NULL,'2099-01-01 00:00:00');\n"
+	);
+
+	// Scores arrive out of user order and are spread across several statements
+	writeDump("osu_scores_high",
+		"CREATE TABLE `osu_scores_high` (\n"
+		"  `score_id` bigint unsigned NOT NULL AUTO_INCREMENT,\n"
+		"  `beatmap_id` mediumint unsigned NOT NULL,\n"
+		"  `user_id` int unsigned NOT NULL,\n"
+		"  `score` int NOT NULL,\n"
+		"  `maxcombo` smallint unsigned NOT NULL,\n"
+		"  `rank` enum('A','B') NOT NULL,\n"
+		"  `count50` smallint unsigned NOT NULL,\n"
+		"  `count100` smallint unsigned NOT NULL,\n"
+		"  `count300` smallint unsigned NOT NULL,\n"
+		"  `countmiss` smallint unsigned NOT NULL,\n"
+		"  `countgeki` smallint unsigned NOT NULL,\n"
+		"  `countkatu` smallint unsigned NOT NULL,\n"
+		"  `enabled_mods` smallint unsigned NOT NULL,\n"
+		"  `pp` float DEFAULT NULL\n"
+		") ENGINE=InnoDB;\n"
+		"INSERT INTO `osu_scores_high` VALUES (1,10,5,1000,100,'S',1,2,300,0,3,4,64,120.5),(2,10,3,2000,200,'A',0,0,400,1,0,0,8,NULL);\n"
+		"INSERT INTO `osu_scores_high` VALUES (3,11,5,3000,300,'S',0,1,500,2,0,0,0,80.25);\n"
+	);
+}
+
+static void removeFiles()
+{
+	for (const auto& table : s_tables)
+		std::remove((table + ".sql").c_str());
+
+	std::remove(s_path);
+}
+
+static void testRoundTrip()
+{
+	writeDumps();
+	Snapshot::Convert(EGamemode::Osu, ".", "rank_score", s_path);
+
+	Snapshot snapshot{s_path};
+	CHECK(snapshot.Gamemode() == EGamemode::Osu);
+
+	// Attributes of other gamemodes and of unsupported types are left out
+	auto attribBeatmapIds = snapshot.Get<s32>("attribs.beatmap_id");
+	auto attribMods = snapshot.Get<u32>("attribs.mods");
+	auto attribTypes = snapshot.Get<byte>("attribs.type");
+	auto attribValues = snapshot.Get<f32>("attribs.value");
+	CHECK(attribBeatmapIds.Size == 2);
+	CHECK(attribBeatmapIds[0] == 10 && attribMods[0] == 0 && attribTypes[0] == Beatmap::Aim && attribValues[0] == 3.5f);
+	CHECK(attribBeatmapIds[1] == 10 && attribMods[1] == 64 && attribTypes[1] == Beatmap::Speed && attribValues[1] == 2.25f);
+
+	auto beatmapIds = snapshot.Get<s32>("beatmaps.beatmap_id");
+	auto approved = snapshot.Get<s32>("beatmaps.approved");
+	auto numCircles = snapshot.Get<s32>("beatmaps.countNormal");
+	auto numSliders = snapshot.Get<s32>("beatmaps.countSlider");
+	CHECK(beatmapIds.Size == 2);
+	CHECK(beatmapIds[0] == 10 && approved[0] == 1 && numCircles[0] == 500 && numSliders[0] == 200);
+	CHECK(beatmapIds[1] == 11 && approved[1] == 2 && numCircles[1] == 0 && numSliders[1] == 100);
+
+	auto blacklist = snapshot.Get<s32>("blacklist.beatmap_id");
+	CHECK(blacklist.Size == 1 && blacklist[0] == 11);
+
+	// Restricted and inactive users are unranked
+	auto userIds = snapshot.Get<s64>("users.user_id");
+	auto userPP = snapshot.Get<f64>("users.pp");
+	auto isRanked = snapshot.Get<byte>("users.ranked");
+	CHECK(userIds.Size == 3);
+	CHECK(userIds[0] == 3 && userPP[0] == 1000.5 && isRanked[0]);
+	CHECK(userIds[1] == 5 && userPP[1] == 800 && !isRanked[1]);
+	CHECK(userIds[2] == 9 && std::isnan(userPP[2]) && !isRanked[2]);
+
+	// Scores are ordered by user, and by score within a user
+	auto scoreIds = snapshot.Get<s64>("scores.score_id");
+	auto scoreUserIds = snapshot.Get<s64>("scores.user_id");
+	auto scoreBeatmapIds = snapshot.Get<s32>("scores.beatmap_id");
+	auto num300 = snapshot.Get<s32>("scores.count300");
+	auto numGeki = snapshot.Get<s32>("scores.countgeki");
+	auto mods = snapshot.Get<u32>("scores.enabled_mods");
+	auto scorePP = snapshot.Get<f32>("scores.pp");
+	CHECK(scoreIds.Size == 3);
+	CHECK(scoreIds[0] == 2 && scoreUserIds[0] == 3 && mods[0] == 8 && std::isnan(scorePP[0]));
+	CHECK(scoreIds[1] == 1 && scoreUserIds[1] == 5 && scoreBeatmapIds[1] == 10 && num300[1] == 300 && numGeki[1] == 3 && scorePP[1] == 120.5f);
+	CHECK(scoreIds[2] == 3 && scoreUserIds[2] == 5 && scoreBeatmapIds[2] == 11 && scorePP[2] == 80.25f);
+
+	// Columns are only handed out with their own element size
+	bool hasThrown = false;
+	try
+	{
+		snapshot.Get<s32>("scores.score_id");
+	}
+	catch (const SnapshotException&)
+	{
+		hasThrown = true;
+	}
+
+	CHECK(hasThrown);
+}
+
+static void testInvalidFile()
+{
+	{
+		std::ofstream file{s_path};
+		file << "Not a snapshot, but long enough to hold a header of one.";
+	}
+
+	bool hasThrown = false;
+	try
+	{
+		Snapshot snapshot{s_path};
+	}
+	catch (const SnapshotException&)
+	{
+		hasThrown = true;
+	}
+
+	CHECK(hasThrown);
+}
+
+int main()
+{
+	testRoundTrip();
+	testInvalidFile();
+
+	removeFiles();
+	return 0;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <pp/Common.h>
+
+#include <cstdlib>
+#include <iostream>
+
+// Tests are plain executables which exit with a non-zero code as soon as a check fails.
+#define CHECK(condition)                                                                                  \
+	do                                                                                                    \
+	{                                                                                                     \
+		if (!(condition))                                                                                 \
+		{                                                                                                 \
+			std::cerr << __FILE__ << ":" << __LINE__ << " - Check failed: " << #condition << std::endl; \
+			std::exit(1);                                                                                 \
+		}                                                                                                 \
+	} while (false)
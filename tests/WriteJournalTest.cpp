@@ -0,0 +1,181 @@
+#include "Test.h"
+
+#include <pp/shared/WriteJournal.h>
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace pp;
+using namespace std::chrono;
+
+static const char* s_path = "WriteJournalTest.journal";
+
+// Writes which were not completed are handed back in order after a restart
+static void testReplay()
+{
+	std::remove(s_path);
+
+	{
+		WriteJournal journal{s_path, milliseconds{10}};
+		CHECK(journal.TakeUnfinished().empty());
+
+		u64 first = journal.Append(1, "UPDATE a");
+		u64 second = journal.Append(2, "UPDATE b");
+		u64 third = journal.Append(1, "UPDATE c");
+
+		journal.Complete(second);
+		CHECK(journal.NumOutstanding() == 2);
+		CHECK(first < third);
+	}
+
+	{
+		WriteJournal journal{s_path, milliseconds{10}};
+		auto unfinished = journal.TakeUnfinished();
+
+		CHECK(unfinished.size() == 2);
+		CHECK(unfinished[0].OrderingKey == 1 && unfinished[0].Statement == "UPDATE a");
+		CHECK(unfinished[1].OrderingKey == 1 && unfinished[1].Statement == "UPDATE c");
+
+		// Replayed writes stay in the journal until they are completed
+		journal.Complete(unfinished[0].Sequence);
+	}
+
+	WriteJournal journal{s_path, milliseconds{10}};
+	auto unfinished = journal.TakeUnfinished();
+
+	CHECK(unfinished.size() == 1);
+	CHECK(unfinished[0].Statement == "UPDATE c");
+}
+
+// A torn record at the end is dropped, leaving the prefix before it intact
+static void testTruncatedTail()
+{
+	std::remove(s_path);
+
+	{
+		WriteJournal journal{s_path, milliseconds{10}};
+		journal.Append(1, "UPDATE a");
+		journal.Append(1, "UPDATE b");
+	}
+
+	// Simulates a crash in the middle of writing the last record
+	std::FILE* pFile = std::fopen(s_path, "rb");
+	CHECK(pFile);
+	std::vector<char> content;
+	char buffer[4096];
+	size_t numRead;
+	while ((numRead = std::fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+		content.insert(std::end(content), buffer, buffer + numRead);
+	std::fclose(pFile);
+
+	pFile = std::fopen(s_path, "wb");
+	CHECK(pFile);
+	CHECK(std::fwrite(content.data(), 1, content.size() - 3, pFile) == content.size() - 3);
+	std::fclose(pFile);
+
+	WriteJournal journal{s_path, milliseconds{10}};
+	auto unfinished = journal.TakeUnfinished();
+
+	CHECK(unfinished.size() == 1);
+	CHECK(unfinished[0].Statement == "UPDATE a");
+}
+
+// Writes which keep failing are set aside after a few replays rather than being replayed forever
+static void testRejection()
+{
+	std::string rejectedPath = std::string{s_path} + ".rejected";
+
+	std::remove(s_path);
+	std::remove(rejectedPath.c_str());
+
+	{
+		WriteJournal journal{s_path, milliseconds{10}};
+		journal.Append(1, "UPDATE a");
+		journal.Append(2, "UPDATE b");
+	}
+
+	// Each restart replays both writes, but only the second one succeeds eventually
+	for (int i = 0; i < 3; ++i)
+	{
+		WriteJournal journal{s_path, milliseconds{10}};
+		auto unfinished = journal.TakeUnfinished();
+
+		CHECK(unfinished.size() == (i == 0 ? 2 : 1));
+		CHECK(unfinished[0].Statement == "UPDATE a");
+
+		if (i == 0)
+			journal.Complete(unfinished[1].Sequence);
+	}
+
+	{
+		WriteJournal journal{s_path, milliseconds{10}};
+		CHECK(journal.TakeUnfinished().empty());
+	}
+
+	std::FILE* pFile = std::fopen(rejectedPath.c_str(), "rb");
+	CHECK(pFile);
+	char buffer[4096];
+	size_t numRead = std::fread(buffer, 1, sizeof(buffer), pFile);
+	std::fclose(pFile);
+
+	CHECK(std::string(buffer, numRead).find("UPDATE a") != std::string::npos);
+	CHECK(std::string(buffer, numRead).find("UPDATE b") == std::string::npos);
+
+	std::remove(rejectedPath.c_str());
+}
+
+// Once mostly completed writes make up a large journal, only the outstanding ones are kept
+static void testCompaction()
+{
+	std::remove(s_path);
+
+	std::vector<u64> outstanding;
+	{
+		WriteJournal journal{s_path, milliseconds{10}};
+
+		std::string statement(1024 * 1024, 'x');
+		for (u32 i = 0; i < 200; ++i)
+		{
+			statement[0] = (char)('a' + i % 26);
+
+			u64 sequence = journal.Append(i, statement);
+			if (i % 50 == 3)
+				outstanding.emplace_back(i);
+			else
+				journal.Complete(sequence);
+		}
+
+		CHECK(journal.NumOutstanding() == outstanding.size());
+
+		// Compaction happens in the background
+		auto deadline = steady_clock::now() + seconds{10};
+		while (journal.Size() >= 70ull * 1024 * 1024 && steady_clock::now() < deadline)
+			std::this_thread::sleep_for(milliseconds{10});
+
+		CHECK(journal.Size() < 70ull * 1024 * 1024);
+	}
+
+	WriteJournal journal{s_path, milliseconds{10}};
+	auto unfinished = journal.TakeUnfinished();
+
+	CHECK(unfinished.size() == outstanding.size());
+	for (size_t i = 0; i < unfinished.size(); ++i)
+	{
+		CHECK(unfinished[i].OrderingKey == outstanding[i]);
+		CHECK(unfinished[i].Statement.size() == 1024 * 1024);
+		CHECK(unfinished[i].Statement[0] == (char)('a' + outstanding[i] % 26));
+	}
+}
+
+int main()
+{
+	testReplay();
+	testTruncatedTail();
+	testRejection();
+	testCompaction();
+
+	std::remove(s_path);
+	return 0;
+}